@@ -1,5 +1,6 @@
 C:/VulkanSDK/1.1.92.1/Bin/glslangValidator.exe -V nbodyDouble.comp -o dcomp.spv
 C:/VulkanSDK/1.1.92.1/Bin/glslangValidator.exe -V nbody.comp -o comp.spv
+C:/VulkanSDK/1.1.92.1/Bin/glslangValidator.exe -V leapfrog.comp -o lcomp.spv
 
 
 pause
\ No newline at end of file
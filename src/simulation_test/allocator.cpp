@@ -0,0 +1,316 @@
+#include "allocator.h"
+#include <algorithm>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void DeviceAllocator::init(VkPhysicalDevice physicalDevice, VkDevice dev)
+{
+	device = dev;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+uint32_t DeviceAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	// check and return index if desired properties are found.
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("Failed to fins suitable memory type!");
+}
+
+uint32_t DeviceAllocator::findPool(uint32_t memoryType, ALLOCATION_STRATEGY strategy, bool image)
+{
+	for (uint32_t i = 0; i < pools.size(); i++)
+	{
+		if (pools[i].memoryType == memoryType && pools[i].strategy == strategy && pools[i].image == image)
+			return i;
+	}
+
+	// no more than an eighth of the heap per block, still a power of two for the buddy orders
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+	VkDeviceSize blockSize = ALLOCATOR_BLOCK_SIZE;
+	while (blockSize > (VkDeviceSize(1) << 20) && blockSize > heapSize / 8)
+		blockSize >>= 1;
+
+	Pool pool;
+	pool.memoryType = memoryType;
+	pool.strategy = strategy;
+	pool.image = image;
+	pool.blockSize = blockSize;
+	pools.push_back(pool);
+
+	return static_cast<uint32_t>(pools.size() - 1);
+}
+
+DeviceAllocator::Block DeviceAllocator::createBlock(uint32_t memoryType, VkDeviceSize size)
+{
+	Block block;
+	block.size = size;
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate device memory block");
+
+	// mapped once for good - a memory object can't be mapped twice, and its allocations are
+	if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* data;
+		if (vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+		{
+			vkFreeMemory(device, block.memory, nullptr);
+			throw std::runtime_error("Failed to map device memory block");
+		}
+		block.mapped = static_cast<uint8_t*>(data);
+	}
+
+	return block;
+}
+
+Allocation DeviceAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size)
+{
+	Block block = createBlock(memoryType, size);
+
+	Allocation allocation;
+	allocation.memory = block.memory;
+	allocation.size = size;
+	allocation.mapped = block.mapped;
+	allocation.dedicated = true;
+
+	dedicatedCount++;
+	dedicatedBytes += size;
+	return allocation;
+}
+
+bool DeviceAllocator::allocateBuddy(Pool& pool, uint32_t blockIndex, uint32_t order, Allocation& allocation)
+{
+	Block& block = pool.blocks[blockIndex];
+
+	// smallest free node that fits
+	uint32_t k = order;
+	while (k < block.freeNodes.size() && block.freeNodes[k].empty())
+		k++;
+
+	if (k >= block.freeNodes.size())
+		return false;
+
+	VkDeviceSize offset = *block.freeNodes[k].begin();
+	block.freeNodes[k].erase(block.freeNodes[k].begin());
+
+	// split it down to size, the upper halves stay free
+	while (k > order)
+	{
+		k--;
+		block.freeNodes[k].insert(offset + (ALLOCATOR_MIN_NODE << k));
+	}
+
+	allocation.offset = offset;
+	allocation.order = order;
+	allocatedBytes += ALLOCATOR_MIN_NODE << order;
+	return true;
+}
+
+bool DeviceAllocator::allocateLinear(Pool& pool, uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation)
+{
+	Block& block = pool.blocks[blockIndex];
+
+	VkDeviceSize offset = alignUp(block.top, alignment);
+	if (offset + size > block.size)
+		return false;
+
+	block.top = offset + size;
+	allocation.offset = offset;
+	allocatedBytes += size;
+	return true;
+}
+
+Allocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool image,
+	ALLOCATION_STRATEGY strategy)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	uint32_t poolIndex = findPool(memoryType, strategy, image);
+	Pool& pool = pools[poolIndex];
+
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+	// anything over half a block would leave most of one unusable
+	Allocation allocation;
+	if (requirements.size > pool.blockSize / 2)
+	{
+		allocation = allocateDedicated(memoryType, requirements.size);
+	}
+	else
+	{
+		// buddy nodes sit at multiples of their own size, so a node at least as big as the alignment is aligned
+		uint32_t order = 0;
+		while ((ALLOCATOR_MIN_NODE << order) < std::max(requirements.size, alignment))
+			order++;
+
+		auto fits = [&](uint32_t b)
+		{
+			return strategy == ALLOCATE_BUDDY ? allocateBuddy(pool, b, order, allocation)
+				: allocateLinear(pool, b, requirements.size, alignment, allocation);
+		};
+
+		uint32_t blockIndex = 0;
+		while (blockIndex < pool.blocks.size() && !fits(blockIndex))
+			blockIndex++;
+
+		if (blockIndex == pool.blocks.size())
+		{
+			Block block = createBlock(memoryType, pool.blockSize);
+
+			// all of it one free node
+			if (strategy == ALLOCATE_BUDDY)
+			{
+				uint32_t orders = 0;
+				while ((ALLOCATOR_MIN_NODE << orders) < pool.blockSize)
+					orders++;
+				block.freeNodes.resize(orders + 1);
+				block.freeNodes[orders].insert(0);
+			}
+
+			pool.blocks.push_back(block);
+			fits(blockIndex);
+		}
+
+		Block& block = pool.blocks[blockIndex];
+		block.live++;
+
+		allocation.memory = block.memory;
+		allocation.mapped = block.mapped ? block.mapped + allocation.offset : nullptr;
+		allocation.pool = poolIndex;
+		allocation.block = blockIndex;
+	}
+
+	allocation.size = requirements.size;
+	usedBytes += requirements.size;
+	allocationCount++;
+
+	return allocation;
+}
+
+void DeviceAllocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	usedBytes -= allocation.size;
+	allocationCount--;
+
+	if (allocation.dedicated)
+	{
+		vkFreeMemory(device, allocation.memory, nullptr);
+		dedicatedCount--;
+		dedicatedBytes -= allocation.size;
+		allocation = Allocation();
+		return;
+	}
+
+	Pool& pool = pools[allocation.pool];
+	Block& block = pool.blocks[allocation.block];
+	block.live--;
+
+	if (pool.strategy == ALLOCATE_LINEAR)
+	{
+		allocatedBytes -= allocation.size;
+
+		// everything in it is gone, start from the bottom again
+		if (block.live == 0)
+			block.top = 0;
+	}
+	else
+	{
+		allocatedBytes -= ALLOCATOR_MIN_NODE << allocation.order;
+
+		// merge with the buddy for as long as it is free too
+		VkDeviceSize offset = allocation.offset;
+		uint32_t order = allocation.order;
+		while (order + 1 < block.freeNodes.size())
+		{
+			VkDeviceSize buddy = offset ^ (ALLOCATOR_MIN_NODE << order);
+			auto it = block.freeNodes[order].find(buddy);
+			if (it == block.freeNodes[order].end())
+				break;
+
+			block.freeNodes[order].erase(it);
+			offset = std::min(offset, buddy);
+			order++;
+		}
+
+		block.freeNodes[order].insert(offset);
+	}
+
+	allocation = Allocation();
+}
+
+AllocatorStats DeviceAllocator::stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	AllocatorStats s;
+	s.allocated = allocatedBytes + dedicatedBytes;
+	s.used = usedBytes;
+	s.allocations = allocationCount;
+	s.dedicated = dedicatedCount;
+	s.reserved = dedicatedBytes;
+
+	VkDeviceSize freeBytes = 0, largestFree = 0;
+	for (auto &pool : pools)
+	{
+		for (auto &block : pool.blocks)
+		{
+			s.reserved += block.size;
+			s.blocks++;
+
+			if (pool.strategy != ALLOCATE_BUDDY)
+				continue;
+
+			VkDeviceSize largest = 0;
+			for (uint32_t order = 0; order < block.freeNodes.size(); order++)
+			{
+				freeBytes += block.freeNodes[order].size() * (ALLOCATOR_MIN_NODE << order);
+				if (!block.freeNodes[order].empty())
+					largest = ALLOCATOR_MIN_NODE << order;
+			}
+			largestFree += largest;
+		}
+	}
+
+	if (freeBytes)
+		s.fragmentation = 1.0f - static_cast<float>(double(largestFree) / double(freeBytes));
+
+	return s;
+}
+
+void DeviceAllocator::destroy()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	// freeing the memory unmaps it too
+	for (auto &pool : pools)
+	{
+		for (auto &block : pool.blocks)
+			vkFreeMemory(device, block.memory, nullptr);
+	}
+
+	pools.clear();
+	allocatedBytes = usedBytes = dedicatedBytes = 0;
+	allocationCount = dedicatedCount = 0;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <cstdint>
+
+// device memory is reserved in large blocks per memory type and handed out in pieces, rather than one
+// vkAllocateMemory per buffer - drivers cap the allocation count and each allocation is slow.
+// buffers and images get separate blocks so bufferImageGranularity never applies between neighbours
+
+// block size, smaller on small heaps
+const VkDeviceSize ALLOCATOR_BLOCK_SIZE = VkDeviceSize(64) << 20;
+
+// smallest buddy node - every allocation is rounded up to a power of two at least this big
+const VkDeviceSize ALLOCATOR_MIN_NODE = 256;
+
+enum ALLOCATION_STRATEGY
+{
+	ALLOCATE_BUDDY,		// general purpose, freed in any order
+	ALLOCATE_LINEAR		// short lived (staging) - bumped off the end, the block rewinds once all of it is freed
+};
+
+struct Allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;	// the block's memory, shared - bind at offset, never free it
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;					// what was asked for
+	void* mapped = nullptr;					// host visible memory is persistently mapped, this is offset's address
+
+	uint32_t pool = UINT32_MAX;				// where it came from, to give it back
+	uint32_t block = 0;
+	uint32_t order = 0;						// buddy node size is ALLOCATOR_MIN_NODE << order
+	bool dedicated = false;					// has memory to itself, freed with it
+};
+
+struct AllocatorStats
+{
+	VkDeviceSize reserved = 0;		// bytes of device memory allocated from the driver
+	VkDeviceSize allocated = 0;		// bytes handed out, after rounding to nodes and alignment
+	VkDeviceSize used = 0;			// bytes asked for
+	size_t blocks = 0;
+	size_t allocations = 0;
+	size_t dedicated = 0;			// allocations too big for a block, given their own memory
+
+	// 1 - largest free node / free bytes, over the buddy blocks. 0 when all the free space is in one piece per block
+	float fragmentation = 0.0f;
+};
+
+class DeviceAllocator
+{
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint8_t* mapped = nullptr;
+		size_t live = 0;						// allocations in it
+
+		std::vector<std::set<VkDeviceSize>> freeNodes;	// buddy - free node offsets per order
+		VkDeviceSize top = 0;					// linear - end of the last allocation
+	};
+
+	// one per memory type, strategy and resource kind
+	struct Pool
+	{
+		uint32_t memoryType;
+		ALLOCATION_STRATEGY strategy;
+		bool image;
+		VkDeviceSize blockSize;
+		std::vector<Block> blocks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+
+	std::vector<Pool> pools;
+	std::mutex lock;
+
+	// counters kept as allocations come and go
+	VkDeviceSize allocatedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	size_t allocationCount = 0;
+	size_t dedicatedCount = 0;
+	VkDeviceSize dedicatedBytes = 0;
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	uint32_t findPool(uint32_t memoryType, ALLOCATION_STRATEGY strategy, bool image);
+	Block createBlock(uint32_t memoryType, VkDeviceSize size);
+	Allocation allocateDedicated(uint32_t memoryType, VkDeviceSize size);
+
+	bool allocateBuddy(Pool& pool, uint32_t blockIndex, uint32_t order, Allocation& allocation);
+	bool allocateLinear(Pool& pool, uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice dev);
+
+	// memory for a resource with these requirements. image is true for optimally tiled images
+	Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool image,
+		ALLOCATION_STRATEGY strategy = ALLOCATE_BUDDY);
+
+	// give it back and clear it. a null allocation is ignored
+	void free(Allocation& allocation);
+
+	AllocatorStats stats();
+
+	// free every block - everything allocated from them must already be destroyed
+	void destroy();
+};
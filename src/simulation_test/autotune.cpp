@@ -0,0 +1,138 @@
+#include "autotune.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+bool TuneKey::operator==(const TuneKey& other) const
+{
+	return shader == other.shader &&
+		vendorID == other.vendorID &&
+		deviceID == other.deviceID &&
+		driverVersion == other.driverVersion &&
+		particleBucket == other.particleBucket;
+}
+
+TuneCache::TuneCache(const std::string& file) : fileName(file)
+{
+	load();
+}
+
+void TuneCache::load()
+{
+	entries.clear();
+	std::ifstream in(fileName);
+
+	// no file yet is fine - nothing has been tuned
+	if (!in.is_open())
+		return;
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+		// skip comments and blank lines
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		// lines from before the shader was part of the key are one field short and dropped
+		std::istringstream fields(line);
+		Entry e;
+		if (fields >> e.key.shader >> e.key.vendorID >> e.key.deviceID >> e.key.driverVersion >> e.key.particleBucket
+			>> e.result.workGroupSize >> e.result.sharedDataSize)
+		{
+			entries.push_back(e);
+		}
+	}
+}
+
+bool TuneCache::find(const TuneKey& key, TuneResult& result) const
+{
+	for (auto &e : entries)
+	{
+		if (e.key == key)
+		{
+			result = e.result;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TuneCache::store(const TuneKey& key, const TuneResult& result)
+{
+	// runs started alongside this one may have tuned other keys since it was read
+	load();
+
+	bool replaced = false;
+	for (auto &e : entries)
+	{
+		if (e.key == key)
+		{
+			e.result = result;
+			replaced = true;
+		}
+	}
+
+	if (!replaced)
+		entries.push_back({ key, result });
+
+	// written beside the file and renamed over it, so a run starting now never reads half a cache
+	std::stringstream temporary;
+#ifdef _WIN32
+	temporary << fileName << "." << GetCurrentProcessId() << ".tmp";
+#else
+	temporary << fileName << "." << getpid() << ".tmp";
+#endif
+
+	{
+		std::ofstream out(temporary.str(), std::ofstream::out | std::ofstream::trunc);
+		out << "# shader vendor device driver particleBucket workGroupSize sharedDataSize" << std::endl;
+
+		for (auto &e : entries)
+		{
+			out << e.key.shader << " " << e.key.vendorID << " " << e.key.deviceID << " " << e.key.driverVersion << " " << e.key.particleBucket << " "
+				<< e.result.workGroupSize << " " << e.result.sharedDataSize << std::endl;
+		}
+
+		if (!out)
+		{
+			// the next run just tunes again
+			std::cerr << "failed to write autotune cache " << temporary.str() << std::endl;
+			out.close();
+			std::remove(temporary.str().c_str());
+			return;
+		}
+	}
+
+#ifdef _WIN32
+	bool renamed = MoveFileExA(temporary.str().c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool renamed = rename(temporary.str().c_str(), fileName.c_str()) == 0;
+#endif
+
+	if (!renamed)
+	{
+		std::cerr << "failed to replace autotune cache " << fileName << std::endl;
+		std::remove(temporary.str().c_str());
+	}
+}
+
+uint32_t TuneCache::particleBucket(uint32_t particleCount)
+{
+	uint32_t bucket = 0;
+	while (particleCount > 1)
+	{
+		particleCount >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
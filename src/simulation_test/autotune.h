@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// where the autotuner keeps its results between runs
+const std::string TUNE_CACHE_FILE = "autotune.cache";
+
+// candidate workgroup sizes and tile sizes (as multiples of the workgroup size)
+const uint32_t TUNE_GROUP_SIZES[] = { 32, 64, 128, 256, 512, 1024 };
+const uint32_t TUNE_TILE_SCALES[] = { 1, 2, 4 };
+
+// dispatches timed per candidate
+const int TUNE_RUNS = 5;
+
+// what a tuning result is valid for
+struct TuneKey
+{
+	std::string shader;			// the compute shader's file - each one tunes differently
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint32_t particleBucket;	// log2 of the particle count
+
+	bool operator==(const TuneKey& other) const;
+};
+
+struct TuneResult
+{
+	uint32_t workGroupSize;
+	uint32_t sharedDataSize;
+};
+
+// small text file of key -> result lines, one per shader/device/driver/particle bucket
+class TuneCache
+{
+	std::string fileName;
+
+	struct Entry
+	{
+		TuneKey key;
+		TuneResult result;
+	};
+
+	std::vector<Entry> entries;
+
+	// entries as the file has them now
+	void load();
+
+public:
+	TuneCache(const std::string& file);
+
+	bool find(const TuneKey& key, TuneResult& result) const;
+
+	// add or replace the entry in what's on disk now, and swap the file for one with it in
+	void store(const TuneKey& key, const TuneResult& result);
+
+	static uint32_t particleBucket(uint32_t particleCount);
+};
@@ -0,0 +1,84 @@
+#include "simulation.h"
+#include "nbody.h"
+#include "force-law.h"
+#include "threadpool.h"
+
+// particles per traversal task, walked in tree order so neighbours share the cells they open
+static const size_t WALK_CHUNK = 256;
+
+bh_simulation::bh_simulation(const parameters& param, const std::vector<particle>& initial)
+	: cpu_simulation(param, initial), theta(param.theta)
+{
+	std::cout << "Barnes-Hut opening angle: " << theta << std::endl;
+}
+
+void bh_simulation::computeForces()
+{
+	loadPositions();
+
+	tree.build(posX.data(), posY.data(), posZ.data(), particles.size());
+
+	walkTree();
+}
+
+void bh_simulation::walkTree()
+{
+	const float theta2 = theta * theta;
+
+	ThreadPool::get()->parallelFor(0, particles.size(), WALK_CHUNK, [&](size_t begin, size_t end)
+	{
+		std::vector<uint32_t> stack;
+		stack.reserve(8 * Octree::MAX_DEPTH);
+
+		for (size_t k = begin; k < end; k++)
+		{
+			uint32_t i = tree.order[k];
+			glm::vec3 p(posX[i], posY[i], posZ[i]);
+			glm::vec3 acceleration(0.0f);
+
+			stack.clear();
+			stack.push_back(0);
+
+			while (!stack.empty())
+			{
+				const OctreeNode& node = tree.nodes[stack.back()];
+				stack.pop_back();
+
+				glm::vec3 d = node.centre - p;
+				float d2 = glm::dot(d, d);
+
+				// far enough away (size / distance < theta) - the whole cell acts as one point. a cell holding
+				// the particle itself is always opened, or it would pull on itself through the monopole
+				bool holdsSelf = k >= node.first && k < node.first + node.count;
+				if (!holdsSelf && node.size * node.size < theta2 * d2)
+				{
+					acceleration += d * (pairScale(d2) * static_cast<float>(node.count));
+					continue;
+				}
+
+				if (node.childCount == 0)
+				{
+					// too close to approximate, sum the leaf directly
+					for (uint32_t m = node.first; m < node.first + node.count; m++)
+					{
+						if (tree.order[m] == i)
+							continue;
+
+						glm::vec3 dj(tree.x[m] - p.x, tree.y[m] - p.y, tree.z[m] - p.z);
+						acceleration += dj * pairScale(glm::dot(dj, dj));
+					}
+					continue;
+				}
+
+				for (uint32_t c = 0; c < node.childCount; c++)
+				{
+					stack.push_back(node.firstChild + c);
+				}
+			}
+
+			accX[i] = acceleration.x;
+			accY[i] = acceleration.y;
+			accZ[i] = acceleration.z;
+		}
+	});
+}
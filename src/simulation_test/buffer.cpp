@@ -1,14 +1,15 @@
 #include "buffer.h"
 #include "nbody.h"
 #include "renderer.h"
+#include "morton.h"
 #include <array>
+#include <numeric>
 
 BufferObject::~BufferObject()
 {
 	for (int i = 0; i < buffer.size(); i++)
 	{
-		vkDestroyBuffer(*dev, buffer[i], nullptr);
-		vkFreeMemory(*dev, memory[i], nullptr);
+		Renderer::get()->destroyBuffer(buffer[i], memory[i]);
 	}
 }
 
@@ -20,31 +21,12 @@ void VertexBO::createSpecificBuffer()
 	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 	size = (size_t)bufferSize;
 
-	// create a staging buffer as a temp buffer and then the *dev has a local vertex  buffer.
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-	// copy data to buffer
-	void* data;
-	// map buffer memory to the cpu
-	vkMapMemory(*dev, stagingBufferMemory, 0, bufferSize, 0, &data);
-
-	// Copy vertex data into the mapped memory
-	memcpy(data, vertices.data(), size);
-
-	// unmap buffer
-	vkUnmapMemory(*dev, stagingBufferMemory);
-
 	// create vertex buffer
 	Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer[bufferIndex], memory[bufferIndex]);
 
-	// local so can't use map., so have to copy data between buffers.
-	Renderer::get()->copyBuffer(stagingBuffer, buffer[bufferIndex], bufferSize);
-
-	// clean up staging buffer
-	vkDestroyBuffer(*dev, stagingBuffer, nullptr);
-	vkFreeMemory(*dev, stagingBufferMemory, nullptr);
+	// local so can't use map., the upload manager stages it and copies it over.
+	// the copy is only queued - the renderer waits on it before the first frame
+	Renderer::get()->uploads.upload(buffer[bufferIndex], vertices.data(), bufferSize);
 }
 
 void IndexBO::createSpecificBuffer()
@@ -56,22 +38,10 @@ void IndexBO::createSpecificBuffer()
 	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 	size = indices.size();
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(*dev, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(*dev, stagingBufferMemory);
-
 	// note usage is INDEX buffer. 
 	Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer[bufferIndex], memory[bufferIndex]);
 
-	Renderer::get()->copyBuffer(stagingBuffer, buffer[bufferIndex], bufferSize);
-
-	vkDestroyBuffer(*dev, stagingBuffer, nullptr);
-	vkFreeMemory(*dev, stagingBufferMemory, nullptr);
+	Renderer::get()->uploads.upload(buffer[bufferIndex], indices.data(), bufferSize);
 }
 
 void InstanceBO::createSpecificBuffer()
@@ -83,18 +53,12 @@ void InstanceBO::createSpecificBuffer()
 	VkDeviceSize bufferSize = sizeof(particles[0]) * particles.size();
 	size = particles.size();
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	Renderer::get()->createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(*dev, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, particles.data(), (size_t)bufferSize);
-	vkUnmapMemory(*dev, stagingBufferMemory);
+	// a restart brings its own ids
+	if (ids.size() != particles.size())
+	{
+		ids.resize(particles.size());
+		std::iota(ids.begin(), ids.end(), 0u);
+	}
 
 	// note usage is INDEX buffer. and storage for compute
 	Renderer::get()->createBuffer(bufferSize,
@@ -104,10 +68,7 @@ void InstanceBO::createSpecificBuffer()
 		buffer[bufferIndex],
 		memory[bufferIndex]);
 
-	Renderer::get()->copyBuffer(stagingBuffer, buffer[bufferIndex], bufferSize);
-
-	vkDestroyBuffer(*dev, stagingBuffer, nullptr);
-	vkFreeMemory(*dev, stagingBufferMemory, nullptr);
+	Renderer::get()->uploads.upload(buffer[bufferIndex], particles.data(), bufferSize);
 }
 
 void InstanceBO::createDrawStorage()
@@ -120,31 +81,100 @@ void InstanceBO::createDrawStorage()
 	VkDeviceSize bufferSize = sizeof(particles[0]) * particles.size();
 	size = particles.size();
 
+	// note usage is INDEX buffer. and storage for compute
+	Renderer::get()->createBuffer(bufferSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		//  for getting data back VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		buffer[bufferIndex+1],  // +1 for draw storage
+		memory[bufferIndex+1]);
+
+	Renderer::get()->uploads.upload(buffer[bufferIndex+1], particles.data(), bufferSize);
+}
+
+void InstanceBO::sortByMorton(const std::vector<VkBuffer>& perParticle)
+{
+	VkDeviceSize bufferSize = sizeof(particle) * size;
+
 	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	Allocation stagingBufferMemory;
 	Renderer::get()->createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		stagingBuffer,
-		stagingBufferMemory);
+		stagingBufferMemory,
+		ALLOCATE_LINEAR);
 
-	void* data;
-	vkMapMemory(*dev, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, particles.data(), (size_t)bufferSize);
-	vkUnmapMemory(*dev, stagingBufferMemory);
+	void* data = stagingBufferMemory.mapped;
 
-	// note usage is INDEX buffer. and storage for compute
+	// every copy (draw storage or the other half of a double buffer) gets the same permutation,
+	// taken from the first, so slot i still means the same particle in all of them
+	std::vector<uint32_t> order;
+	std::vector<particle> contents(size);
+
+	for (size_t b = 0; b < buffer.size(); b++)
+	{
+		Renderer::get()->copyBuffer(buffer[b], stagingBuffer, bufferSize);
+		memcpy(contents.data(), data, (size_t)bufferSize);
+
+		if (b == 0)
+		{
+			std::vector<float> x(size), y(size), z(size);
+			for (size_t i = 0; i < size; i++)
+			{
+				x[i] = contents[i].pos.x;
+				y[i] = contents[i].pos.y;
+				z[i] = contents[i].pos.z;
+			}
+
+			mortonOrder(x.data(), y.data(), z.data(), size, order);
+			applyOrder(ids, order);
+		}
+
+		applyOrder(contents, order);
+		memcpy(data, contents.data(), (size_t)bufferSize);
+		Renderer::get()->copyBuffer(stagingBuffer, buffer[b], bufferSize);
+	}
+
+	// smaller than a particle, so they fit the same staging buffer
+	VkDeviceSize vec4Size = sizeof(glm::vec4) * size;
+	std::vector<glm::vec4> values(size);
+
+	for (VkBuffer other : perParticle)
+	{
+		Renderer::get()->copyBuffer(other, stagingBuffer, vec4Size);
+		memcpy(values.data(), data, (size_t)vec4Size);
+
+		applyOrder(values, order);
+		memcpy(data, values.data(), (size_t)vec4Size);
+		Renderer::get()->copyBuffer(stagingBuffer, other, vec4Size);
+	}
+
+	Renderer::get()->destroyBuffer(stagingBuffer, stagingBufferMemory);
+}
+
+std::vector<particle> InstanceBO::readBack(size_t index) const
+{
+	VkDeviceSize bufferSize = sizeof(particle) * size;
+
+	VkBuffer stagingBuffer;
+	Allocation stagingBufferMemory;
 	Renderer::get()->createBuffer(bufferSize,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		//  for getting data back VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		buffer[bufferIndex+1],  // +1 for draw storage
-		memory[bufferIndex+1]);
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingBuffer,
+		stagingBufferMemory,
+		ALLOCATE_LINEAR);
+
+	Renderer::get()->copyBuffer(buffer[index], stagingBuffer, bufferSize);
+
+	std::vector<particle> contents(size);
+
+	memcpy(contents.data(), stagingBufferMemory.mapped, (size_t)bufferSize);
 
-	Renderer::get()->copyBuffer(stagingBuffer, buffer[bufferIndex+1], bufferSize);
+	Renderer::get()->destroyBuffer(stagingBuffer, stagingBufferMemory);
 
-	vkDestroyBuffer(*dev, stagingBuffer, nullptr);
-	vkFreeMemory(*dev, stagingBufferMemory, nullptr);
+	return contents;
 }
 
 VkVertexInputBindingDescription InstanceBO::getBindingDescription()
@@ -6,6 +6,7 @@
 #include <glm/mat4x4.hpp>
 #include <glm/glm.hpp>
 #include "particle.h"
+#include "allocator.h"
 
 struct UniformBufferObject
 {
@@ -25,7 +26,7 @@ struct BufferObject
 {
 	const VkDevice* dev;
 	std::vector<VkBuffer> buffer;
-	std::vector<VkDeviceMemory> memory;
+	std::vector<Allocation> memory;
 	size_t size = 0;
 	int bufferIndex = 0;
 
@@ -53,6 +54,16 @@ struct InstanceBO : BufferObject
 	void createSpecificBuffer();
 	void createDrawStorage();
 
+	// which particle (by its index from prepareParticles) is in each slot, sorting moves them around
+	std::vector<uint32_t> ids;
+
+	// read the device copies back, put them in morton order and upload them again. perParticle buffers
+	// (a vec4 per particle, like the leapfrog accelerations) get the same order. the device must be idle
+	void sortByMorton(const std::vector<VkBuffer>& perParticle = {});
+
+	// copy one of the device buffers back to the host. the device must be idle
+	std::vector<particle> readBack(size_t index) const;
+
 	static VkVertexInputBindingDescription getBindingDescription();
 
 	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescription();
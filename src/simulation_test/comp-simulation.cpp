@@ -76,6 +76,9 @@ void comp_simulation::createCommandPools(QueueFamilyIndices& queueFamilyIndices,
 
 void comp_simulation::frame()
 {
+	// compute works on the buffer the draw reads, so the two take turns on the gpu - the draw signals the
+	// compute, which the next draw waits on. a draw that didn't go still signals
+	renderer->signalDrawn = true;
 	renderer->drawFrame();			   // render
 	dispatchCompute();				   // submit compute
 	renderer->updateUniformBuffer();   // update
@@ -86,29 +89,24 @@ void comp_simulation::frame()
 // compute command buffers
 void comp_simulation::allocateComputeCommandBuffers()
 {
-	VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
-	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cmdBufAllocateInfo.commandPool = compute->commandPool;
-	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	cmdBufAllocateInfo.commandBufferCount = 1;
-	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &compute->commandBuffer) != VK_SUCCESS)
-		throw std::runtime_error("Failed allocating buffer for compute commands");
-
-	// Fence for compute CB sync
-	VkFenceCreateInfo fenceCreateInfo{};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &compute->fence) != VK_SUCCESS)
-		throw std::runtime_error("Failed creating compute fence");
+	compute->createFrameResources(device, renderer->frameSlots, renderer->framesInFlight);
 }
 
 void comp_simulation::recordComputeCommands()
 {
+	for (uint32_t slot = 0; slot < compute->commandBuffers.size(); slot++)
+		recordComputeCommand(slot);
+}
+
+void comp_simulation::recordComputeCommand(uint32_t slot)
+{
+	VkCommandBuffer commandBuffer = compute->commandBuffers[slot];
+
 	// create command buffer
 	VkCommandBufferBeginInfo cmdBufInfo{};
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-	if (vkBeginCommandBuffer(compute->commandBuffer, &cmdBufInfo) != VK_SUCCESS)
+	if (vkBeginCommandBuffer(commandBuffer, &cmdBufInfo) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create compute command buffer");
 
 	// Compute particle movement
@@ -128,7 +126,7 @@ void comp_simulation::recordComputeCommands()
 	bufferBarrier.dstQueueFamilyIndex = renderer->queueFamilyIndices.compute;			// Required as compute and graphics queue may have different families
 
 	vkCmdPipelineBarrier(
-		compute->commandBuffer,
+		commandBuffer,
 		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
 		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 		0, // no flags
@@ -136,17 +134,16 @@ void comp_simulation::recordComputeCommands()
 		1, &bufferBarrier,
 		0, nullptr);
 
-	vkCmdBindPipeline(compute->commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipeline);
-	vkCmdBindDescriptorSets(compute->commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipelineLayout, 0, 1, &compute->descriptorSet, 0, 0);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipeline);
 
 	// time compute
-	vkCmdResetQueryPool(compute->commandBuffer, renderer->computeQueryPool, 0, 2);
-	vkCmdWriteTimestamp(compute->commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 0);
+	vkCmdResetQueryPool(commandBuffer, renderer->computeQueryPool, 2 * slot, 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 2 * slot);
 
-	// Dispatch the compute     
-	vkCmdDispatch(compute->commandBuffer, renderer->PARTICLE_COUNT, 1, 1);
+	// Dispatch the compute, once per substep
+	compute->recordSteps(commandBuffer, compute->descriptorSet, compute->descriptorSet, renderer->PARTICLE_COUNT, slot);
 
-	vkCmdWriteTimestamp(compute->commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 1);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 2 * slot + 1);
 
 	// Add memory barrier to ensure that compute shader has finished writing to the buffer
 	// Without this the (rendering) vertex shader may display incomplete results (partial data from last frame) 
@@ -160,7 +157,7 @@ void comp_simulation::recordComputeCommands()
 	bufferBarrier.dstQueueFamilyIndex = renderer->queueFamilyIndices.graphics;			// Required as compute and graphics queue may have different families
 
 	vkCmdPipelineBarrier(
-		compute->commandBuffer,
+		commandBuffer,
 		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
 		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 		0, // no flags
@@ -168,37 +165,24 @@ void comp_simulation::recordComputeCommands()
 		1, &bufferBarrier,
 		0, nullptr);
 
-	vkEndCommandBuffer(compute->commandBuffer);
+	vkEndCommandBuffer(commandBuffer);
 }
 
 void comp_simulation::dispatchCompute()
 {
-	// wait until presentation is finished before drawing the next frame
-	vkQueueWaitIdle(presentQueue);
+	uint32_t slot = renderer->frameSlot();
 
-	auto fenceResult = vkWaitForFences(device, 1, &compute->fence, VK_TRUE, UINT64_MAX);
-	// Submit compute commands
-	while (fenceResult != VK_SUCCESS)
-	{
-		if (fenceResult == VK_ERROR_DEVICE_LOST)
-			throw std::runtime_error("device crashed");
-
-		fenceResult = vkWaitForFences(device, 1, &compute->fence, VK_TRUE, UINT64_MAX);
-	};
+	// the submission framesInFlight frames back is done with the slot's ubo, so this frame's values can go in
+	compute->waitSlot(device, slot);
+	compute->writeUniforms(slot);
 
-	vkResetFences(device, 1, &compute->fence);
-	VkSubmitInfo computeSubmitInfo{};
-	computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	computeSubmitInfo.commandBufferCount = 1;
-	computeSubmitInfo.pCommandBuffers = &compute->commandBuffer;
+	// after this frame's draw has read the particles, and ahead of the next one
+	compute->waitSemaphore = renderer->drawnSemaphore();
+	compute->waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	compute->signalSemaphore = compute->finished[slot % compute->finished.size()];
+	renderer->drawWait = compute->signalSemaphore;
 
-	auto re = vkQueueSubmit(compute->queue, 1, &computeSubmitInfo, compute->fence);
-	if (re != VK_SUCCESS)
-	{
-		std::cout << "result: " << re << std::endl;
-		throw std::runtime_error("failed to submit compute queue");
-	}
-	
+	compute->submit(slot);
 }
 
 void comp_simulation::cleanup()
@@ -0,0 +1,520 @@
+#include "compression.h"
+#include "morton.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+// particles per residual block and bytes per encodeBytes block
+static const size_t PARTICLE_BLOCK = 1 << 16;
+static const size_t BYTE_BLOCK = 1 << 18;
+
+// rANS with 12 bit probabilities and a 32 bit state, renormalised a byte at a time
+static const uint32_t PROB_BITS = 12;
+static const uint32_t PROB_SCALE = 1u << PROB_BITS;
+static const uint32_t RANS_LOW = 1u << 23;
+
+// quantised coordinates stay well inside int32 so the second differences fit in int64
+static const int64_t QUANTISED_LIMIT = int64_t(1) << 30;
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+static uint64_t getVarint(const uint8_t*& p, const uint8_t* end)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (p == end)
+			throw std::runtime_error("compressed data ends mid value");
+
+		uint8_t byte = *p++;
+		value |= uint64_t(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	throw std::runtime_error("compressed data has an overlong value");
+}
+
+static uint64_t zigzag(int64_t value)
+{
+	return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+	return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// scale the byte counts to sum to PROB_SCALE, every byte that occurs keeps at least 1
+static void normaliseFrequencies(const uint32_t counts[256], size_t total, uint32_t freq[256])
+{
+	int64_t sum = 0;
+	for (int s = 0; s < 256; s++)
+	{
+		freq[s] = counts[s] ? std::max<uint32_t>(1, static_cast<uint32_t>(uint64_t(counts[s]) * PROB_SCALE / total)) : 0;
+		sum += freq[s];
+	}
+
+	// hand the rounding error to the most common bytes, where it costs the least
+	while (sum != PROB_SCALE)
+	{
+		int best = -1;
+		for (int s = 0; s < 256; s++)
+		{
+			if (freq[s] > (sum > PROB_SCALE ? 1u : 0u) && (best < 0 || freq[s] > freq[best]))
+				best = s;
+		}
+
+		int64_t step = sum > PROB_SCALE ? -std::min<int64_t>(sum - PROB_SCALE, freq[best] - 1) : PROB_SCALE - sum;
+		freq[best] = static_cast<uint32_t>(freq[best] + step);
+		sum += step;
+	}
+}
+
+// raw size, the frequency table, then the coded bytes
+static void ransEncode(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out)
+{
+	putVarint(out, raw.size());
+	if (raw.empty())
+		return;
+
+	uint32_t counts[256] = {};
+	for (uint8_t byte : raw)
+		counts[byte]++;
+
+	uint32_t freq[256], start[256];
+	normaliseFrequencies(counts, raw.size(), freq);
+
+	for (int s = 0, total = 0; s < 256; s++)
+	{
+		start[s] = total;
+		total += freq[s];
+		putVarint(out, freq[s]);
+	}
+
+	// rANS runs backwards - code the last byte first and reverse the output
+	std::vector<uint8_t> coded;
+	coded.reserve(raw.size() / 2 + 8);
+
+	uint32_t x = RANS_LOW;
+	for (size_t i = raw.size(); i-- > 0;)
+	{
+		uint32_t f = freq[raw[i]];
+		uint32_t xMax = ((RANS_LOW >> PROB_BITS) << 8) * f;
+		while (x >= xMax)
+		{
+			coded.push_back(static_cast<uint8_t>(x));
+			x >>= 8;
+		}
+		x = ((x / f) << PROB_BITS) + (x % f) + start[raw[i]];
+	}
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+		coded.push_back(static_cast<uint8_t>(x >> shift));
+
+	putVarint(out, coded.size());
+	out.insert(out.end(), coded.rbegin(), coded.rend());
+}
+
+static const uint8_t* ransDecode(const uint8_t* p, const uint8_t* end, std::vector<uint8_t>& raw)
+{
+	raw.resize(static_cast<size_t>(getVarint(p, end)));
+	if (raw.empty())
+		return p;
+
+	uint32_t freq[256], start[256];
+	uint32_t total = 0;
+	for (int s = 0; s < 256; s++)
+	{
+		freq[s] = static_cast<uint32_t>(getVarint(p, end));
+		start[s] = total;
+		total += freq[s];
+		if (total > PROB_SCALE)
+			break;
+	}
+	if (total != PROB_SCALE)
+		throw std::runtime_error("compressed block has a bad frequency table");
+
+	uint8_t symbol[PROB_SCALE];
+	for (int s = 0; s < 256; s++)
+		memset(symbol + start[s], s, freq[s]);
+
+	uint64_t codedSize = getVarint(p, end);
+	if (codedSize < 4 || codedSize > uint64_t(end - p))
+		throw std::runtime_error("compressed block is truncated");
+
+	const uint8_t* c = p;
+	const uint8_t* codedEnd = p + codedSize;
+	uint32_t x = uint32_t(c[0]) | uint32_t(c[1]) << 8 | uint32_t(c[2]) << 16 | uint32_t(c[3]) << 24;
+	c += 4;
+
+	for (auto &byte : raw)
+	{
+		uint32_t slot = x & (PROB_SCALE - 1);
+		uint8_t s = symbol[slot];
+		byte = s;
+
+		x = freq[s] * (x >> PROB_BITS) + slot - start[s];
+		while (x < RANS_LOW)
+		{
+			if (c == codedEnd)
+				throw std::runtime_error("compressed block is truncated");
+			x = (x << 8) | *c++;
+		}
+	}
+
+	return codedEnd;
+}
+
+// block count, every block's coded size, then the blocks - sizes up front so they decode in parallel
+static void writeBlocks(const std::vector<std::vector<uint8_t>>& raw, std::vector<uint8_t>& out)
+{
+	std::vector<std::vector<uint8_t>> coded(raw.size());
+
+	ThreadPool::get()->parallelFor(0, raw.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t b = begin; b < end; b++)
+		{
+			ransEncode(raw[b], coded[b]);
+		}
+	});
+
+	putVarint(out, raw.size());
+	for (auto &block : coded)
+		putVarint(out, block.size());
+
+	for (auto &block : coded)
+		out.insert(out.end(), block.begin(), block.end());
+}
+
+static size_t readBlocks(const uint8_t* data, size_t size, std::vector<std::vector<uint8_t>>& raw)
+{
+	const uint8_t* p = data;
+	const uint8_t* end = data + size;
+
+	uint64_t count = getVarint(p, end);
+	if (count > size)
+		throw std::runtime_error("compressed data has a bad block count");
+
+	std::vector<uint64_t> offsets(static_cast<size_t>(count) + 1, 0);
+	for (size_t b = 0; b < count; b++)
+	{
+		offsets[b + 1] = offsets[b] + getVarint(p, end);
+		if (offsets[b + 1] > uint64_t(end - p))
+			throw std::runtime_error("compressed data is truncated");
+	}
+
+	// exceptions can't cross the pool, each block just flags a failure
+	raw.resize(static_cast<size_t>(count));
+	std::atomic<bool> corrupt(false);
+
+	ThreadPool::get()->parallelFor(0, raw.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t b = begin; b < end; b++)
+		{
+			try
+			{
+				if (ransDecode(p + offsets[b], p + offsets[b + 1], raw[b]) != p + offsets[b + 1])
+					corrupt = true;
+			}
+			catch (const std::runtime_error&)
+			{
+				corrupt = true;
+			}
+		}
+	});
+
+	if (corrupt)
+		throw std::runtime_error("compressed block is corrupt");
+
+	return static_cast<size_t>(p + offsets.back() - data);
+}
+
+void encodeBytes(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+	std::vector<std::vector<uint8_t>> blocks((size + BYTE_BLOCK - 1) / BYTE_BLOCK);
+	for (size_t b = 0; b < blocks.size(); b++)
+	{
+		blocks[b].assign(data + b * BYTE_BLOCK, data + std::min(size, (b + 1) * BYTE_BLOCK));
+	}
+
+	writeBlocks(blocks, out);
+}
+
+size_t decodeBytes(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+	std::vector<std::vector<uint8_t>> blocks;
+	size_t used = readBlocks(data, size, blocks);
+
+	out.clear();
+	for (auto &block : blocks)
+		out.insert(out.end(), block.begin(), block.end());
+
+	return used;
+}
+
+// bounding box of the finite coordinates
+static void bounds(const float* xyz, size_t count, float lo[3], float hi[3])
+{
+	auto pool = ThreadPool::get();
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(4 * pool->size(), count / 4096));
+	std::vector<float> chunkLo(3 * chunks, INFINITY), chunkHi(3 * chunks, -INFINITY);
+
+	pool->parallelFor(0, chunks, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t c = begin; c < end; c++)
+		{
+			for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; i++)
+			{
+				for (int a = 0; a < 3; a++)
+				{
+					float v = xyz[3 * i + a];
+					if (std::isfinite(v))
+					{
+						chunkLo[3 * c + a] = std::min(chunkLo[3 * c + a], v);
+						chunkHi[3 * c + a] = std::max(chunkHi[3 * c + a], v);
+					}
+				}
+			}
+		}
+	});
+
+	for (int a = 0; a < 3; a++)
+	{
+		lo[a] = INFINITY;
+		hi[a] = -INFINITY;
+		for (size_t c = 0; c < chunks; c++)
+		{
+			lo[a] = std::min(lo[a], chunkLo[3 * c + a]);
+			hi[a] = std::max(hi[a], chunkHi[3 * c + a]);
+		}
+
+		// nothing finite
+		if (lo[a] > hi[a])
+			lo[a] = hi[a] = 0.0f;
+	}
+}
+
+// morton order of quantised positions. the decoder has the same integers, so it gets the same order
+static void quantisedOrder(const std::vector<int32_t>& q, size_t count, std::vector<uint32_t>& order)
+{
+	int32_t lo[3] = { INT32_MAX, INT32_MAX, INT32_MAX };
+	int32_t hi[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+	for (size_t i = 0; i < count; i++)
+	{
+		for (int a = 0; a < 3; a++)
+		{
+			lo[a] = std::min(lo[a], q[3 * i + a]);
+			hi[a] = std::max(hi[a], q[3 * i + a]);
+		}
+	}
+
+	// drop low bits until the widest axis fits the key
+	uint64_t span = 0;
+	for (int a = 0; a < 3; a++)
+		span = std::max<uint64_t>(span, uint64_t(int64_t(hi[a]) - lo[a]));
+
+	int shift = 0;
+	while ((span >> shift) >= (uint64_t(1) << MORTON_BITS))
+		shift++;
+
+	std::vector<uint64_t> keys(count);
+	order.resize(count);
+
+	ThreadPool::get()->parallelFor(0, count, 1 << 14, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			keys[i] = mortonEncode(
+				static_cast<uint32_t>((int64_t(q[3 * i + 0]) - lo[0]) >> shift),
+				static_cast<uint32_t>((int64_t(q[3 * i + 1]) - lo[1]) >> shift),
+				static_cast<uint32_t>((int64_t(q[3 * i + 2]) - lo[2]) >> shift));
+			order[i] = static_cast<uint32_t>(i);
+		}
+	});
+
+	radixSort(keys, order);
+}
+
+PositionEncoder::PositionEncoder(float errorBound, uint32_t keyInterval)
+	: errorBound(errorBound), keyInterval(std::max(1u, keyInterval))
+{
+}
+
+void PositionEncoder::setGrid(const float* xyz, size_t count)
+{
+	float lo[3], hi[3];
+	bounds(xyz, count, lo, hi);
+
+	gridExtent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+
+	// rounding to the nearest step is off by at most half of it. half again so the bound still holds until the
+	// box shrinks to half this size
+	grid.step = errorBound * (gridExtent > 0.0f ? gridExtent : 1.0f);
+	for (int a = 0; a < 3; a++)
+		grid.origin[a] = lo[a];
+}
+
+bool PositionEncoder::quantise(const float* xyz, size_t count)
+{
+	current.resize(3 * count);
+	std::atomic<bool> inRange(true);
+
+	ThreadPool::get()->parallelFor(0, count, 1 << 14, [&](size_t begin, size_t end)
+	{
+		bool fits = true;
+		for (size_t i = begin; i < end; i++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				// anything not finite sits on the origin
+				double v = std::isfinite(xyz[3 * i + a]) ? (double(xyz[3 * i + a]) - grid.origin[a]) / grid.step : 0.0;
+				int64_t q = std::llround(std::max(-double(QUANTISED_LIMIT), std::min(double(QUANTISED_LIMIT), v)));
+
+				fits = fits && std::abs(q) < QUANTISED_LIMIT;
+				current[3 * i + a] = static_cast<int32_t>(q);
+			}
+		}
+
+		if (!fits)
+			inRange = false;
+	});
+
+	return inRange;
+}
+
+bool PositionEncoder::encode(const float* xyz, size_t count, std::vector<uint8_t>& out)
+{
+	bool keyframe = previous.size() != 3 * count || ++sinceKey >= keyInterval;
+
+	// shrunk too far for the grid to keep the error bound, spread out too far for it to mean much, or off the end
+	if (!keyframe)
+	{
+		float lo[3], hi[3];
+		bounds(xyz, count, lo, hi);
+		float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+
+		keyframe = extent < 0.5f * gridExtent || extent > 2.0f * gridExtent || !quantise(xyz, count);
+	}
+
+	if (keyframe)
+	{
+		setGrid(xyz, count);
+		quantise(xyz, count);
+		sinceKey = 0;
+	}
+	else
+	{
+		quantisedOrder(previous, count, order);
+	}
+
+	// residuals, the prediction restarts at every block so they stay independent
+	std::vector<std::vector<uint8_t>> blocks((count + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK);
+
+	ThreadPool::get()->parallelFor(0, blocks.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t b = begin; b < end; b++)
+		{
+			std::vector<uint8_t>& block = blocks[b];
+			block.reserve(3 * PARTICLE_BLOCK);
+			int64_t last[3] = { 0, 0, 0 };
+
+			for (size_t k = b * PARTICLE_BLOCK; k < std::min(count, (b + 1) * PARTICLE_BLOCK); k++)
+			{
+				for (int a = 0; a < 3; a++)
+				{
+					// keyframes predict from the last particle, delta frames predict the motion from the last particle's
+					int64_t value = keyframe ? current[3 * k + a]
+						: int64_t(current[3 * order[k] + a]) - previous[3 * order[k] + a];
+
+					putVarint(block, zigzag(value - last[a]));
+					last[a] = value;
+				}
+			}
+		}
+	});
+
+	size_t headerAt = out.size();
+	out.resize(headerAt + sizeof(grid));
+	memcpy(out.data() + headerAt, &grid, sizeof(grid));
+	writeBlocks(blocks, out);
+
+	previous.swap(current);
+	return keyframe;
+}
+
+size_t PositionDecoder::decode(const uint8_t* data, size_t size, bool keyframe, size_t count, float* xyz)
+{
+	if (size < sizeof(grid))
+		throw std::runtime_error("compressed frame is truncated");
+
+	if (!keyframe && previous.size() != 3 * count)
+		throw std::runtime_error("delta frame without the frame before it");
+
+	memcpy(&grid, data, sizeof(grid));
+
+	std::vector<std::vector<uint8_t>> blocks;
+	size_t used = sizeof(grid) + readBlocks(data + sizeof(grid), size - sizeof(grid), blocks);
+
+	if (blocks.size() != (count + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK)
+		throw std::runtime_error("compressed frame has the wrong particle count");
+
+	if (!keyframe)
+		quantisedOrder(previous, count, order);
+
+	current.resize(3 * count);
+	std::atomic<bool> corrupt(false);
+
+	ThreadPool::get()->parallelFor(0, blocks.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t b = begin; b < end; b++)
+		{
+			const uint8_t* p = blocks[b].data();
+			const uint8_t* blockEnd = p + blocks[b].size();
+			int64_t last[3] = { 0, 0, 0 };
+
+			try
+			{
+				for (size_t k = b * PARTICLE_BLOCK; k < std::min(count, (b + 1) * PARTICLE_BLOCK); k++)
+				{
+					size_t i = keyframe ? k : order[k];
+					for (int a = 0; a < 3; a++)
+					{
+						last[a] += unzigzag(getVarint(p, blockEnd));
+						current[3 * i + a] = static_cast<int32_t>(keyframe ? last[a] : previous[3 * i + a] + last[a]);
+					}
+				}
+			}
+			catch (const std::runtime_error&)
+			{
+				corrupt = true;
+			}
+		}
+	});
+
+	if (corrupt)
+		throw std::runtime_error("compressed frame is corrupt");
+
+	ThreadPool::get()->parallelFor(0, count, 1 << 14, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			for (int a = 0; a < 3; a++)
+				xyz[3 * i + a] = grid.origin[a] + static_cast<float>(current[3 * i + a]) * grid.step;
+		}
+	});
+
+	previous.swap(current);
+	return used;
+}
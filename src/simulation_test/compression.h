@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// lossy position coding for trajectories and snapshots.
+// positions are quantised to a grid whose step keeps every coordinate within errorBound * (bounding box size)
+// of the original. keyframes code each particle against the one before it in id order. delta frames code the
+// change since the last frame, predicted from the change of the particle before it in morton order, so
+// particles moving together cost almost nothing. the residuals are zigzag varints, entropy coded with
+// order-0 rANS in independent blocks that encode and decode in parallel on the pool
+
+// grid a keyframe sets up, delta frames reuse it
+struct QuantisationGrid
+{
+	float origin[3];
+	float step;
+};
+
+// entropy code bytes, appending them to out
+void encodeBytes(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+// decode bytes written by encodeBytes. returns how much of data was used
+size_t decodeBytes(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+// keeps the last frame so the next one can be coded against it
+class PositionEncoder
+{
+	float errorBound;
+	uint32_t keyInterval;
+	uint32_t sinceKey = 0;
+	float gridExtent = 0.0f;		// bounding box size when the grid was set up
+
+	QuantisationGrid grid = {};
+	std::vector<int32_t> previous;	// last frame, quantised, x/y/z in id order
+	std::vector<int32_t> current;
+	std::vector<uint32_t> order;
+
+	void setGrid(const float* xyz, size_t count);
+	bool quantise(const float* xyz, size_t count);
+
+public:
+	// keyframe at least every keyInterval frames, so a reader can start part way through
+	explicit PositionEncoder(float errorBound, uint32_t keyInterval = 64);
+
+	// count x/y/z positions in id order. appends the payload to out and returns true for a keyframe
+	bool encode(const float* xyz, size_t count, std::vector<uint8_t>& out);
+};
+
+class PositionDecoder
+{
+	QuantisationGrid grid = {};
+	std::vector<int32_t> previous;
+	std::vector<int32_t> current;
+	std::vector<uint32_t> order;
+
+public:
+	// a delta frame needs the frame before it decoded first. writes count x/y/z positions in id order and
+	// returns how much of data was used
+	size_t decode(const uint8_t* data, size_t size, bool keyframe, size_t count, float* xyz);
+
+	// a delta frame can follow
+	bool primed() const { return !previous.empty(); }
+};
@@ -1,38 +1,174 @@
 #include "compute.h"
 #include "buffer.h"
+#include "renderer.h"
 
 ComputeConfig::ComputeConfig()
 {
 
 }
 
-void ComputeConfig::cleanup(const VkDevice& device)
+uint32_t ComputeConfig::groupCount(uint32_t particleCount) const
 {
-	// compute clean up
-	vkDestroyFence(device, fence, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-	vkDestroyPipeline(device, pipeline, nullptr);
-	vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(1), &commandBuffer);
-	vkDestroyCommandPool(device, commandPool, nullptr);
-	vkDestroyBuffer(device, uniformBuffer, nullptr);
-	vkFreeMemory(device, uboMem, nullptr);
+	return (particleCount + workGroupSize - 1) / workGroupSize;
+}
+
+void ComputeConfig::recordSteps(VkCommandBuffer cmd, VkDescriptorSet in, VkDescriptorSet out, uint32_t particleCount, uint32_t slot) const
+{
+	// every set bound has the one dynamic ubo
+	uint32_t offsets[2] = { uniforms.offset(slot), uniforms.offset(slot) };
+
+	// every pass has to see the whole of the last one's writes (positions, velocities and accelerations) - the
+	// first included, as the submission before may still be running on the queue
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	VkDescriptorSet read = in;
+	for (uint32_t step = 0; step < substeps; step++)
+	{
+		// an odd number of steps from the last, euler writes the scratch buffer
+		VkDescriptorSet write = (!leapfrog && scratchSet != VK_NULL_HANDLE && (substeps - 1 - step) % 2) ? scratchSet : out;
+		VkDescriptorSet sets[2] = { read, write };
+		read = write;
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, setCount, sets, setCount, offsets);
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		if (!leapfrog)
+		{
+			vkCmdDispatch(cmd, groupCount(particleCount), 1, 1);
+			continue;
+		}
+
+		uint32_t stage = DRIFT;
+		vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(stage), &stage);
+		vkCmdDispatch(cmd, groupCount(particleCount), 1, 1);
+
+		// the force pass reads every particle's new position
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		stage = KICK;
+		vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(stage), &stage);
+		vkCmdDispatch(cmd, groupCount(particleCount), 1, 1);
+	}
+}
+
+void ComputeConfig::createFrameResources(const VkDevice& device, uint32_t slots, uint32_t framesInFlight)
+{
+	commandBuffers.resize(slots);
+
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocateInfo.commandPool = commandPool;
+	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocateInfo.commandBufferCount = slots;
+	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, commandBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed allocating buffer for compute commands");
+
+	// signalled, so the first wait on each goes straight through
+	VkFenceCreateInfo fenceCreateInfo{};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	fences.resize(framesInFlight);
+	for (auto &fence : fences)
+	{
+		if (vkCreateFence(device, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS)
+			throw std::runtime_error("Failed creating compute fence");
+	}
+
+	// per slot, as double buffering waits on one a frame after it was signalled - with a single frame in flight
+	// the next compute would signal it again first
+	finished.resize(slots);
+	for (auto &semaphore : finished)
+	{
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+			throw std::runtime_error("Failed creating compute semaphore");
+	}
+}
+
+void ComputeConfig::waitSlot(const VkDevice& device, uint32_t slot)
+{
+	VkFence& fence = fences[slot % fences.size()];
+
+	// only blocks once the cpu is a full set of frames ahead
+	if (vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+		throw std::runtime_error("device crashed");
+
+	vkResetFences(device, 1, &fence);
 }
 
-void Async::cleanup(const VkDevice& device)
+void ComputeConfig::submit(uint32_t slot)
+{
+	VkSemaphore waits[2], signals[2];
+	VkPipelineStageFlags waitStages[2];
+	uint32_t waitCount = 0, signalCount = 0;
+
+	if (waitReadback)
+	{
+		waitStages[waitCount] = readbackWaitStage;
+		waits[waitCount++] = readbackDone;
+		waitReadback = false;
+	}
+
+	if (waitSemaphore != VK_NULL_HANDLE)
+	{
+		waitStages[waitCount] = waitStage;
+		waits[waitCount++] = waitSemaphore;
+		waitSemaphore = VK_NULL_HANDLE;
+	}
+
+	if (signalReadback)
+	{
+		signals[signalCount++] = readbackReady;
+		signalReadback = false;
+	}
+
+	if (signalSemaphore != VK_NULL_HANDLE)
+	{
+		signals[signalCount++] = signalSemaphore;
+		signalSemaphore = VK_NULL_HANDLE;
+	}
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffers[slot];
+	submitInfo.waitSemaphoreCount = waitCount;
+	submitInfo.pWaitSemaphores = waits;
+	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.signalSemaphoreCount = signalCount;
+	submitInfo.pSignalSemaphores = signals;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, fences[slot % fences.size()]) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit compute queue");
+
+	lastQuery = 2 * slot;
+	lastDeltaT = ubo.deltaT;
+}
+
+void ComputeConfig::cleanup(const VkDevice& device)
 {
 	// compute clean up
-	vkDestroyFence(device, fence, nullptr);
+	for (auto &fence : fences)
+		vkDestroyFence(device, fence, nullptr);
+	for (auto &semaphore : finished)
+		vkDestroySemaphore(device, semaphore, nullptr);
+
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 	vkDestroyPipeline(device, pipeline, nullptr);
 
-	for (auto &b : commandBuffer)
-	{
-		vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(1), &b);
-	}
+	if (!commandBuffers.empty())
+		vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
 
 	vkDestroyCommandPool(device, commandPool, nullptr);
-	vkDestroyBuffer(device, uniformBuffer, nullptr);
-	vkFreeMemory(device, uboMem, nullptr);
+	uniforms.destroy();
+	Renderer::get()->destroyBuffer(accelerationBuffer, accelerationMem);
+	Renderer::get()->destroyBuffer(scratchBuffer, scratchMem);
 }
@@ -2,25 +2,71 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vector>
+#include "uniform-ring.h"
 
 struct BufferObject;
 
+// no timestamps written - a frame that didn't submit to that queue
+const uint32_t NO_QUERY = UINT32_MAX;
+
+// leapfrog passes, chosen by push constant
+enum LEAPFROG_STAGE : uint32_t
+{
+	DRIFT = 0,			// half kick with the stored acceleration then a full drift
+	KICK = 1			// new accelerations and the closing half kick
+};
+
 struct ComputeConfig
 {
 	BufferObject* storageBuffer;					// (Shader) storage buffer object containing the particles
-	VkBuffer uniformBuffer;		    // Uniform buffer object containing particle system parameters
 	VkQueue queue;								// Separate queue for compute commands (queue family may differ from the one used for graphics)
 	VkCommandPool commandPool;					// Use a separate command pool (queue family may differ from the one used for graphics)
-	VkCommandBuffer commandBuffer;				// Command buffer storing the dispatch commands and barriers
-	VkFence fence;								// Synchronization fence to avoid rewriting compute CB if still in use
+	std::vector<VkCommandBuffer> commandBuffers;	// one per frame slot, each with its own ubo slot and timestamp pair
+	std::vector<VkFence> fences;				// one per frame in flight, so a slot isn't rewritten while still in use
+	std::vector<VkSemaphore> finished;			// one per frame slot, for modes that chain another queue's work after compute
 	VkDescriptorSetLayout descriptorSetLayout;	// Compute shader binding layout
 	VkDescriptorSet descriptorSet;				// Compute shader bindings
 	VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
 	VkPipeline pipeline;						// Compute pipeline for updating particle positions
 
-												// memory for ubo
-	VkDeviceMemory uboMem;
-	void* mapped = nullptr;
+	uint32_t workGroupSize = 256;				// local_size_x of the force kernel (specialisation constant 4)
+	uint32_t sharedDataSize = 256;				// particles per shared memory tile (specialisation constant 0)
+
+	bool leapfrog = false;						// kick-drift-kick rather than the one pass euler update
+	uint32_t substeps = 1;						// steps recorded into each compute submission
+	uint32_t setCount = 1;						// descriptor sets in the pipeline layout - in and out for two
+
+	// last force pass's accelerations, read by the leapfrog drift for its opening half kick
+	VkBuffer accelerationBuffer = VK_NULL_HANDLE;
+	Allocation accelerationMem;
+
+	// double buffered euler substeps can't read and write the one buffer, so the ones after the first
+	// alternate between out and this, finishing on out. only made for more than one substep
+	VkBuffer scratchBuffer = VK_NULL_HANDLE;
+	Allocation scratchMem;
+	VkDescriptorSet scratchSet = VK_NULL_HANDLE;
+
+	// trajectory readback - a submission signals readbackReady for a copy waiting on it, and the one after
+	// the copy waits on readbackDone before it overwrites the particles
+	VkSemaphore readbackReady = VK_NULL_HANDLE;
+	VkSemaphore readbackDone = VK_NULL_HANDLE;
+	VkPipelineStageFlags readbackWaitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	bool signalReadback = false;
+	bool waitReadback = false;
+
+	// the mode's own ordering for the next submission, alongside the readback's - each used once
+	VkSemaphore waitSemaphore = VK_NULL_HANDLE;
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	VkSemaphore signalSemaphore = VK_NULL_HANDLE;
+
+	// first of the two timestamps the last submission writes, for the frame loop to read back
+	uint32_t lastQuery = NO_QUERY;
+
+	// step the last submission integrated with (per substep), left at 0 by a frame that didn't submit
+	float lastDeltaT = 0.0f;
+
+	// ubo slots, one per frame slot - each command buffer binds its own with a dynamic offset
+	UniformRing uniforms;
 	// Compute shader uniform block object
 	struct computeUBO
 	{
@@ -32,14 +78,32 @@ struct ComputeConfig
 
 	ComputeConfig();
 
+	// number of workgroups needed to cover every particle
+	uint32_t groupCount(uint32_t particleCount) const;
+
+	// record every substep's dispatches with barriers between them. the first substep reads the particles from
+	// in, the last leaves them in out - leapfrog works on out in place after the first drift, euler with a scratch
+	// set ping-pongs through it. slot is the ubo slot it reads
+	void recordSteps(VkCommandBuffer cmd, VkDescriptorSet in, VkDescriptorSet out, uint32_t particleCount, uint32_t slot) const;
+
+	// copy ubo into slot - only once the last submission reading it has finished
+	void writeUniforms(uint32_t slot) { uniforms.write(slot, &ubo); }
+
+	// a command buffer per frame slot, and a fence (signalled) and semaphore per frame in flight
+	void createFrameResources(const VkDevice& device, uint32_t slots, uint32_t framesInFlight);
+
+	// block until the last submission sharing slot's fence has finished. only call it when slot is about to be submitted
+	void waitSlot(const VkDevice& device, uint32_t slot);
+
+	// submit slot's command buffer with the readback and mode semaphores asked for, fenced for waitSlot
+	void submit(uint32_t slot);
+
 	virtual void cleanup(const VkDevice& device);
 };
 
 
+// command buffers alternate between the two sets, so the slot's parity says which buffer it writes
 struct Async : public ComputeConfig
 {
-	VkCommandBuffer commandBuffer[2];			// 2 Command buffer storing the dispatch commands and barriers
 	VkDescriptorSet descriptorSet[2];			// Compute shader bindings (FOR 1 AND 2)!!!!!
-
-	void cleanup(const VkDevice& device) override;
 };
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "cpu-forces.h"
+
+#ifdef CPU_FORCES_X86
+#include <immintrin.h>
+
+// 1/sqrt(x) - the hardware estimate plus one newton step gets close to full float precision
+static inline __m256 rsqrt(__m256 x)
+{
+	__m256 y = _mm256_rsqrt_ps(x);
+	__m256 halfX = _mm256_mul_ps(_mm256_set1_ps(0.5f), x);
+	return _mm256_mul_ps(y, _mm256_fnmadd_ps(halfX, _mm256_mul_ps(y, y), _mm256_set1_ps(1.5f)));
+}
+
+// x^-POWER built from rsqrt
+static inline __m256 invPow(__m256 x)
+{
+	__m256 r = rsqrt(x);
+
+	if (POWER == 0.5f)
+		return r;
+	if (POWER == 0.75f)
+		return _mm256_mul_ps(r, _mm256_sqrt_ps(r));
+	if (POWER == 1.0f)
+		return _mm256_mul_ps(r, r);
+
+	return _mm256_mul_ps(_mm256_mul_ps(r, r), r);
+}
+
+static inline float horizontalSum(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_hadd_ps(sum, sum);
+	sum = _mm_hadd_ps(sum, sum);
+	return _mm_cvtss_f32(sum);
+}
+
+void forceKernelAVX2(const ForceBlock& b)
+{
+	const int WIDTH = 8;
+	const __m256 gravity = _mm256_set1_ps(GRAVITY);
+	const __m256 soften = _mm256_set1_ps(SOFTEN);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		__m256 px = _mm256_set1_ps(b.x[i]);
+		__m256 py = _mm256_set1_ps(b.y[i]);
+		__m256 pz = _mm256_set1_ps(b.z[i]);
+
+		__m256 ax = _mm256_setzero_ps();
+		__m256 ay = _mm256_setzero_ps();
+		__m256 az = _mm256_setzero_ps();
+
+		for (size_t j = b.sourceBegin; j < b.sourceEnd; j += WIDTH)
+		{
+			size_t remaining = b.sourceEnd - j;
+			int valid = remaining < WIDTH ? static_cast<int>(remaining) : WIDTH;
+			__m256i validMask = _mm256_cmpgt_epi32(_mm256_set1_epi32(valid), lanes);
+
+			// masked loads read zero past the end of the sources
+			__m256 sx = _mm256_maskload_ps(b.x + j, validMask);
+			__m256 sy = _mm256_maskload_ps(b.y + j, validMask);
+			__m256 sz = _mm256_maskload_ps(b.z + j, validMask);
+
+			__m256 dx = _mm256_sub_ps(sx, px);
+			__m256 dy = _mm256_sub_ps(sy, py);
+			__m256 dz = _mm256_sub_ps(sz, pz);
+			__m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+			// normalize(dist) * GRAVITY / pow(d2 + SOFTEN, POWER)
+			__m256 scale = _mm256_mul_ps(_mm256_mul_ps(gravity, rsqrt(d2)), invPow(_mm256_add_ps(d2, soften)));
+
+			// drop the particle's own lane and any padding lanes
+			int self = (i >= j && i - j < WIDTH) ? static_cast<int>(i - j) : -1;
+			__m256i keep = _mm256_andnot_si256(_mm256_cmpeq_epi32(lanes, _mm256_set1_epi32(self)), validMask);
+			scale = _mm256_and_ps(scale, _mm256_castsi256_ps(keep));
+
+			ax = _mm256_fmadd_ps(dx, scale, ax);
+			ay = _mm256_fmadd_ps(dy, scale, ay);
+			az = _mm256_fmadd_ps(dz, scale, az);
+		}
+
+		b.ax[i] += horizontalSum(ax);
+		b.ay[i] += horizontalSum(ay);
+		b.az[i] += horizontalSum(az);
+	}
+}
+
+void forceKernelAVX2Symmetric(const ForceBlock& b)
+{
+	const int WIDTH = 8;
+	const __m256 gravity = _mm256_set1_ps(GRAVITY);
+	const __m256 soften = _mm256_set1_ps(SOFTEN);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		__m256 px = _mm256_set1_ps(b.x[i]);
+		__m256 py = _mm256_set1_ps(b.y[i]);
+		__m256 pz = _mm256_set1_ps(b.z[i]);
+
+		__m256 ax = _mm256_setzero_ps();
+		__m256 ay = _mm256_setzero_ps();
+		__m256 az = _mm256_setzero_ps();
+
+		// only the pairs with j > i, each one is applied to both ends
+		size_t first = b.sourceBegin > i ? b.sourceBegin : i + 1;
+
+		for (size_t j = first; j < b.sourceEnd; j += WIDTH)
+		{
+			size_t remaining = b.sourceEnd - j;
+			int valid = remaining < WIDTH ? static_cast<int>(remaining) : WIDTH;
+			__m256i validMask = _mm256_cmpgt_epi32(_mm256_set1_epi32(valid), lanes);
+
+			__m256 dx = _mm256_sub_ps(_mm256_maskload_ps(b.x + j, validMask), px);
+			__m256 dy = _mm256_sub_ps(_mm256_maskload_ps(b.y + j, validMask), py);
+			__m256 dz = _mm256_sub_ps(_mm256_maskload_ps(b.z + j, validMask), pz);
+			__m256 d2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+			__m256 scale = _mm256_mul_ps(_mm256_mul_ps(gravity, rsqrt(d2)), invPow(_mm256_add_ps(d2, soften)));
+			scale = _mm256_and_ps(scale, _mm256_castsi256_ps(validMask));
+
+			__m256 fx = _mm256_mul_ps(dx, scale);
+			__m256 fy = _mm256_mul_ps(dy, scale);
+			__m256 fz = _mm256_mul_ps(dz, scale);
+
+			ax = _mm256_add_ps(ax, fx);
+			ay = _mm256_add_ps(ay, fy);
+			az = _mm256_add_ps(az, fz);
+
+			// equal and opposite on the sources
+			_mm256_maskstore_ps(b.ax + j, validMask, _mm256_sub_ps(_mm256_maskload_ps(b.ax + j, validMask), fx));
+			_mm256_maskstore_ps(b.ay + j, validMask, _mm256_sub_ps(_mm256_maskload_ps(b.ay + j, validMask), fy));
+			_mm256_maskstore_ps(b.az + j, validMask, _mm256_sub_ps(_mm256_maskload_ps(b.az + j, validMask), fz));
+		}
+
+		b.ax[i] += horizontalSum(ax);
+		b.ay[i] += horizontalSum(ay);
+		b.az[i] += horizontalSum(az);
+	}
+}
+
+#endif
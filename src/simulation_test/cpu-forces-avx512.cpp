@@ -0,0 +1,130 @@
+#include "cpu-forces.h"
+
+#ifdef CPU_FORCES_X86
+#include <immintrin.h>
+
+// 1/sqrt(x) - the 14 bit estimate plus one newton step gets close to full float precision
+static inline __m512 rsqrt(__m512 x)
+{
+	__m512 y = _mm512_rsqrt14_ps(x);
+	__m512 halfX = _mm512_mul_ps(_mm512_set1_ps(0.5f), x);
+	return _mm512_mul_ps(y, _mm512_fnmadd_ps(halfX, _mm512_mul_ps(y, y), _mm512_set1_ps(1.5f)));
+}
+
+// x^-POWER built from rsqrt
+static inline __m512 invPow(__m512 x)
+{
+	__m512 r = rsqrt(x);
+
+	if (POWER == 0.5f)
+		return r;
+	if (POWER == 0.75f)
+		return _mm512_mul_ps(r, _mm512_sqrt_ps(r));
+	if (POWER == 1.0f)
+		return _mm512_mul_ps(r, r);
+
+	return _mm512_mul_ps(_mm512_mul_ps(r, r), r);
+}
+
+void forceKernelAVX512(const ForceBlock& b)
+{
+	const int WIDTH = 16;
+	const __m512 gravity = _mm512_set1_ps(GRAVITY);
+	const __m512 soften = _mm512_set1_ps(SOFTEN);
+
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		__m512 px = _mm512_set1_ps(b.x[i]);
+		__m512 py = _mm512_set1_ps(b.y[i]);
+		__m512 pz = _mm512_set1_ps(b.z[i]);
+
+		__m512 ax = _mm512_setzero_ps();
+		__m512 ay = _mm512_setzero_ps();
+		__m512 az = _mm512_setzero_ps();
+
+		for (size_t j = b.sourceBegin; j < b.sourceEnd; j += WIDTH)
+		{
+			size_t remaining = b.sourceEnd - j;
+			__mmask16 keep = remaining < WIDTH ? static_cast<__mmask16>((1u << remaining) - 1) : static_cast<__mmask16>(0xFFFF);
+
+			// drop the particle's own lane
+			if (i >= j && i - j < WIDTH)
+				keep &= static_cast<__mmask16>(~(1u << (i - j)));
+
+			__m512 sx = _mm512_maskz_loadu_ps(keep, b.x + j);
+			__m512 sy = _mm512_maskz_loadu_ps(keep, b.y + j);
+			__m512 sz = _mm512_maskz_loadu_ps(keep, b.z + j);
+
+			__m512 dx = _mm512_sub_ps(sx, px);
+			__m512 dy = _mm512_sub_ps(sy, py);
+			__m512 dz = _mm512_sub_ps(sz, pz);
+			__m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+			// normalize(dist) * GRAVITY / pow(d2 + SOFTEN, POWER)
+			__m512 scale = _mm512_mul_ps(_mm512_mul_ps(gravity, rsqrt(d2)), invPow(_mm512_add_ps(d2, soften)));
+			scale = _mm512_maskz_mov_ps(keep, scale);
+
+			ax = _mm512_fmadd_ps(dx, scale, ax);
+			ay = _mm512_fmadd_ps(dy, scale, ay);
+			az = _mm512_fmadd_ps(dz, scale, az);
+		}
+
+		b.ax[i] += _mm512_reduce_add_ps(ax);
+		b.ay[i] += _mm512_reduce_add_ps(ay);
+		b.az[i] += _mm512_reduce_add_ps(az);
+	}
+}
+
+void forceKernelAVX512Symmetric(const ForceBlock& b)
+{
+	const int WIDTH = 16;
+	const __m512 gravity = _mm512_set1_ps(GRAVITY);
+	const __m512 soften = _mm512_set1_ps(SOFTEN);
+
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		__m512 px = _mm512_set1_ps(b.x[i]);
+		__m512 py = _mm512_set1_ps(b.y[i]);
+		__m512 pz = _mm512_set1_ps(b.z[i]);
+
+		__m512 ax = _mm512_setzero_ps();
+		__m512 ay = _mm512_setzero_ps();
+		__m512 az = _mm512_setzero_ps();
+
+		// only the pairs with j > i, each one is applied to both ends
+		size_t first = b.sourceBegin > i ? b.sourceBegin : i + 1;
+
+		for (size_t j = first; j < b.sourceEnd; j += WIDTH)
+		{
+			size_t remaining = b.sourceEnd - j;
+			__mmask16 keep = remaining < WIDTH ? static_cast<__mmask16>((1u << remaining) - 1) : static_cast<__mmask16>(0xFFFF);
+
+			__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(keep, b.x + j), px);
+			__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(keep, b.y + j), py);
+			__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(keep, b.z + j), pz);
+			__m512 d2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+			__m512 scale = _mm512_mul_ps(_mm512_mul_ps(gravity, rsqrt(d2)), invPow(_mm512_add_ps(d2, soften)));
+			scale = _mm512_maskz_mov_ps(keep, scale);
+
+			__m512 fx = _mm512_mul_ps(dx, scale);
+			__m512 fy = _mm512_mul_ps(dy, scale);
+			__m512 fz = _mm512_mul_ps(dz, scale);
+
+			ax = _mm512_add_ps(ax, fx);
+			ay = _mm512_add_ps(ay, fy);
+			az = _mm512_add_ps(az, fz);
+
+			// equal and opposite on the sources
+			_mm512_mask_storeu_ps(b.ax + j, keep, _mm512_sub_ps(_mm512_maskz_loadu_ps(keep, b.ax + j), fx));
+			_mm512_mask_storeu_ps(b.ay + j, keep, _mm512_sub_ps(_mm512_maskz_loadu_ps(keep, b.ay + j), fy));
+			_mm512_mask_storeu_ps(b.az + j, keep, _mm512_sub_ps(_mm512_maskz_loadu_ps(keep, b.az + j), fz));
+		}
+
+		b.ax[i] += _mm512_reduce_add_ps(ax);
+		b.ay[i] += _mm512_reduce_add_ps(ay);
+		b.az[i] += _mm512_reduce_add_ps(az);
+	}
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include "cpu-forces.h"
+
+#ifdef CPU_FORCES_X86
+#include <nmmintrin.h>
+
+// 1/sqrt(x) - the hardware estimate plus one newton step gets close to full float precision
+static inline __m128 rsqrt(__m128 x)
+{
+	__m128 y = _mm_rsqrt_ps(x);
+	__m128 yy = _mm_mul_ps(y, y);
+	return _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), x), yy)));
+}
+
+// x^-POWER built from rsqrt
+static inline __m128 invPow(__m128 x)
+{
+	__m128 r = rsqrt(x);
+
+	if (POWER == 0.5f)
+		return r;
+	if (POWER == 0.75f)
+		return _mm_mul_ps(r, _mm_sqrt_ps(r));
+	if (POWER == 1.0f)
+		return _mm_mul_ps(r, r);
+
+	return _mm_mul_ps(_mm_mul_ps(r, r), r);
+}
+
+static inline float horizontalSum(__m128 v)
+{
+	v = _mm_hadd_ps(v, v);
+	v = _mm_hadd_ps(v, v);
+	return _mm_cvtss_f32(v);
+}
+
+void forceKernelSSE(const ForceBlock& b)
+{
+	const int WIDTH = 4;
+	const __m128 gravity = _mm_set1_ps(GRAVITY);
+	const __m128 soften = _mm_set1_ps(SOFTEN);
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		__m128 px = _mm_set1_ps(b.x[i]);
+		__m128 py = _mm_set1_ps(b.y[i]);
+		__m128 pz = _mm_set1_ps(b.z[i]);
+
+		__m128 ax = _mm_setzero_ps();
+		__m128 ay = _mm_setzero_ps();
+		__m128 az = _mm_setzero_ps();
+
+		for (size_t j = b.sourceBegin; j < b.sourceEnd; j += WIDTH)
+		{
+			size_t remaining = b.sourceEnd - j;
+			__m128 sx, sy, sz;
+
+			if (remaining >= WIDTH)
+			{
+				sx = _mm_loadu_ps(b.x + j);
+				sy = _mm_loadu_ps(b.y + j);
+				sz = _mm_loadu_ps(b.z + j);
+			}
+			else
+			{
+				// tail - pad out the last few sources, the lanes get masked off below
+				float tx[WIDTH] = {}, ty[WIDTH] = {}, tz[WIDTH] = {};
+				for (size_t k = 0; k < remaining; k++)
+				{
+					tx[k] = b.x[j + k];
+					ty[k] = b.y[j + k];
+					tz[k] = b.z[j + k];
+				}
+				sx = _mm_loadu_ps(tx);
+				sy = _mm_loadu_ps(ty);
+				sz = _mm_loadu_ps(tz);
+			}
+
+			__m128 dx = _mm_sub_ps(sx, px);
+			__m128 dy = _mm_sub_ps(sy, py);
+			__m128 dz = _mm_sub_ps(sz, pz);
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+			// normalize(dist) * GRAVITY / pow(d2 + SOFTEN, POWER)
+			__m128 scale = _mm_mul_ps(_mm_mul_ps(gravity, rsqrt(d2)), invPow(_mm_add_ps(d2, soften)));
+
+			// drop the particle's own lane and any padding lanes
+			int self = (i >= j && i - j < WIDTH) ? static_cast<int>(i - j) : -1;
+			int valid = remaining < WIDTH ? static_cast<int>(remaining) : WIDTH;
+			__m128i keep = _mm_andnot_si128(_mm_cmpeq_epi32(lanes, _mm_set1_epi32(self)), _mm_cmplt_epi32(lanes, _mm_set1_epi32(valid)));
+			scale = _mm_and_ps(scale, _mm_castsi128_ps(keep));
+
+			ax = _mm_add_ps(ax, _mm_mul_ps(dx, scale));
+			ay = _mm_add_ps(ay, _mm_mul_ps(dy, scale));
+			az = _mm_add_ps(az, _mm_mul_ps(dz, scale));
+		}
+
+		b.ax[i] += horizontalSum(ax);
+		b.ay[i] += horizontalSum(ay);
+		b.az[i] += horizontalSum(az);
+	}
+}
+
+void forceKernelSSESymmetric(const ForceBlock& b)
+{
+	const int WIDTH = 4;
+	const __m128 gravity = _mm_set1_ps(GRAVITY);
+	const __m128 soften = _mm_set1_ps(SOFTEN);
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		__m128 px = _mm_set1_ps(b.x[i]);
+		__m128 py = _mm_set1_ps(b.y[i]);
+		__m128 pz = _mm_set1_ps(b.z[i]);
+
+		__m128 ax = _mm_setzero_ps();
+		__m128 ay = _mm_setzero_ps();
+		__m128 az = _mm_setzero_ps();
+
+		// only the pairs with j > i, each one is applied to both ends
+		size_t first = b.sourceBegin > i ? b.sourceBegin : i + 1;
+
+		for (size_t j = first; j < b.sourceEnd; j += WIDTH)
+		{
+			size_t remaining = b.sourceEnd - j;
+			int valid = remaining < WIDTH ? static_cast<int>(remaining) : WIDTH;
+
+			// sources and their accelerations, padded out to a full vector on the tail
+			float tx[WIDTH] = {}, ty[WIDTH] = {}, tz[WIDTH] = {};
+			float tax[WIDTH] = {}, tay[WIDTH] = {}, taz[WIDTH] = {};
+			const float *srcX = b.x + j, *srcY = b.y + j, *srcZ = b.z + j;
+			float *accX = b.ax + j, *accY = b.ay + j, *accZ = b.az + j;
+
+			if (valid < WIDTH)
+			{
+				for (int k = 0; k < valid; k++)
+				{
+					tx[k] = srcX[k]; ty[k] = srcY[k]; tz[k] = srcZ[k];
+					tax[k] = accX[k]; tay[k] = accY[k]; taz[k] = accZ[k];
+				}
+				srcX = tx; srcY = ty; srcZ = tz;
+				accX = tax; accY = tay; accZ = taz;
+			}
+
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(srcX), px);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(srcY), py);
+			__m128 dz = _mm_sub_ps(_mm_loadu_ps(srcZ), pz);
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+			__m128 scale = _mm_mul_ps(_mm_mul_ps(gravity, rsqrt(d2)), invPow(_mm_add_ps(d2, soften)));
+			scale = _mm_and_ps(scale, _mm_castsi128_ps(_mm_cmplt_epi32(lanes, _mm_set1_epi32(valid))));
+
+			__m128 fx = _mm_mul_ps(dx, scale);
+			__m128 fy = _mm_mul_ps(dy, scale);
+			__m128 fz = _mm_mul_ps(dz, scale);
+
+			ax = _mm_add_ps(ax, fx);
+			ay = _mm_add_ps(ay, fy);
+			az = _mm_add_ps(az, fz);
+
+			// equal and opposite on the sources
+			_mm_storeu_ps(accX, _mm_sub_ps(_mm_loadu_ps(accX), fx));
+			_mm_storeu_ps(accY, _mm_sub_ps(_mm_loadu_ps(accY), fy));
+			_mm_storeu_ps(accZ, _mm_sub_ps(_mm_loadu_ps(accZ), fz));
+
+			if (valid < WIDTH)
+			{
+				for (int k = 0; k < valid; k++)
+				{
+					b.ax[j + k] = tax[k];
+					b.ay[j + k] = tay[k];
+					b.az[j + k] = taz[k];
+				}
+			}
+		}
+
+		b.ax[i] += horizontalSum(ax);
+		b.ay[i] += horizontalSum(ay);
+		b.az[i] += horizontalSum(az);
+	}
+}
+
+#endif
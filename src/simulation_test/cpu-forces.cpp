@@ -0,0 +1,199 @@
+#include "cpu-forces.h"
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER) && defined(CPU_FORCES_X86)
+#include <intrin.h>
+#elif defined(CPU_FORCES_X86)
+#include <cpuid.h>
+#endif
+
+void forceKernelScalar(const ForceBlock& b)
+{
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		float ax = 0.0f, ay = 0.0f, az = 0.0f;
+
+		for (size_t j = b.sourceBegin; j < b.sourceEnd; j++)
+		{
+			if (i == j)
+				continue;
+
+			float dx = b.x[j] - b.x[i];
+			float dy = b.y[j] - b.y[i];
+			float dz = b.z[j] - b.z[i];
+			float d2 = dx * dx + dy * dy + dz * dz;
+
+			// normalize(dist) * GRAVITY / pow(dot(dist, dist) + SOFTEN, POWER)
+			float scale = GRAVITY / (std::sqrt(d2) * std::pow(d2 + SOFTEN, POWER));
+
+			ax += dx * scale;
+			ay += dy * scale;
+			az += dz * scale;
+		}
+
+		b.ax[i] += ax;
+		b.ay[i] += ay;
+		b.az[i] += az;
+	}
+}
+
+void forceKernelScalarSymmetric(const ForceBlock& b)
+{
+	for (size_t i = b.targetBegin; i < b.targetEnd; i++)
+	{
+		float ax = 0.0f, ay = 0.0f, az = 0.0f;
+
+		// only the pairs with j > i, each one is applied to both ends
+		for (size_t j = std::max(b.sourceBegin, i + 1); j < b.sourceEnd; j++)
+		{
+			float dx = b.x[j] - b.x[i];
+			float dy = b.y[j] - b.y[i];
+			float dz = b.z[j] - b.z[i];
+			float d2 = dx * dx + dy * dy + dz * dz;
+
+			float scale = GRAVITY / (std::sqrt(d2) * std::pow(d2 + SOFTEN, POWER));
+
+			ax += dx * scale;
+			ay += dy * scale;
+			az += dz * scale;
+
+			b.ax[j] -= dx * scale;
+			b.ay[j] -= dy * scale;
+			b.az[j] -= dz * scale;
+		}
+
+		b.ax[i] += ax;
+		b.ay[i] += ay;
+		b.az[i] += az;
+	}
+}
+
+#ifdef CPU_FORCES_X86
+
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	int r[4];
+	__cpuidex(r, leaf, subleaf);
+	for (int i = 0; i < 4; i++)
+		regs[i] = static_cast<unsigned int>(r[i]);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// which register states the OS saves on a context switch
+static unsigned long long xgetbv()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+#endif
+
+ForceKernelInfo selectForceKernel()
+{
+	ForceKernelInfo scalar = { "scalar", forceKernelScalar, forceKernelScalarSymmetric };
+
+	// other exponents need a real pow - only the scalar loop has one
+	if (!FAST_POWER)
+		return scalar;
+
+#ifdef CPU_FORCES_X86
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+
+	cpuid(1, 0, regs);
+	bool sse42 = (regs[2] & (1u << 20)) != 0;
+	bool fma = (regs[2] & (1u << 12)) != 0;
+	bool osxsave = (regs[2] & (1u << 27)) != 0;
+	bool avx = (regs[2] & (1u << 28)) != 0;
+
+	bool avx2 = false, avx512 = false;
+	if (maxLeaf >= 7)
+	{
+		cpuid(7, 0, regs);
+		avx2 = (regs[1] & (1u << 5)) != 0;
+		avx512 = (regs[1] & (1u << 16)) != 0;
+	}
+
+	// the OS also has to save the ymm (and zmm/opmask) state
+	unsigned long long xcr0 = osxsave ? xgetbv() : 0;
+	bool ymmState = (xcr0 & 0x6) == 0x6;
+	bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+	if (avx512 && zmmState)
+		return { "AVX-512", forceKernelAVX512, forceKernelAVX512Symmetric };
+
+	if (avx && avx2 && fma && ymmState)
+		return { "AVX2+FMA", forceKernelAVX2, forceKernelAVX2Symmetric };
+
+	if (sse42)
+		return { "SSE4.2", forceKernelSSE, forceKernelSSESymmetric };
+#endif
+
+	return scalar;
+}
+
+CacheSizes detectCacheSizes()
+{
+	// typical desktop core if the OS won't say
+	CacheSizes caches = { 32 * 1024, 256 * 1024 };
+
+#ifdef _WIN32
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length))
+	{
+		for (auto &i : info)
+		{
+			if (i.Relationship != RelationCache || i.Cache.Type == CacheInstruction)
+				continue;
+
+			if (i.Cache.Level == 1)
+				caches.l1 = i.Cache.Size;
+			else if (i.Cache.Level == 2)
+				caches.l2 = i.Cache.Size;
+		}
+	}
+#elif defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+	long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+	if (l1 > 0)
+		caches.l1 = static_cast<size_t>(l1);
+	if (l2 > 0)
+		caches.l2 = static_cast<size_t>(l2);
+#endif
+
+	return caches;
+}
+
+ForceTiling forceTiling(const CacheSizes& caches)
+{
+	// half of each level is left for everything else that passes through it.
+	// sources are 3 floats of position, targets 3 of position and 3 of acceleration.
+	// both are kept to multiples of 16 so only the last block has a masked tail
+	ForceTiling tiling;
+	tiling.sourceBlock = std::max<size_t>(16, (caches.l1 / 2 / (3 * sizeof(float))) & ~size_t(15));
+	tiling.targetBlock = std::max<size_t>(16, (caches.l2 / 2 / (6 * sizeof(float))) & ~size_t(15));
+
+	return tiling;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include "physics.h"
+
+// the force kernels are compiled once per instruction set (cpu-forces-*.cpp with their own
+// compiler flags) so this header must stay free of anything that emits inline code
+
+// one block of the O(N^2) pass - every target in [targetBegin, targetEnd) is pulled by every
+// source in [sourceBegin, sourceEnd). positions are structure of arrays copies of particle::pos
+struct ForceBlock
+{
+	const float* x;
+	const float* y;
+	const float* z;
+
+	// accelerations - kernels add to these rather than overwrite
+	float* ax;
+	float* ay;
+	float* az;
+
+	size_t targetBegin, targetEnd;
+	size_t sourceBegin, sourceEnd;
+};
+
+typedef void(*ForceKernel)(const ForceBlock& block);
+
+struct ForceKernelInfo
+{
+	const char* name;
+	ForceKernel kernel;
+
+	// newton's third law version - each pair (i in targets, j in sources, j > i) is evaluated once
+	// and added to i and subtracted from j. ax/ay/az must cover both ranges
+	ForceKernel symmetric;
+};
+
+// the vector kernels build (d2 + SOFTEN)^-POWER from rsqrt, which works for these exponents
+const bool FAST_POWER = POWER == 0.5f || POWER == 0.75f || POWER == 1.0f || POWER == 1.5f;
+
+// plain loop, same maths as nbody.comp - always available
+void forceKernelScalar(const ForceBlock& block);
+void forceKernelScalarSymmetric(const ForceBlock& block);
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_FORCES_X86
+void forceKernelSSE(const ForceBlock& block);		// SSE4.2
+void forceKernelAVX2(const ForceBlock& block);		// AVX2 + FMA
+void forceKernelAVX512(const ForceBlock& block);	// AVX-512F
+void forceKernelSSESymmetric(const ForceBlock& block);
+void forceKernelAVX2Symmetric(const ForceBlock& block);
+void forceKernelAVX512Symmetric(const ForceBlock& block);
+#endif
+
+// per core data cache sizes in bytes
+struct CacheSizes
+{
+	size_t l1;
+	size_t l2;
+};
+
+CacheSizes detectCacheSizes();
+
+// tile sizes for the O(N^2) pass, the CPU version of the shader's shared memory tile.
+// a block of sources stays in L1 while every target of a block (resident in L2) is pulled by it
+struct ForceTiling
+{
+	size_t sourceBlock;
+	size_t targetBlock;
+};
+
+ForceTiling forceTiling(const CacheSizes& caches);
+
+// pick the widest kernel this CPU (and OS) can run
+ForceKernelInfo selectForceKernel();
@@ -0,0 +1,395 @@
+#include "simulation.h"
+#include "renderer.h"
+#include "nbody.h"
+#include "physics.h"
+#include "threadpool.h"
+#include "morton.h"
+#include "snapshot.h"
+#include <numeric>
+#include <sstream>
+
+static const size_t INTEGRATE_CHUNK = 4096;
+
+// the base class wants queue and device handles - the CPU engine never uses them
+static const VkQueue nullQueue = VK_NULL_HANDLE;
+static const VkDevice nullDevice = VK_NULL_HANDLE;
+
+cpu_simulation::cpu_simulation(const parameters& param, const std::vector<particle>& initial)
+	: simulation(&nullQueue, &nullQueue, &nullDevice), simParam(param), particles(initial)
+{
+	compute = nullptr;
+
+	size_t count = particles.size();
+	posX.resize(count); posY.resize(count); posZ.resize(count);
+	accX.resize(count); accY.resize(count); accZ.resize(count);
+
+	ids.resize(count);
+	std::iota(ids.begin(), ids.end(), 0u);
+
+	threadCount = ThreadPool::get()->size();
+
+	forceKernel = selectForceKernel();
+	std::cout << "CPU force kernel: " << forceKernel.name << " on " << threadCount << " threads" << std::endl;
+
+	CacheSizes caches = detectCacheSizes();
+	tiling = forceTiling(caches);
+	std::cout << "CPU force tiles: " << tiling.sourceBlock << " sources (L1 " << caches.l1 / 1024 << "KB) x "
+		<< tiling.targetBlock << " targets (L2 " << caches.l2 / 1024 << "KB)" << std::endl;
+
+	if (simParam.symmetric)
+		workerAcc.assign(threadCount, std::vector<float>(3 * count, 0.0f));
+}
+
+cpu_simulation::~cpu_simulation()
+{
+	// no renderer to clean these up
+	for (auto &b : buffers)
+	{
+		delete b;
+	}
+}
+
+// nothing to create on a device
+void cpu_simulation::createCommandPools(QueueFamilyIndices& queueFamilyIndices, VkPhysicalDevice& phys) {}
+void cpu_simulation::allocateComputeCommandBuffers() {}
+void cpu_simulation::recordComputeCommands() {}
+void cpu_simulation::recordGraphicsCommands() {}
+void cpu_simulation::createDescriptorPool() {}
+void cpu_simulation::createDescriptorSets() {}
+void cpu_simulation::createBufferObjects() {}
+void cpu_simulation::cleanup() {}
+
+void cpu_simulation::frame()
+{
+	dispatchCompute();
+}
+
+void cpu_simulation::dispatchCompute()
+{
+	step(simParam.fixedDeltaT > 0.0f ? simParam.fixedDeltaT : frameTimer);
+}
+
+void cpu_simulation::step(float deltaT)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	uint32_t substeps = std::max(1u, simParam.substeps);
+	float subDeltaT = std::max(0.0f, deltaT) / static_cast<float>(substeps);
+
+	for (uint32_t s = 0; s < substeps; s++)
+	{
+		if (simParam.integrator == LEAPFROG)
+		{
+			// the accelerations left by the last kick are for the current positions unless a sort moved things
+			if (!accelerationCurrent)
+				computeForces();
+
+			kick(0.5f * subDeltaT);
+			drift(subDeltaT);
+			computeForces();
+			kick(0.5f * subDeltaT);
+			accelerationCurrent = true;
+		}
+		else
+		{
+			computeForces();
+			integrate(subDeltaT);
+		}
+	}
+
+	stepCount++;
+	simTime += std::max(0.0f, deltaT);
+	lastDeltaT = deltaT;
+
+	if (simParam.resortInterval && stepCount % simParam.resortInterval == 0)
+	{
+		sortParticles();
+		accelerationCurrent = false;
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	computeTime = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void cpu_simulation::loadPositions()
+{
+	ThreadPool::get()->parallelFor(0, particles.size(), INTEGRATE_CHUNK, [this](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			posX[i] = particles[i].pos.x;
+			posY[i] = particles[i].pos.y;
+			posZ[i] = particles[i].pos.z;
+			accX[i] = accY[i] = accZ[i] = 0.0f;
+		}
+	});
+}
+
+void cpu_simulation::computeForces()
+{
+	// kernels read positions as structure of arrays and accumulate into zeroed accelerations
+	loadPositions();
+
+	// one pool task per target block, but at least four per worker on small runs so stealing can even out the tails
+	size_t perWorker = (particles.size() + 4 * threadCount - 1) / (4 * threadCount);
+	size_t chunk = std::min(tiling.targetBlock, std::max<size_t>(16, (perWorker + 15) & ~size_t(15)));
+
+	if (simParam.symmetric)
+	{
+		computeForcesSymmetric(chunk);
+		return;
+	}
+
+	ThreadPool::get()->parallelFor(0, particles.size(), chunk, [this](size_t begin, size_t end)
+	{
+		computeForceRange(begin, end);
+	});
+}
+
+void cpu_simulation::computeForceRange(size_t begin, size_t end)
+{
+	// targets in the range are pulled by every particle, one L1 sized block of sources at a time.
+	// without this every target streams all N sources from memory and large runs stop scaling with cores
+	ForceBlock block = {};
+	block.x = posX.data(); block.y = posY.data(); block.z = posZ.data();
+	block.ax = accX.data(); block.ay = accY.data(); block.az = accZ.data();
+	block.targetBegin = begin;
+	block.targetEnd = end;
+
+	for (size_t source = 0; source < particles.size(); source += tiling.sourceBlock)
+	{
+		block.sourceBegin = source;
+		block.sourceEnd = std::min(source + tiling.sourceBlock, particles.size());
+
+		forceKernel.kernel(block);
+	}
+}
+
+void cpu_simulation::computeForcesSymmetric(size_t chunk)
+{
+	size_t count = particles.size();
+	size_t rowBlocks = (count + chunk - 1) / chunk;
+	auto pool = ThreadPool::get();
+
+	// the sources' accelerations are read and written as well, so they get half the L1 tile
+	size_t sourceBlock = std::max<size_t>(16, tiling.sourceBlock / 2);
+
+	// block k has (count - k * chunk) pairs to its right, so pair it with the block from
+	// the other end to give every task about the same work
+	pool->parallelFor(0, (rowBlocks + 1) / 2, 1, [&](size_t begin, size_t end)
+	{
+		// each worker scatters into its own copy so no two threads write the same j
+		std::vector<float>& acc = workerAcc[pool->currentWorker()];
+
+		ForceBlock block = {};
+		block.x = posX.data(); block.y = posY.data(); block.z = posZ.data();
+		block.ax = acc.data(); block.ay = acc.data() + count; block.az = acc.data() + 2 * count;
+
+		for (size_t k = begin; k < end; k++)
+		{
+			size_t rows[2] = { k, rowBlocks - 1 - k };
+
+			for (size_t r = 0; r < (rows[0] == rows[1] ? 1u : 2u); r++)
+			{
+				block.targetBegin = rows[r] * chunk;
+				block.targetEnd = std::min(block.targetBegin + chunk, count);
+
+				// sources before the block only pair with earlier targets, those pairs are already done
+				for (size_t source = block.targetBegin; source < count; source += sourceBlock)
+				{
+					block.sourceBegin = source;
+					block.sourceEnd = std::min(source + sourceBlock, count);
+
+					forceKernel.symmetric(block);
+				}
+			}
+		}
+	});
+
+	// reduce the worker copies into the accelerations, clearing them for the next step
+	pool->parallelFor(0, count, INTEGRATE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (auto &acc : workerAcc)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				accX[i] += acc[i];
+				accY[i] += acc[count + i];
+				accZ[i] += acc[2 * count + i];
+				acc[i] = acc[count + i] = acc[2 * count + i] = 0.0f;
+			}
+		}
+	});
+}
+
+void cpu_simulation::integrate(float deltaT)
+{
+	// symplectic euler as in the shader - velocity first then position with the new velocity
+	deltaT = std::max(0.0f, deltaT);
+
+	ThreadPool::get()->parallelFor(0, particles.size(), INTEGRATE_CHUNK, [this, deltaT](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::vec3 acceleration = glm::vec3(accX[i], accY[i], accZ[i]);
+			glm::vec3 vel = glm::vec3(particles[i].vel) + deltaT * acceleration;
+			glm::vec3 pos = glm::vec3(particles[i].pos) + vel * deltaT;
+
+			particles[i].pos = glm::vec4(pos, particles[i].pos.w);
+			particles[i].vel = glm::vec4(vel, particles[i].vel.w);
+		}
+	});
+}
+
+void cpu_simulation::resume(const std::vector<uint32_t>& restoredIds, uint64_t step, double time)
+{
+	ids = restoredIds;
+	stepCount = step;
+	simTime = time;
+}
+
+void cpu_simulation::saveSnapshot()
+{
+	writeSnapshot(simParam.snapshotPath, particles, ids, stepCount, simTime, lastDeltaT, simParam.compressionError);
+	std::cout << "Snapshot at step " << stepCount << " written to " << simParam.snapshotPath << std::endl;
+}
+
+void cpu_simulation::kick(float deltaT)
+{
+	ThreadPool::get()->parallelFor(0, particles.size(), INTEGRATE_CHUNK, [this, deltaT](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			particles[i].vel.x += deltaT * accX[i];
+			particles[i].vel.y += deltaT * accY[i];
+			particles[i].vel.z += deltaT * accZ[i];
+		}
+	});
+}
+
+void cpu_simulation::drift(float deltaT)
+{
+	ThreadPool::get()->parallelFor(0, particles.size(), INTEGRATE_CHUNK, [this, deltaT](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			glm::vec3 pos = glm::vec3(particles[i].pos) + glm::vec3(particles[i].vel) * deltaT;
+			particles[i].pos = glm::vec4(pos, particles[i].pos.w);
+		}
+	});
+}
+
+void cpu_simulation::sortParticles()
+{
+	// the structure of arrays copies are free between steps
+	loadPositions();
+
+	std::vector<uint32_t> order;
+	mortonOrder(posX.data(), posY.data(), posZ.data(), particles.size(), order);
+
+	applyOrder(particles, order);
+	applyOrder(ids, order);
+}
+
+std::string cpu_simulation::createFileString(int testNum)
+{
+	std::stringstream filetoSave;
+
+	filetoSave << "CPU" << "_S" << (int)simParam.chosenMode << "_P" << particles.size() <<
+		"_ST" << simParam.stacks <<
+		"_SL" << simParam.slices <<
+		"_SC" << simParam.dims.x <<
+		"_TN" << testNum <<
+		".csv";
+
+	return filetoSave.str();
+}
+
+void cpu_simulation::run()
+{
+	int testNumber = 0;
+	std::string fileName = createFileString(testNumber);
+
+	// check if file exists.. if so increment number.
+	while (does_file_exist(fileName))
+	{
+		testNumber++;
+		fileName = createFileString(testNumber);
+	}
+
+	std::ofstream file(fileName, std::ofstream::out);
+
+	// same header as the GPU runs, columns with no CPU equivalent are left empty
+	file << "Simulation Type" << ", " << simParam.modeTypes[simParam.chosenMode] << std::endl;
+	file << "Particles, " << particles.size() << ", "
+		<< "Stack Count, " << simParam.stacks << ", "
+		<< "Slice Count, " << simParam.slices << ", "
+		<< "Mesh Scale, " << simParam.dims.x
+		<< std::endl;
+
+	file << "Frame" << ", "
+		<< "Frame Time (ms)" << ", "
+		<< "Compute Timestamp Start" << ", "
+		<< "Compute Timestamp End" << ", "
+		<< "Compute Time" << ", "
+		<< "Graphics Timestamp Start" << ", "
+		<< "Graphics Timestamp End" << ", "
+		<< "Graphics Time" << ", "
+		<< "async?" << std::endl;
+
+	auto runStart = std::chrono::high_resolution_clock::now();
+	uint32_t frameCounter = 0;
+	uint32_t secondsRan = 0;
+	float fpsTimer = 0;
+
+	// a fixed step count ends the run by frames instead of by time
+	while (simParam.steps ? frameCounter < simParam.steps : secondsRan <= simParam.totalTime)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		frame();
+
+		frameCounter++;
+		auto endTime = std::chrono::high_resolution_clock::now();
+		auto deltaT = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+		frameTimer = (float)deltaT / 1000.0f;
+
+		if (!simParam.snapshotPath.empty() && simParam.snapshotInterval && frameCounter % simParam.snapshotInterval == 0)
+			saveSnapshot();
+
+		fpsTimer += (float)deltaT;
+		if (fpsTimer > 1000.0f)  // after 1 second
+		{
+			std::cout << std::fixed << deltaT << "ms (" << static_cast<uint32_t>(1.0f / frameTimer) << " fps)" << std::endl;
+
+			fpsTimer = 0.0f;
+			secondsRan++;
+		}
+
+		// host clock in ns stands in for the device timestamps
+		auto stampStart = std::chrono::duration_cast<std::chrono::nanoseconds>(startTime - runStart).count();
+		auto stampEnd = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - runStart).count();
+
+		file << frameCounter << ", "
+			<< deltaT << ", "
+			<< stampStart << ", "
+			<< stampEnd << ", "
+			<< computeTime << ", "
+			<< ", "
+			<< ", "
+			<< ", "
+			<< "NO" << std::endl;
+	}
+
+	// hash of the final state so fixed step runs can be compared
+	if (simParam.steps)
+	{
+		uint64_t hash = stateHash(particles, ids);
+
+		std::cout << "State hash after " << frameCounter << " frames: " << std::hex << hash << std::dec << std::endl;
+		file << "State Hash, " << std::hex << hash << std::dec << std::endl;
+	}
+
+	if (!simParam.snapshotPath.empty())
+		saveSnapshot();
+}
@@ -26,9 +26,14 @@ void double_simulation::frame()
 	renderer->updateUniformBuffer();   // update
 	renderer->updateCompute();		   // update	
 	dispatchCompute();				   // submit compute
+
+	// the draw reads last frame's results while this compute writes the other buffer - it waits on that compute,
+	// and signals the next one, which writes what it read
+	renderer->signalDrawn = true;
 	renderer->drawFrame();			   // render	  
+	lastDrawn = renderer->drawnSemaphore();
 
-	waitOnFence(renderer->graphicsFence);
+	// no waiting here - the next frame only blocks once the cpu is framesInFlight frames ahead
 	bufferIndex = 1 - bufferIndex;
 }
 
@@ -36,10 +41,10 @@ void double_simulation::createDescriptorPool()
 {
 	// how many and what type
 	std::vector<VkDescriptorPoolSize> poolSize = { VkDescriptorPoolSize(), VkDescriptorPoolSize(), VkDescriptorPoolSize() };
-	poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize[0].descriptorCount = 3;
+	poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize[0].descriptorCount = 4;
 	poolSize[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSize[1].descriptorCount = 2;
+	poolSize[1].descriptorCount = 5;		// particles and leapfrog accelerations for both sets, and the euler scratch set
 	poolSize[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 
 	// if lighting then 2 textures are used
@@ -73,15 +78,21 @@ void double_simulation::createDescriptorSets()
 	allocInfo.pSetLayouts = &comp->descriptorSetLayout;
 	allocInfo.descriptorSetCount = 1;
 
-	// for double buffering
-	for (int i = 0; i < 2; i++)
+	// for double buffering, and the scratch buffer if euler substeps need one
+	VkBuffer targets[3] = { buffers[INSTANCE]->buffer[0], buffers[INSTANCE]->buffer[1], comp->scratchBuffer };
+	VkDescriptorSet* sets[3] = { &comp->descriptorSet[0], &comp->descriptorSet[1], &comp->scratchSet };
+
+	for (int i = 0; i < 3; i++)
 	{
+		if (targets[i] == VK_NULL_HANDLE)
+			continue;
+
 		// create allocation
-		if (vkAllocateDescriptorSets(device, &allocInfo, &comp->descriptorSet[i]) != VK_SUCCESS)
+		if (vkAllocateDescriptorSets(device, &allocInfo, sets[i]) != VK_SUCCESS)
 			throw std::runtime_error("Failed to allocate descriptor set for compute");
 
 		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = buffers[INSTANCE]->buffer[i];
+		bufferInfo.buffer = targets[i];
 		bufferInfo.offset = 0;
 		bufferInfo.range = sizeof(particle) * buffers[INSTANCE]->size;  //  BUFFER SIZE FOR COMPUTE!
 
@@ -89,29 +100,46 @@ void double_simulation::createDescriptorSets()
 		// Binding 0 : Particle position storage buffer
 		VkWriteDescriptorSet storageDesc{};
 		storageDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		storageDesc.dstSet = comp->descriptorSet[i];
+		storageDesc.dstSet = *sets[i];
 		storageDesc.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		storageDesc.dstBinding = 0;
 		storageDesc.pBufferInfo = &bufferInfo;
 		storageDesc.descriptorCount = 1;
 
 		VkDescriptorBufferInfo UBI = {};
-		UBI.buffer = comp->uniformBuffer;
+		UBI.buffer = comp->uniforms.handle();
 		UBI.offset = 0;
-		UBI.range = sizeof(ComputeConfig::computeUBO);
+		UBI.range = comp->uniforms.range();
 
 
 		// Binding 1 : Uniform buffer
 		VkWriteDescriptorSet uniformDesc{};
 		uniformDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		uniformDesc.dstSet = comp->descriptorSet[i];
-		uniformDesc.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		uniformDesc.dstSet = *sets[i];
+		uniformDesc.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		uniformDesc.dstBinding = 1;
 		uniformDesc.pBufferInfo = &UBI;
 		uniformDesc.descriptorCount = 1;
 
 		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = { storageDesc, uniformDesc };
 
+		// Binding 2 : Leapfrog accelerations - one buffer shared by both sets
+		VkDescriptorBufferInfo accelerationInfo = {};
+		accelerationInfo.buffer = comp->accelerationBuffer;
+		accelerationInfo.offset = 0;
+		accelerationInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet accelerationDesc{};
+		accelerationDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		accelerationDesc.dstSet = *sets[i];
+		accelerationDesc.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		accelerationDesc.dstBinding = 2;
+		accelerationDesc.pBufferInfo = &accelerationInfo;
+		accelerationDesc.descriptorCount = 1;
+
+		if (comp->leapfrog)
+			computeWriteDescriptorSets.push_back(accelerationDesc);
+
 		// create sets
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
 
@@ -120,26 +148,8 @@ void double_simulation::createDescriptorSets()
 
 void double_simulation::allocateComputeCommandBuffers()
 {
-	auto comp = static_cast<Async*>(compute);
-
-	// Create a command buffer for compute operations
-	VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
-	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cmdBufAllocateInfo.commandPool = comp->commandPool;
-	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	cmdBufAllocateInfo.commandBufferCount = 2;
-	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, comp->commandBuffer) != VK_SUCCESS)
-		throw std::runtime_error("Failed allocating buffer for compute commands");
-	// Fence for compute CB sync
-	VkFenceCreateInfo fenceCreateInfo{};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = 0;
-	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &compute->fence) != VK_SUCCESS)
-		throw std::runtime_error("Failed creating compute fence");
-
-	// fence for gfx
-	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &renderer->graphicsFence) != VK_SUCCESS)
-		throw std::runtime_error("Failed creating gfx fence");
+	// an even number of slots, so a slot always writes the same buffer
+	compute->createFrameResources(device, renderer->frameSlots, renderer->framesInFlight);
 }
 
 void double_simulation::allocateGraphicsCommandBuffers()
@@ -152,7 +162,7 @@ void double_simulation::allocateGraphicsCommandBuffers()
 	// primary can be submitted to a queue for execution but cannot be called from other command buffers
 	// secondary cannot be submitted but can be called from primary buffers
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = 2;
+	allocInfo.commandBufferCount = static_cast<uint32_t>(renderer->graphicsCmdBuffers.size());
 
 	if (vkAllocateCommandBuffers(device, &allocInfo, renderer->graphicsCmdBuffers.data()) != VK_SUCCESS)
 	{
@@ -162,51 +172,56 @@ void double_simulation::allocateGraphicsCommandBuffers()
 
 void double_simulation::recordComputeCommands()
 {
-	recordComputeCommand(0);
-	recordComputeCommand(1);
+	for (uint32_t slot = 0; slot < compute->commandBuffers.size(); slot++)
+		recordComputeCommand(slot);
 }
 
-void double_simulation::recordComputeCommand(int frame)
+void double_simulation::recordComputeCommand(uint32_t slot)
 {
 	// create command buffer For current frame....
 	// Compute: Begin, bind pipeline, bind desc sets, dispatch calls, end.
 	auto comp = static_cast<Async*>(compute);
+	VkCommandBuffer commandBuffer = comp->commandBuffers[slot];
+	uint32_t frame = slot % 2;
 
 	// begin
 	VkCommandBufferBeginInfo cmdBufInfo{};
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-	if (vkBeginCommandBuffer(comp->commandBuffer[frame], &cmdBufInfo) != VK_SUCCESS)
+	if (vkBeginCommandBuffer(commandBuffer, &cmdBufInfo) != VK_SUCCESS)
 		throw std::runtime_error("Compute command buffer failed to start");
 
-	// bind pipeline & desc sets
-	vkCmdBindPipeline(comp->commandBuffer[frame], VK_PIPELINE_BIND_POINT_COMPUTE, comp->pipeline);
-
-	// get both desc sets
+	// bind pipeline - recordSteps binds the descriptor sets for each substep
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, comp->pipeline);
 
-	std::vector<VkDescriptorSet> descSets = { comp->descriptorSet[1 - frame], comp->descriptorSet[frame] };
+	vkCmdResetQueryPool(commandBuffer, renderer->computeQueryPool, 2 * slot, 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 2 * slot);
 
-	vkCmdBindDescriptorSets(comp->commandBuffer[frame], VK_PIPELINE_BIND_POINT_COMPUTE, comp->pipelineLayout, 0, descSets.size(), descSets.data(), 0, nullptr);
-	vkCmdResetQueryPool(comp->commandBuffer[frame], renderer->computeQueryPool, 0, 2);
-	vkCmdWriteTimestamp(comp->commandBuffer[frame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 0);
-	vkCmdDispatch(comp->commandBuffer[frame], renderer->PARTICLE_COUNT, 1, 1);
-	vkCmdWriteTimestamp(comp->commandBuffer[frame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 1);
+	// read last frame's buffer and write this one's - substeps after the first end on it too
+	comp->recordSteps(commandBuffer, comp->descriptorSet[1 - frame], comp->descriptorSet[frame], renderer->PARTICLE_COUNT, slot);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 2 * slot + 1);
 
 	// end cmd writing
-	vkEndCommandBuffer(comp->commandBuffer[frame]);
+	vkEndCommandBuffer(commandBuffer);
 }
 
 void double_simulation::recordGraphicsCommands()
 {
-	// resize to 2
-	renderer->graphicsCmdBuffers.resize(2);
+	// one per frame slot and image
+	renderer->graphicsCmdBuffers.resize(renderer->graphicsCommandCount());
 	allocateGraphicsCommandBuffers();
-	recordRenderCommand(0);
-	recordRenderCommand(1);
+
+	for (uint32_t i = 0; i < renderer->graphicsCmdBuffers.size(); i++)
+		recordRenderCommand(i);
 }
 
-void double_simulation::recordRenderCommand(int frame)
+void double_simulation::recordRenderCommand(uint32_t command)
 {
+	// the image it draws into, and the buffer its slot's compute reads - the last one written
+	uint32_t image = command % static_cast<uint32_t>(renderer->swapChainFramebuffers.size());
+	uint32_t frame = (command / static_cast<uint32_t>(renderer->swapChainFramebuffers.size())) % 2;
+	VkCommandBuffer commandBuffer = renderer->graphicsCmdBuffers[command];
+
 	// begin recording command buffer
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -216,16 +231,17 @@ void double_simulation::recordRenderCommand(int frame)
 	beginInfo.pInheritanceInfo = nullptr; // Optional - only relevant for secondary cmd buffers
 
 										  // this call resets command buffer as not possible to ammend
-	vkBeginCommandBuffer(renderer->graphicsCmdBuffers[frame], &beginInfo);
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-	vkCmdResetQueryPool(renderer->graphicsCmdBuffers[frame], renderer->renderQueryPool, 0, 2);
+	uint32_t query = renderer->graphicsQuery(command);
+	vkCmdResetQueryPool(commandBuffer, renderer->renderQueryPool, query, 2);
 
 	// Start the render pass
 	VkRenderPassBeginInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	// render pass and it's attachments to bind (in this case a colour attachment from the frambuffer)
 	renderPassInfo.renderPass = renderer->renderPass;
-	renderPassInfo.framebuffer = renderer->swapChainFramebuffers[frame];
+	renderPassInfo.framebuffer = renderer->swapChainFramebuffers[image];
 
 	// size of render area
 	renderPassInfo.renderArea.offset = { 0, 0 };
@@ -240,65 +256,60 @@ void double_simulation::recordRenderCommand(int frame)
 	renderPassInfo.pClearValues = clearValues.data();
 
 	// begin pass - command buffer to record to, the render pass details, how the commands are provided (from 1st/2ndary)
-	vkCmdBeginRenderPass(renderer->graphicsCmdBuffers[frame], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 	// BIND THE PIPELINE
-	vkCmdBindPipeline(renderer->graphicsCmdBuffers[frame], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->graphicsPipeline);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->graphicsPipeline);
 
 	// bind the vbo
 	VkBuffer vertexBuffers[] = { buffers[VERTEX]->buffer[buffIndex] };
 	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(renderer->graphicsCmdBuffers[frame], 0, 1, vertexBuffers, offsets); // vbo
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets); // vbo
 
-	VkBuffer instanceBuffers[] = { buffers[INSTANCE]->buffer[frame] };
+	VkBuffer instanceBuffers[] = { buffers[INSTANCE]->buffer[1 - frame] };
 
-	vkCmdBindVertexBuffers(renderer->graphicsCmdBuffers[frame], 1, 1, instanceBuffers, offsets); // instance
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, instanceBuffers, offsets); // instance
 																				   // bind index & uniforms
-	vkCmdBindIndexBuffer(renderer->graphicsCmdBuffers[frame], buffers[INDEX]->buffer[buffIndex], 0, VK_INDEX_TYPE_UINT16);
-	vkCmdBindDescriptorSets(renderer->graphicsCmdBuffers[frame], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipelineLayout, 0, 1, &renderer->gfxDescriptorSet, 0, nullptr);
+	vkCmdBindIndexBuffer(commandBuffer, buffers[INDEX]->buffer[buffIndex], 0, VK_INDEX_TYPE_UINT16);
+	uint32_t uniformOffset = renderer->uniforms.offset(command);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipelineLayout, 0, 1, &renderer->gfxDescriptorSet, 1, &uniformOffset);
 
-	vkCmdWriteTimestamp(renderer->graphicsCmdBuffers[frame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, 0);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, query);
 
 	// DRAW A TRIANGLEEEEE!!
 	// vertex count, instance count, first vertex/ first instance. - used for offsets
-	vkCmdDrawIndexed(renderer->graphicsCmdBuffers[frame], static_cast<uint32_t>(buffers[INDEX]->size), static_cast<uint32_t>(buffers[INSTANCE]->size), 0, 0, 0);
+	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(buffers[INDEX]->size), static_cast<uint32_t>(buffers[INSTANCE]->size), 0, 0, 0);
 	//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
 
-	vkCmdWriteTimestamp(renderer->graphicsCmdBuffers[frame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, 1);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, query + 1);
 
 
 	// end the pass
-	vkCmdEndRenderPass(renderer->graphicsCmdBuffers[frame]);
+	vkCmdEndRenderPass(commandBuffer);
 
 	// check if failed recording
-	if (vkEndCommandBuffer(renderer->graphicsCmdBuffers[frame]) != VK_SUCCESS)
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
 		throw std::runtime_error("failed to record command buffer!");
 
 }
 
-void double_simulation::waitOnFence(VkFence& fence)
-{
-	// spinlock on fence
-	while (vkWaitForFences(device, 1, &fence, VK_TRUE, 1000) != VK_SUCCESS);
-
-	// reset fence
-	vkResetFences(device, 1, &fence);
-}
-
 void double_simulation::dispatchCompute()
 {
-	// have to cast compute to use multi buffers
-	auto comp = static_cast<Async*>(compute);
-
-	VkSubmitInfo computeSubmitInfo{};
-	computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	computeSubmitInfo.pCommandBuffers = &comp->commandBuffer[bufferIndex];
-	computeSubmitInfo.commandBufferCount = 1;
+	// slots come in pairs, so this one's parity is bufferIndex
+	uint32_t slot = renderer->frameSlot();
 
-	if (vkQueueSubmit(comp->queue, 1, &computeSubmitInfo, comp->fence) != VK_SUCCESS)
-		throw std::runtime_error("failed to submit compute queue");
+	// the submission framesInFlight frames back is done with the slot's ubo, so this frame's values can go in
+	compute->waitSlot(device, slot);
+	compute->writeUniforms(slot);
 
+	// last frame's draw read the buffer this writes, and this frame's draws what it wrote
+	compute->waitSemaphore = lastDrawn;
+	compute->waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	compute->signalSemaphore = compute->finished[slot];
+	renderer->drawWait = compute->signalSemaphore;
+	lastDrawn = VK_NULL_HANDLE;
 
+	compute->submit(slot);
 }
 
 void double_simulation::cleanup()
@@ -0,0 +1,84 @@
+#include "fft.h"
+#include "threadpool.h"
+
+static const size_t LINE_CHUNK = 64;
+
+// iterative cooley-tukey on one line
+static void fftLine(std::complex<float>* data, uint32_t size, const std::vector<uint32_t>& reversed, const std::vector<std::complex<float>>& twiddles)
+{
+	for (uint32_t i = 0; i < size; i++)
+	{
+		if (i < reversed[i])
+			std::swap(data[i], data[reversed[i]]);
+	}
+
+	for (uint32_t length = 2; length <= size; length <<= 1)
+	{
+		uint32_t half = length >> 1;
+		uint32_t stride = size / length;
+
+		for (uint32_t start = 0; start < size; start += length)
+		{
+			for (uint32_t k = 0; k < half; k++)
+			{
+				std::complex<float> odd = data[start + k + half] * twiddles[k * stride];
+				data[start + k + half] = data[start + k] - odd;
+				data[start + k] += odd;
+			}
+		}
+	}
+}
+
+void fft3d(std::vector<std::complex<float>>& grid, uint32_t size, bool inverse)
+{
+	uint32_t bits = 0;
+	while ((1u << bits) < size)
+		bits++;
+
+	std::vector<uint32_t> reversed(size);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		uint32_t r = 0;
+		for (uint32_t b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		reversed[i] = r;
+	}
+
+	const double pi = 3.14159265358979323846;
+	std::vector<std::complex<float>> twiddles(size / 2 + 1);
+	for (uint32_t k = 0; k < twiddles.size(); k++)
+	{
+		double angle = (inverse ? 2.0 : -2.0) * pi * k / size;
+		twiddles[k] = std::complex<float>(static_cast<float>(std::cos(angle)), static_cast<float>(std::sin(angle)));
+	}
+
+	const size_t lines = static_cast<size_t>(size) * size;
+
+	// element step along the axis and where line l starts, for x, y then z
+	for (int axis = 0; axis < 3; axis++)
+	{
+		size_t step = axis == 0 ? 1 : axis == 1 ? size : static_cast<size_t>(size) * size;
+
+		ThreadPool::get()->parallelFor(0, lines, LINE_CHUNK, [&](size_t begin, size_t end)
+		{
+			std::vector<std::complex<float>> line(size);
+
+			for (size_t l = begin; l < end; l++)
+			{
+				// the two coordinates that aren't this axis
+				size_t a = l % size, b = l / size;
+				size_t start = axis == 0 ? (a + b * size) * size
+					: axis == 1 ? a + b * size * size
+					: a + b * size;
+
+				for (uint32_t i = 0; i < size; i++)
+					line[i] = grid[start + i * step];
+
+				fftLine(line.data(), size, reversed, twiddles);
+
+				for (uint32_t i = 0; i < size; i++)
+					grid[start + i * step] = line[i];
+			}
+		});
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <complex>
+#include <vector>
+#include <cstdint>
+
+// in place radix-2 FFT over a size^3 complex grid stored x fastest. size must be a power of two.
+// each axis is done as size^2 independent lines, shared out over the thread pool.
+// the inverse is not scaled - divide by size^3 afterwards
+void fft3d(std::vector<std::complex<float>>& grid, uint32_t size, bool inverse);
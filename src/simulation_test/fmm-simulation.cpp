@@ -0,0 +1,74 @@
+#include "simulation.h"
+#include "nbody.h"
+#include "threadpool.h"
+#include <cmath>
+
+// how often the FMM result is checked against the direct sum, and on how many particles
+static const uint64_t ERROR_INTERVAL = 100;
+static const size_t ERROR_SAMPLES = 256;
+
+fmm_simulation::fmm_simulation(const parameters& param, const std::vector<particle>& initial)
+	: cpu_simulation(param, initial), fmm(param.fmmOrder)
+{
+	directX.resize(particles.size());
+	directY.resize(particles.size());
+	directZ.resize(particles.size());
+}
+
+void fmm_simulation::computeForces()
+{
+	loadPositions();
+
+	fmm.evaluate(posX.data(), posY.data(), posZ.data(), particles.size(),
+		accX.data(), accY.data(), accZ.data(), forceKernel.kernel);
+
+	if (stepCount % ERROR_INTERVAL == 0)
+		measureError();
+}
+
+void fmm_simulation::measureError()
+{
+	size_t count = particles.size();
+	size_t samples = std::min(ERROR_SAMPLES, count);
+
+	// direct sum for evenly spaced particles, each pulled by all the others
+	ThreadPool::get()->parallelFor(0, samples, 1, [&](size_t begin, size_t end)
+	{
+		ForceBlock block = {};
+		block.x = posX.data(); block.y = posY.data(); block.z = posZ.data();
+		block.ax = directX.data(); block.ay = directY.data(); block.az = directZ.data();
+		block.sourceBegin = 0;
+		block.sourceEnd = count;
+
+		for (size_t s = begin; s < end; s++)
+		{
+			size_t i = s * count / samples;
+			directX[i] = directY[i] = directZ[i] = 0.0f;
+
+			block.targetBegin = i;
+			block.targetEnd = i + 1;
+			forceKernel.kernel(block);
+		}
+	});
+
+	double errorSum = 0.0, magnitudeSum = 0.0, worst = 0.0;
+	for (size_t s = 0; s < samples; s++)
+	{
+		size_t i = s * count / samples;
+		glm::vec3 direct(directX[i], directY[i], directZ[i]);
+		glm::vec3 error = glm::vec3(accX[i], accY[i], accZ[i]) - direct;
+
+		double e2 = glm::dot(error, error);
+		double d2 = glm::dot(direct, direct);
+		errorSum += e2;
+		magnitudeSum += d2;
+		if (d2 > 0.0)
+			worst = std::max(worst, std::sqrt(e2 / d2));
+	}
+
+	double rms = magnitudeSum > 0.0 ? std::sqrt(errorSum / magnitudeSum) : 0.0;
+
+	std::cout << "FMM step " << stepCount << " - depth " << fmm.depth() << ", " << fmm.leafCount() << " leaves, "
+		<< "force error vs direct sum: " << std::scientific << rms << " rms, " << worst << " max ("
+		<< samples << " particles)" << std::fixed << std::endl;
+}
@@ -0,0 +1,483 @@
+#include "fmm.h"
+#include "morton.h"
+#include "force-law.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <numeric>
+
+static const uint32_t MAX_ORDER = 10;
+static const size_t CELL_CHUNK = 16;
+static const size_t PARTICLE_CHUNK = 1 << 14;
+
+// out[a][b][c] += sum A[a][i] * B[b][j] * C[c][k] * in[i][j][k], one axis at a time.
+// with transpose set the matrices are used as A[i][a] etc
+static void applyTensor(const float* A, const float* B, const float* C, bool transpose, const float* in, float* out, uint32_t p)
+{
+	auto at = [&](const float* M, uint32_t r, uint32_t c) { return transpose ? M[c * p + r] : M[r * p + c]; };
+
+	float t1[MAX_ORDER * MAX_ORDER * MAX_ORDER];
+	float t2[MAX_ORDER * MAX_ORDER * MAX_ORDER];
+
+	for (uint32_t i = 0; i < p; i++)
+		for (uint32_t j = 0; j < p; j++)
+			for (uint32_t c = 0; c < p; c++)
+			{
+				float sum = 0.0f;
+				for (uint32_t k = 0; k < p; k++)
+					sum += at(C, c, k) * in[(i * p + j) * p + k];
+				t1[(i * p + j) * p + c] = sum;
+			}
+
+	for (uint32_t i = 0; i < p; i++)
+		for (uint32_t b = 0; b < p; b++)
+			for (uint32_t c = 0; c < p; c++)
+			{
+				float sum = 0.0f;
+				for (uint32_t j = 0; j < p; j++)
+					sum += at(B, b, j) * t1[(i * p + j) * p + c];
+				t2[(i * p + b) * p + c] = sum;
+			}
+
+	for (uint32_t a = 0; a < p; a++)
+		for (uint32_t b = 0; b < p; b++)
+			for (uint32_t c = 0; c < p; c++)
+			{
+				float sum = 0.0f;
+				for (uint32_t i = 0; i < p; i++)
+					sum += at(A, a, i) * t2[(i * p + b) * p + c];
+				out[(a * p + b) * p + c] += sum;
+			}
+}
+
+Fmm::Fmm(uint32_t expansionOrder)
+{
+	order = std::min(MAX_ORDER, std::max(2u, expansionOrder));
+	nodeCount = order * order * order;
+
+	const float pi = 3.14159265358979f;
+	nodes.resize(order);
+	nodePolys.resize(order * order);
+
+	for (uint32_t m = 0; m < order; m++)
+	{
+		nodes[m] = std::cos((2.0f * m + 1.0f) * pi / (2.0f * order));
+
+		// chebyshev polynomials by recurrence
+		nodePolys[m * order] = 1.0f;
+		if (order > 1)
+			nodePolys[m * order + 1] = nodes[m];
+		for (uint32_t k = 2; k < order; k++)
+			nodePolys[m * order + k] = 2.0f * nodes[m] * nodePolys[m * order + k - 1] - nodePolys[m * order + k - 2];
+	}
+
+	// a child's nodes sit at (node - 1) / 2 or (node + 1) / 2 in its parent's coordinates
+	std::vector<float> weights(order);
+	for (int half = 0; half < 2; half++)
+	{
+		childTransfer[half].resize(order * order);
+
+		for (uint32_t c = 0; c < order; c++)
+		{
+			interpolationWeights((nodes[c] + (half ? 1.0f : -1.0f)) * 0.5f, weights.data());
+
+			for (uint32_t m = 0; m < order; m++)
+				childTransfer[half][m * order + c] = weights[m];
+		}
+	}
+}
+
+// weight of each node in the 1D interpolation at position:
+// S(node, position) = 1/p + 2/p * sum T_k(node) T_k(position)
+void Fmm::interpolationWeights(float position, float* weights) const
+{
+	float polys[MAX_ORDER];
+	polys[0] = 1.0f;
+	if (order > 1)
+		polys[1] = position;
+	for (uint32_t k = 2; k < order; k++)
+		polys[k] = 2.0f * position * polys[k - 1] - polys[k - 2];
+
+	for (uint32_t m = 0; m < order; m++)
+	{
+		float sum = 0.0f;
+		for (uint32_t k = 1; k < order; k++)
+			sum += nodePolys[m * order + k] * polys[k];
+
+		weights[m] = (1.0f + 2.0f * sum) / order;
+	}
+}
+
+uint32_t Fmm::chooseDepth(size_t count) const
+{
+	// deepest level whose non empty cells still hold about 4 * order^3 particles each -
+	// where the near field direct sums cost about as much as the far field translations
+	const size_t target = 4 * nodeCount;
+
+	// count how many new cells each level adds along the sorted keys
+	std::vector<size_t> newCells(MORTON_BITS + 1, 0);
+	for (size_t i = 1; i < count; i++)
+	{
+		uint32_t level = 1;
+		while (level < MORTON_BITS && (keys[i] >> 3 * (MORTON_BITS - level)) == (keys[i - 1] >> 3 * (MORTON_BITS - level)))
+			level++;
+
+		if (keys[i] != keys[i - 1])
+			newCells[level]++;
+	}
+
+	size_t cells = 1;
+	uint32_t depth = 0;
+	for (uint32_t level = 1; level <= MORTON_BITS; level++)
+	{
+		cells += newCells[level];
+		if (count / cells < target)
+			break;
+		depth = level;
+	}
+
+	// interaction lists start at level 2
+	return std::max(2u, depth);
+}
+
+void Fmm::buildLevels(uint32_t depth)
+{
+	levels.assign(depth + 1, Level());
+
+	// leaves - runs of particles sharing a prefix
+	Level& leaves = levels[depth];
+	uint32_t shift = 3 * (MORTON_BITS - depth);
+	for (size_t k = 0; k < keys.size(); k++)
+	{
+		uint64_t prefix = keys[k] >> shift;
+		if (k == 0 || prefix != leaves.keys.back())
+		{
+			leaves.keys.push_back(prefix);
+			leaves.first.push_back(static_cast<uint32_t>(k));
+		}
+	}
+	leaves.first.push_back(static_cast<uint32_t>(keys.size()));
+
+	// parents - runs of children sharing a prefix
+	for (uint32_t l = depth - 1; l >= 2; l--)
+	{
+		const Level& children = levels[l + 1];
+		Level& parents = levels[l];
+
+		for (size_t c = 0; c < children.keys.size(); c++)
+		{
+			uint64_t prefix = children.keys[c] >> 3;
+			if (c == 0 || prefix != parents.keys.back())
+			{
+				parents.keys.push_back(prefix);
+				parents.first.push_back(static_cast<uint32_t>(c));
+			}
+		}
+		parents.first.push_back(static_cast<uint32_t>(children.keys.size()));
+	}
+
+	for (uint32_t l = 0; l <= depth; l++)
+	{
+		levels[l].size = rootSize / static_cast<float>(1u << l);
+		levels[l].multipole.assign(levels[l].keys.size() * nodeCount, 0.0f);
+		levels[l].local.assign(levels[l].keys.size() * 3 * nodeCount, 0.0f);
+	}
+}
+
+glm::vec3 Fmm::cellCentre(const Level& level, uint32_t cell) const
+{
+	uint32_t ix, iy, iz;
+	mortonDecode(level.keys[cell], ix, iy, iz);
+	return lo + level.size * (glm::vec3(ix, iy, iz) + 0.5f);
+}
+
+int64_t Fmm::findCell(const Level& level, uint64_t key) const
+{
+	auto it = std::lower_bound(level.keys.begin(), level.keys.end(), key);
+	if (it == level.keys.end() || *it != key)
+		return -1;
+
+	return it - level.keys.begin();
+}
+
+void Fmm::evaluate(const float* posX, const float* posY, const float* posZ, size_t count,
+	float* accX, float* accY, float* accZ, ForceKernel nearKernel)
+{
+	if (count == 0)
+		return;
+
+	auto pool = ThreadPool::get();
+
+	// sort along the morton curve so every cell is a contiguous run
+	mortonBounds(posX, posY, posZ, count, lo, rootSize);
+
+	keys.resize(count);
+	mortonKeys(posX, posY, posZ, count, lo, rootSize, keys.data());
+
+	sortOrder.resize(count);
+	std::iota(sortOrder.begin(), sortOrder.end(), 0u);
+	radixSort(keys, sortOrder);
+
+	x.resize(count); y.resize(count); z.resize(count);
+	ax.assign(count, 0.0f); ay.assign(count, 0.0f); az.assign(count, 0.0f);
+
+	pool->parallelFor(0, count, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; k++)
+		{
+			x[k] = posX[sortOrder[k]];
+			y[k] = posY[sortOrder[k]];
+			z[k] = posZ[sortOrder[k]];
+		}
+	});
+
+	buildLevels(chooseDepth(count));
+
+	particlesToMultipoles();
+	multipolesUp();
+	multipolesToLocals();
+	localsDown();
+	localsToParticles();
+	nearField(nearKernel);
+
+	pool->parallelFor(0, count, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; k++)
+		{
+			accX[sortOrder[k]] += ax[k];
+			accY[sortOrder[k]] += ay[k];
+			accZ[sortOrder[k]] += az[k];
+		}
+	});
+}
+
+void Fmm::particlesToMultipoles()
+{
+	// every particle spreads a weight of one over its leaf's nodes
+	uint32_t depth = this->depth();
+	Level& leaves = levels[depth];
+
+	ThreadPool::get()->parallelFor(0, leaves.keys.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+	{
+		float wx[MAX_ORDER], wy[MAX_ORDER], wz[MAX_ORDER];
+
+		for (uint32_t c = static_cast<uint32_t>(begin); c < end; c++)
+		{
+			glm::vec3 centre = cellCentre(leaves, c);
+			float toUnit = 2.0f / leaves.size;
+			float* multipole = &leaves.multipole[c * nodeCount];
+
+			for (uint32_t k = leaves.first[c]; k < leaves.first[c + 1]; k++)
+			{
+				interpolationWeights((x[k] - centre.x) * toUnit, wx);
+				interpolationWeights((y[k] - centre.y) * toUnit, wy);
+				interpolationWeights((z[k] - centre.z) * toUnit, wz);
+
+				for (uint32_t i = 0; i < order; i++)
+					for (uint32_t j = 0; j < order; j++)
+						for (uint32_t l = 0; l < order; l++)
+							multipole[(i * order + j) * order + l] += wx[i] * wy[j] * wz[l];
+			}
+		}
+	});
+}
+
+void Fmm::multipolesUp()
+{
+	for (uint32_t l = depth() - 1; l >= 2; l--)
+	{
+		Level& parents = levels[l];
+		const Level& children = levels[l + 1];
+
+		ThreadPool::get()->parallelFor(0, parents.keys.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				for (uint32_t child = parents.first[c]; child < parents.first[c + 1]; child++)
+				{
+					// the low three key bits say which half the child is in along x, y and z
+					uint64_t octant = children.keys[child] & 7;
+					applyTensor(childTransfer[octant & 1].data(), childTransfer[(octant >> 1) & 1].data(), childTransfer[(octant >> 2) & 1].data(),
+						false, &children.multipole[child * nodeCount], &parents.multipole[c * nodeCount], order);
+				}
+			}
+		});
+	}
+}
+
+void Fmm::multipolesToLocals()
+{
+	for (uint32_t l = 2; l <= depth(); l++)
+	{
+		Level& level = levels[l];
+		const int32_t parentCells = 1 << (l - 1);
+
+		// node to node offsets along one axis, in units of the cell size
+		std::vector<float> nodeOffset(order * order);
+		for (uint32_t m = 0; m < order; m++)
+			for (uint32_t n = 0; n < order; n++)
+				nodeOffset[m * order + n] = 0.5f * (nodes[n] - nodes[m]);
+
+		ThreadPool::get()->parallelFor(0, level.keys.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				uint32_t ix, iy, iz;
+				mortonDecode(level.keys[c], ix, iy, iz);
+				int32_t px = ix >> 1, py = iy >> 1, pz = iz >> 1;
+
+				float* local = &level.local[c * 3 * nodeCount];
+
+				// the interaction list - children of the parent's neighbours that aren't neighbours themselves
+				for (int32_t nx = px - 1; nx <= px + 1; nx++)
+				for (int32_t ny = py - 1; ny <= py + 1; ny++)
+				for (int32_t nz = pz - 1; nz <= pz + 1; nz++)
+				{
+					if (nx < 0 || ny < 0 || nz < 0 || nx >= parentCells || ny >= parentCells || nz >= parentCells)
+						continue;
+
+					for (uint32_t octant = 0; octant < 8; octant++)
+					{
+						int32_t sx = 2 * nx + (octant & 1);
+						int32_t sy = 2 * ny + ((octant >> 1) & 1);
+						int32_t sz = 2 * nz + ((octant >> 2) & 1);
+
+						if (std::abs(sx - static_cast<int32_t>(ix)) <= 1 && std::abs(sy - static_cast<int32_t>(iy)) <= 1 && std::abs(sz - static_cast<int32_t>(iz)) <= 1)
+							continue;
+
+						int64_t source = findCell(level, mortonEncode(sx, sy, sz));
+						if (source < 0)
+							continue;
+
+						const float* multipole = &level.multipole[source * nodeCount];
+						glm::vec3 cellOffset = glm::vec3(sx - static_cast<int32_t>(ix), sy - static_cast<int32_t>(iy), sz - static_cast<int32_t>(iz));
+
+						// pull of every source node on every target node
+						for (uint32_t mi = 0; mi < order; mi++)
+						for (uint32_t mj = 0; mj < order; mj++)
+						for (uint32_t mk = 0; mk < order; mk++)
+						{
+							uint32_t m = (mi * order + mj) * order + mk;
+							glm::vec3 acceleration(0.0f);
+
+							for (uint32_t ni = 0; ni < order; ni++)
+							for (uint32_t nj = 0; nj < order; nj++)
+							for (uint32_t nk = 0; nk < order; nk++)
+							{
+								glm::vec3 d = level.size * (cellOffset + glm::vec3(nodeOffset[mi * order + ni], nodeOffset[mj * order + nj], nodeOffset[mk * order + nk]));
+								acceleration += d * (pairScale(glm::dot(d, d)) * multipole[(ni * order + nj) * order + nk]);
+							}
+
+							local[m] += acceleration.x;
+							local[nodeCount + m] += acceleration.y;
+							local[2 * nodeCount + m] += acceleration.z;
+						}
+					}
+				}
+			}
+		});
+	}
+}
+
+void Fmm::localsDown()
+{
+	for (uint32_t l = 2; l < depth(); l++)
+	{
+		const Level& parents = levels[l];
+		Level& children = levels[l + 1];
+
+		ThreadPool::get()->parallelFor(0, parents.keys.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				for (uint32_t child = parents.first[c]; child < parents.first[c + 1]; child++)
+				{
+					// interpolate the parent's field at the child's nodes
+					uint64_t octant = children.keys[child] & 7;
+					for (uint32_t axis = 0; axis < 3; axis++)
+					{
+						applyTensor(childTransfer[octant & 1].data(), childTransfer[(octant >> 1) & 1].data(), childTransfer[(octant >> 2) & 1].data(),
+							true, &parents.local[(c * 3 + axis) * nodeCount], &children.local[(child * 3 + axis) * nodeCount], order);
+					}
+				}
+			}
+		});
+	}
+}
+
+void Fmm::localsToParticles()
+{
+	uint32_t depth = this->depth();
+	const Level& leaves = levels[depth];
+
+	ThreadPool::get()->parallelFor(0, leaves.keys.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+	{
+		float wx[MAX_ORDER], wy[MAX_ORDER], wz[MAX_ORDER];
+
+		for (uint32_t c = static_cast<uint32_t>(begin); c < end; c++)
+		{
+			glm::vec3 centre = cellCentre(leaves, c);
+			float toUnit = 2.0f / leaves.size;
+			const float* local = &leaves.local[c * 3 * nodeCount];
+
+			for (uint32_t k = leaves.first[c]; k < leaves.first[c + 1]; k++)
+			{
+				interpolationWeights((x[k] - centre.x) * toUnit, wx);
+				interpolationWeights((y[k] - centre.y) * toUnit, wy);
+				interpolationWeights((z[k] - centre.z) * toUnit, wz);
+
+				glm::vec3 acceleration(0.0f);
+				for (uint32_t i = 0; i < order; i++)
+					for (uint32_t j = 0; j < order; j++)
+						for (uint32_t l = 0; l < order; l++)
+						{
+							uint32_t m = (i * order + j) * order + l;
+							float w = wx[i] * wy[j] * wz[l];
+							acceleration += w * glm::vec3(local[m], local[nodeCount + m], local[2 * nodeCount + m]);
+						}
+
+				ax[k] += acceleration.x;
+				ay[k] += acceleration.y;
+				az[k] += acceleration.z;
+			}
+		}
+	});
+}
+
+void Fmm::nearField(ForceKernel kernel)
+{
+	// direct sums between each leaf and its (up to 26) neighbours and itself
+	const Level& leaves = levels[depth()];
+	const int32_t cells = 1 << depth();
+
+	ThreadPool::get()->parallelFor(0, leaves.keys.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+	{
+		ForceBlock block = {};
+		block.x = x.data(); block.y = y.data(); block.z = z.data();
+		block.ax = ax.data(); block.ay = ay.data(); block.az = az.data();
+
+		for (size_t c = begin; c < end; c++)
+		{
+			uint32_t ix, iy, iz;
+			mortonDecode(leaves.keys[c], ix, iy, iz);
+
+			block.targetBegin = leaves.first[c];
+			block.targetEnd = leaves.first[c + 1];
+
+			for (int32_t nx = static_cast<int32_t>(ix) - 1; nx <= static_cast<int32_t>(ix) + 1; nx++)
+			for (int32_t ny = static_cast<int32_t>(iy) - 1; ny <= static_cast<int32_t>(iy) + 1; ny++)
+			for (int32_t nz = static_cast<int32_t>(iz) - 1; nz <= static_cast<int32_t>(iz) + 1; nz++)
+			{
+				if (nx < 0 || ny < 0 || nz < 0 || nx >= cells || ny >= cells || nz >= cells)
+					continue;
+
+				int64_t source = findCell(leaves, mortonEncode(nx, ny, nz));
+				if (source < 0)
+					continue;
+
+				block.sourceBegin = leaves.first[source];
+				block.sourceEnd = leaves.first[source + 1];
+				kernel(block);
+			}
+		}
+	});
+}
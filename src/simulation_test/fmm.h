@@ -0,0 +1,63 @@
+#pragma once
+#include "cpu-forces.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+// kernel independent fast multipole method (black box FMM, Fong & Darve 2009).
+// the softened GRAVITY/POWER/SOFTEN law has no analytic multipole expansion, so the far field of
+// every cell is instead interpolated through order^3 chebyshev nodes. cells come from the morton
+// sorted particles at a uniform depth, only the non empty ones are stored
+class Fmm
+{
+	struct Level
+	{
+		std::vector<uint64_t> keys;		// morton prefix of every non empty cell, sorted
+		std::vector<uint32_t> first;	// first particle (leaf level) or child cell (above), plus an end marker
+		std::vector<float> multipole;	// order^3 source weights per cell
+		std::vector<float> local;		// order^3 x 3 far field accelerations per cell
+		float size;						// cell edge length
+	};
+
+	uint32_t order;
+	uint32_t nodeCount;					// order^3
+
+	std::vector<float> nodes;			// chebyshev nodes on [-1, 1]
+	std::vector<float> nodePolys;		// T_k(node m) at [m * order + k]
+	std::vector<float> childTransfer[2];	// 1D interpolation from a lower (0) or upper (1) half to the whole cell
+
+	std::vector<Level> levels;			// levels[l] holds the cells at depth l, leaves are the last one
+	glm::vec3 lo;
+	float rootSize;
+
+	// sorted positions and the accelerations built up for them
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> sortOrder;
+	std::vector<float> x, y, z;
+	std::vector<float> ax, ay, az;
+
+	void interpolationWeights(float position, float* weights) const;
+	uint32_t chooseDepth(size_t count) const;
+	void buildLevels(uint32_t depth);
+
+	void particlesToMultipoles();
+	void multipolesUp();
+	void multipolesToLocals();
+	void localsDown();
+	void localsToParticles();
+	void nearField(ForceKernel kernel);
+
+	glm::vec3 cellCentre(const Level& level, uint32_t cell) const;
+	int64_t findCell(const Level& level, uint64_t key) const;
+
+public:
+	explicit Fmm(uint32_t order);
+
+	// add the acceleration on every particle from every other to ax/ay/az.
+	// nearKernel does the direct sums between neighbouring leaves
+	void evaluate(const float* posX, const float* posY, const float* posZ, size_t count,
+		float* accX, float* accY, float* accZ, ForceKernel nearKernel);
+
+	uint32_t depth() const { return static_cast<uint32_t>(levels.size()) - 1; }
+	size_t leafCount() const { return levels.empty() ? 0 : levels.back().keys.size(); }
+};
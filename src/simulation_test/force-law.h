@@ -0,0 +1,24 @@
+#pragma once
+#include "physics.h"
+#include <cmath>
+
+// GRAVITY / (|d| * (d2 + SOFTEN)^POWER) - multiply by the separation d for the pull of one particle.
+// the scalar form shared by the tree and multipole solvers, the O(N^2) kernels have their own
+static inline float pairScale(float d2)
+{
+	float r = 1.0f / std::sqrt(d2 + SOFTEN);
+	float invPow;
+
+	if (POWER == 0.5f)
+		invPow = r;
+	else if (POWER == 0.75f)
+		invPow = r * std::sqrt(r);
+	else if (POWER == 1.0f)
+		invPow = r * r;
+	else if (POWER == 1.5f)
+		invPow = r * r * r;
+	else
+		invPow = std::pow(d2 + SOFTEN, -POWER);
+
+	return GRAVITY * invPow / std::sqrt(d2);
+}
@@ -0,0 +1,270 @@
+#include "initial-conditions.h"
+#include "force-law.h"
+#include "philox.h"
+#include "threadpool.h"
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+#include <cmath>
+
+// particles per generation task - any size gives the same particles
+static const size_t PARTICLE_CHUNK = 1 << 14;
+
+static const float PLANE_HALF_WIDTH = 10.0f;
+static const float PLUMMER_RADIUS = 4.0f;
+static const float DISK_SCALE_LENGTH = 4.0f;
+static const float DISK_SCALE_HEIGHT = 0.3f;
+static const float DISK_MAX_RADIUS = 6.0f * DISK_SCALE_LENGTH;
+static const float HERNQUIST_RADIUS = 3.0f;
+static const float HERNQUIST_MAX_RADIUS = 10.0f * HERNQUIST_RADIUS;
+static const float PAIR_SEPARATION = 40.0f;
+
+// rotation curves are sampled at this many radii, from this many of the particles
+static const size_t PROFILE_RADII = 64;
+static const size_t PROFILE_SAMPLES = 4096;
+
+using namespace glm;
+
+const char* distributionName(DISTRIBUTION distribution)
+{
+	switch (distribution)
+	{
+	case PLANE: return "plane";
+	case CUBE: return "cube";
+	case PLUMMER: return "plummer";
+	case DISK: return "disk";
+	case GALAXY_PAIR: return "galaxy pair";
+	}
+
+	return "unknown";
+}
+
+// uniformly distributed unit vector
+static vec3 isotropic(PhiloxStream& rng)
+{
+	float cosTheta = 2.0f * rng.uniform() - 1.0f;
+	float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = glm::two_pi<float>() * rng.uniform();
+
+	return vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+// circular speed sqrt(r * inward acceleration) at evenly spaced radii out to maxRadius along direction,
+// from the force law summed over an evenly strided sample of particles [begin, end) and scaled up to all of them.
+// the force law isn't newtonian so there's no closed form - this is what the particles will actually feel
+class RotationCurve
+{
+	std::vector<float> speeds;
+	float maxRadius;
+
+public:
+	RotationCurve(const std::vector<particle>& particles, size_t begin, size_t end, vec3 centre, vec3 direction, float maxRadius)
+		: speeds(PROFILE_RADII), maxRadius(maxRadius)
+	{
+		size_t stride = std::max<size_t>(1, (end - begin) / PROFILE_SAMPLES);
+		size_t sampled = (end - begin + stride - 1) / stride;
+		float scale = static_cast<float>(end - begin) / static_cast<float>(std::max<size_t>(1, sampled));
+
+		// one task per radius and each sum in index order, so the curve doesn't depend on the thread count
+		ThreadPool::get()->parallelFor(0, PROFILE_RADII, 1, [&](size_t first, size_t last)
+		{
+			for (size_t k = first; k < last; k++)
+			{
+				float r = maxRadius * static_cast<float>(k) / static_cast<float>(PROFILE_RADII - 1);
+				vec3 probe = centre + r * direction;
+				vec3 acceleration(0.0f);
+
+				for (size_t j = begin; j < end; j += stride)
+				{
+					vec3 d = vec3(particles[j].pos) - probe;
+					float d2 = dot(d, d);
+					if (d2 > 1e-12f)
+						acceleration += d * pairScale(d2);
+				}
+
+				float inward = std::max(0.0f, dot(acceleration, direction) * -scale);
+				speeds[k] = std::sqrt(r * inward);
+			}
+		});
+	}
+
+	float speed(float r) const
+	{
+		float t = std::min(r / maxRadius, 1.0f) * static_cast<float>(PROFILE_RADII - 1);
+		size_t k = std::min(static_cast<size_t>(t), PROFILE_RADII - 2);
+		float f = t - static_cast<float>(k);
+		return speeds[k] + f * (speeds[k + 1] - speeds[k]);
+	}
+};
+
+// fill [0, count) with fn(rng, i) where rng is particle i's own stream
+template <typename Fn>
+static void forEachParticle(size_t count, uint32_t seed, Fn fn)
+{
+	ThreadPool::get()->parallelFor(0, count, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			PhiloxStream rng(seed, i);
+			fn(rng, i);
+		}
+	});
+}
+
+static void generatePlane(std::vector<particle>& particles, uint32_t seed)
+{
+	forEachParticle(particles.size(), seed, [&](PhiloxStream& rng, size_t i)
+	{
+		float x = PLANE_HALF_WIDTH * (2.0f * rng.uniform() - 1.0f);
+		float y = PLANE_HALF_WIDTH * (2.0f * rng.uniform() - 1.0f);
+
+		particles[i].pos = vec4(x, y, 0.0f, PARTICLE_MASS);
+		particles[i].vel = vec4(0.0f);
+	});
+}
+
+static void generateCube(std::vector<particle>& particles, uint32_t seed)
+{
+	forEachParticle(particles.size(), seed, [&](PhiloxStream& rng, size_t i)
+	{
+		vec3 p = PLANE_HALF_WIDTH * (2.0f * vec3(rng.uniform(), rng.uniform(), rng.uniform()) - vec3(1.0f));
+
+		particles[i].pos = vec4(p, PARTICLE_MASS);
+		particles[i].vel = vec4(0.0f);
+	});
+}
+
+static void generatePlummer(std::vector<particle>& particles, uint32_t seed)
+{
+	const float a = PLUMMER_RADIUS;
+
+	// inverse of the cumulative mass, cut where the last 0.1% would have flown off to huge radii
+	forEachParticle(particles.size(), seed, [&](PhiloxStream& rng, size_t i)
+	{
+		float m = 0.999f * rng.uniformOpen();
+		float r = a / std::sqrt(std::pow(m, -2.0f / 3.0f) - 1.0f);
+
+		particles[i].pos = vec4(r * isotropic(rng), PARTICLE_MASS);
+	});
+
+	// aarseth, henon & wielen's speeds are fractions of the local escape speed. for a newtonian plummer
+	// sphere GM/a = 2^1.5 vc(a)^2, so the measured circular speed at a sets the scale here
+	RotationCurve curve(particles, 0, particles.size(), vec3(0.0f), vec3(1.0f, 0.0f, 0.0f), 2.0f * a);
+	float vc = curve.speed(a);
+	float gmOverA = 2.0f * std::sqrt(2.0f) * vc * vc;
+
+	forEachParticle(particles.size(), seed, [&](PhiloxStream& rng, size_t i)
+	{
+		// the position draws come first in the stream, skip them
+		for (int skip = 0; skip < 3; skip++)
+			rng.next();
+
+		// rejection sample q from q^2 (1 - q^2)^3.5
+		float q, g;
+		do
+		{
+			q = rng.uniform();
+			g = 0.1f * rng.uniform();
+		} while (g > q * q * std::pow(1.0f - q * q, 3.5f));
+
+		float r = length(vec3(particles[i].pos));
+		float escape = std::sqrt(2.0f * gmOverA) * std::pow(1.0f + r * r / (a * a), -0.25f);
+
+		particles[i].vel = vec4(q * escape * isotropic(rng), 0.0f);
+	});
+}
+
+static void generateDisk(std::vector<particle>& particles, uint32_t seed)
+{
+	// surface density e^(-R/h) makes R gamma distributed - the sum of two exponentials. z is sech^2
+	forEachParticle(particles.size(), seed, [&](PhiloxStream& rng, size_t i)
+	{
+		float R;
+		do
+		{
+			R = -DISK_SCALE_LENGTH * std::log(rng.uniformOpen() * rng.uniformOpen());
+		} while (R > DISK_MAX_RADIUS);
+
+		float phi = glm::two_pi<float>() * rng.uniform();
+		float z = DISK_SCALE_HEIGHT * std::atanh(2.0f * rng.uniformOpen() - 1.0f);
+
+		particles[i].pos = vec4(R * std::cos(phi), R * std::sin(phi), z, PARTICLE_MASS);
+	});
+
+	RotationCurve curve(particles, 0, particles.size(), vec3(0.0f), vec3(1.0f, 0.0f, 0.0f), DISK_MAX_RADIUS);
+
+	ThreadPool::get()->parallelFor(0, particles.size(), PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			vec3 p = vec3(particles[i].pos.x, particles[i].pos.y, 0.0f);
+			float R = length(p);
+			vec3 tangent = R > 0.0f ? vec3(-p.y, p.x, 0.0f) / R : vec3(0.0f);
+
+			particles[i].vel = vec4(curve.speed(R) * tangent, 0.0f);
+		}
+	});
+}
+
+static void generateGalaxyPair(std::vector<particle>& particles, uint32_t seed)
+{
+	size_t count = particles.size();
+	size_t split = count / 2;
+
+	// hernquist's cumulative mass is (r / (r + a))^2 - inverted, and cut at HERNQUIST_MAX_RADIUS
+	const float a = HERNQUIST_RADIUS;
+	const float maxRoot = HERNQUIST_MAX_RADIUS / (HERNQUIST_MAX_RADIUS + a);
+
+	forEachParticle(count, seed, [&](PhiloxStream& rng, size_t i)
+	{
+		float root = maxRoot * rng.uniform();
+		float r = a * root / (1.0f - root);
+
+		particles[i].pos = vec4(r * isotropic(rng), PARTICLE_MASS);
+	});
+
+	// each galaxy spins about its own axis, the second tilted so the encounter isn't flat
+	vec3 axes[2] = { vec3(0.0f, 0.0f, 1.0f), normalize(vec3(0.0f, 0.5f, 1.0f)) };
+	size_t begins[2] = { 0, split };
+	size_t ends[2] = { split, count };
+
+	// both curves are measured in the galaxies' own frames, out past the separation for the orbit
+	std::vector<RotationCurve> curves;
+	for (int g = 0; g < 2; g++)
+	{
+		vec3 side = normalize(cross(axes[g], vec3(1.0f, 0.0f, 0.0f)));
+		curves.emplace_back(particles, begins[g], ends[g], vec3(0.0f), side, PAIR_SEPARATION);
+	}
+
+	// a circular relative orbit needs sqrt(2) vc(separation) - this is less, so they fall together
+	float approach = 0.5f * curves[1].speed(PAIR_SEPARATION);
+	vec3 centres[2] = { vec3(-0.5f * PAIR_SEPARATION, 0.0f, 0.0f), vec3(0.5f * PAIR_SEPARATION, 0.0f, 0.0f) };
+	vec3 bulk[2] = { vec3(0.0f, -approach, 0.0f), vec3(0.0f, approach, 0.0f) };
+
+	ThreadPool::get()->parallelFor(0, count, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			int g = i < split ? 0 : 1;
+			vec3 p = vec3(particles[i].pos);
+			float r = length(p);
+
+			// speed falls off towards the axis - (axis x p) / r has length sin(angle from the axis)
+			vec3 spin = r > 0.0f ? curves[g].speed(r) * cross(axes[g], p) / r : vec3(0.0f);
+
+			particles[i].pos = vec4(p + centres[g], PARTICLE_MASS);
+			particles[i].vel = vec4(spin + bulk[g], 0.0f);
+		}
+	});
+}
+
+void generateParticles(std::vector<particle>& particles, DISTRIBUTION distribution, uint32_t seed)
+{
+	switch (distribution)
+	{
+	case PLANE: generatePlane(particles, seed); break;
+	case CUBE: generateCube(particles, seed); break;
+	case PLUMMER: generatePlummer(particles, seed); break;
+	case DISK: generateDisk(particles, seed); break;
+	case GALAXY_PAIR: generateGalaxyPair(particles, seed); break;
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "particle.h"
+#include <vector>
+#include <cstdint>
+
+enum DISTRIBUTION
+{
+	PLANE,			// uniform square in z = 0, at rest
+	CUBE,			// uniform cube, at rest
+	PLUMMER,		// plummer sphere with isotropic velocities
+	DISK,			// exponential disk on its rotation curve
+	GALAXY_PAIR		// two rotating hernquist spheres on a bound orbit
+};
+
+// every particle weighs the same, the force law ignores it anyway. it is also the size the particles are drawn at
+const float PARTICLE_MASS = 100.0f;
+
+const char* distributionName(DISTRIBUTION distribution);
+
+// fill every particle from the chosen distribution. positions are a pure function of (seed, index), velocities
+// add the rotation curve measured from a fixed sample of those positions, so the result is the same on any
+// number of threads
+void generateParticles(std::vector<particle>& particles, DISTRIBUTION distribution, uint32_t seed);
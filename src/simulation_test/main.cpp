@@ -1,6 +1,7 @@
 #include <iostream>
 #include "nbody.h"
 #include "args.h"
+#include "threadpool.h"
 
 int main(int argc, const char *argv[])
 {
@@ -18,10 +19,41 @@ int main(int argc, const char *argv[])
 	args::Flag mode1(group2, "Compute Only", "Run the simulation using normal compute.", { 'c', "compute" });
 	args::Flag mode2(group2, "Async Transfer", "Run the simulation using Asynchronous Compute - Transfer Method", { 't', "transfer" });
 	args::Flag mode3(group2, "Async Double Buffer", "Run the simulation using Asynchronous Compute - Double Buffering", { 'd', "double" });
+	args::Flag mode4(group2, "CPU Reference", "Run the simulation on the CPU - no GPU needed", { 'r', "cpu" });
+	args::Flag mode5(group2, "Barnes-Hut", "Run the simulation on the CPU with a Barnes-Hut octree - O(N log N)", { 'b', "barnes-hut" });
+	args::Flag mode6(group2, "Fast Multipole", "Run the simulation on the CPU with the fast multipole method - O(N)", { 'f', "fmm" });
+	args::Flag mode7(group2, "Particle Mesh", "Run the simulation on the CPU with a particle mesh FFT solver - O(N + G^3 log G)", { "pm" });
+	args::ValueFlag<std::string> replay(group2, "Trajectory File", "Play back a trajectory recorded with --trajectory instead of simulating - no compute.", { "replay" });
 
 	args::ValueFlag<float> expTime(parser, "Experiment Time", "Set how long in MINUTES to run the experiment for.", { 'm', "minutes", });
 
 	args::Flag lighting(parser, "Lighting Flag", "Run the simulation with lighting.", { 'l', "lighting", });
+	args::ValueFlag<int> groupSize(parser, "Workgroup Size", "Set the compute workgroup size (also the shared memory tile size).", { 'g', "groupsize" });
+	args::Flag autotune(parser, "Autotune", "Benchmark workgroup and tile sizes at startup (cached per device in autotune.cache).", { "autotune" });
+
+	args::ValueFlag<int> threads(parser, "Thread Count", "Set the number of host worker threads (default: all hardware threads).", { "threads" });
+	args::Flag pin(parser, "Pin Threads", "Pin each host worker thread to its own core.", { "pin" });
+	args::ValueFlag<float> theta(parser, "Theta", "Barnes-Hut opening angle, smaller is more accurate (0-1, default 0.5).", { "theta" });
+	args::ValueFlag<int> fmmOrder(parser, "FMM Order", "Chebyshev nodes per axis for the FMM far field, higher is more accurate (2-10, default 4).", { "order" });
+	args::ValueFlag<int> gridSize(parser, "Mesh Size", "Particle mesh cells per axis, rounded up to a power of two (default 64).", { "grid" });
+	args::Flag leapfrog(parser, "Leapfrog", "Integrate with kick-drift-kick leapfrog instead of euler.", { "leapfrog" });
+	args::ValueFlag<int> substeps(parser, "Substeps", "Steps per frame, recorded into one compute submission (default 1).", { "substeps" });
+	args::ValueFlag<float> fixedDt(parser, "Fixed Time Step", "Advance every frame by this many seconds instead of the measured frame time.", { "fixed-dt" });
+	args::ValueFlag<int> seed(parser, "Seed", "Seed for the initial particle positions.", { "seed" });
+	std::unordered_map<std::string, DISTRIBUTION> distributions{
+		{ "plane", PLANE }, { "cube", CUBE }, { "plummer", PLUMMER }, { "disk", DISK }, { "pair", GALAXY_PAIR } };
+	args::MapFlag<std::string, DISTRIBUTION> distribution(parser, "Distribution", "Initial conditions: plane, cube, plummer, disk or pair (default plane).", { "distribution" }, distributions);
+	args::ValueFlag<int> steps(parser, "Steps", "Stop after this many frames and print a hash of the final state.", { "steps" });
+	args::ValueFlag<std::string> snapshot(parser, "Snapshot File", "Save the particle state here on exit (and every --checkpoint frames).", { "snapshot" });
+	args::ValueFlag<int> checkpoint(parser, "Checkpoint Interval", "Frames between snapshots, 0 = only on exit.", { "checkpoint" });
+	args::ValueFlag<std::string> restart(parser, "Restart File", "Continue the run saved in a snapshot instead of generating particles.", { "restart" });
+	args::ValueFlag<std::string> trajectory(parser, "Trajectory File", "GPU modes: stream particle positions here without stalling the frame loop.", { "trajectory" });
+	args::ValueFlag<int> trajectoryEvery(parser, "Trajectory Interval", "Frames between trajectory frames (default 1).", { "trajectory-every" });
+	args::ValueFlag<float> compress(parser, "Error Bound", "Quantise trajectory and snapshot positions to this fraction of the bounding box (e.g. 1e-5) and entropy code them.", { "compress" });
+	args::ValueFlag<int> resort(parser, "Re-sort Interval", "Re-sort the particles along a Morton curve every K steps for memory locality.", { "resort" });
+	args::Flag headless(parser, "Headless", "GPU modes: render offscreen without a window or swapchain (no display needed, works on lavapipe).", { "headless" });
+	args::ValueFlag<int> framesInFlight(parser, "Frames In Flight", "GPU modes: frames the CPU may record ahead of the GPU before it waits (1-4, default 2).", { "frames-in-flight" });
+	args::Flag symmetric(parser, "Symmetric Pairs", "CPU mode: evaluate each pair once and apply it to both particles.", { "symmetric" });
 
 	args::CompletionFlag completion(parser, { "complete" });
 	try
@@ -53,7 +85,7 @@ int main(int argc, const char *argv[])
 
 	parameters simParam;
 
-	MODE choice = mode1 ? COMPUTE : mode2 ? TRANSFER : DOUBLE;
+	MODE choice = mode1 ? COMPUTE : mode2 ? TRANSFER : mode3 ? DOUBLE : mode4 ? CPU : mode5 ? BARNES_HUT : mode6 ? FMM : mode7 ? PM : REPLAY;
 
 	if (particleCount){	simParam.pCount = args::get(particleCount); }
 
@@ -69,10 +101,37 @@ int main(int argc, const char *argv[])
 	simParam.chosenMode = choice;
 
 	if (lighting) {	simParam.lighting = true; }
+	if (groupSize) { simParam.workGroupSize = args::get(groupSize); }
+	if (autotune) { simParam.autotune = true; }
+	if (threads) { simParam.threads = std::max(0, args::get(threads)); }
+	if (pin) { simParam.pinThreads = true; }
+	if (symmetric) { simParam.symmetric = true; }
+	if (theta) { simParam.theta = std::min(std::max(0.0f, args::get(theta)), 1.0f); }
+	if (fmmOrder) { simParam.fmmOrder = std::max(2, args::get(fmmOrder)); }
+	if (gridSize) { simParam.gridSize = std::max(4, args::get(gridSize)); }
+	if (leapfrog) { simParam.integrator = LEAPFROG; }
+	if (substeps) { simParam.substeps = std::max(1, args::get(substeps)); }
+	if (fixedDt) { simParam.fixedDeltaT = std::max(0.0f, args::get(fixedDt)); }
+	if (seed) { simParam.seed = static_cast<uint32_t>(args::get(seed)); }
+	if (distribution) { simParam.distribution = args::get(distribution); }
+	if (steps) { simParam.steps = std::max(0, args::get(steps)); }
+	if (snapshot) { simParam.snapshotPath = args::get(snapshot); }
+	if (checkpoint) { simParam.snapshotInterval = std::max(0, args::get(checkpoint)); }
+	if (restart) { simParam.restartPath = args::get(restart); }
+	if (trajectory) { simParam.trajectoryPath = args::get(trajectory); }
+	if (trajectoryEvery) { simParam.trajectoryInterval = std::max(1, args::get(trajectoryEvery)); }
+	if (compress) { simParam.compressionError = std::max(0.0f, args::get(compress)); }
+	if (resort) { simParam.resortInterval = std::max(0, args::get(resort)); }
+	if (replay) { simParam.replayPath = args::get(replay); }
+	if (headless) { simParam.headless = true; }
+	if (framesInFlight) { simParam.framesInFlight = static_cast<uint32_t>(std::min(std::max(1, args::get(framesInFlight)), static_cast<int>(MAX_FRAMES_IN_FLIGHT))); }
 
 	simParam.print();
+
+	// host side work (particle setup, mesh, the CPU engine) all shares one pool
+	ThreadPool::get()->init(simParam.threads, simParam.pinThreads);
 	
-	nbody simulation(simParam.pCount, amd, choice); // maximum in release so far with current res settings
+	nbody simulation(simParam.pCount, amd, choice, simParam.headless); // maximum in release so far with current res settings
 
 	try
 	{
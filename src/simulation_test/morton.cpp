@@ -0,0 +1,183 @@
+#include "morton.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <numeric>
+
+// chunks per pool worker for the sort passes
+static const size_t SORT_CHUNK = 1 << 16;
+static const size_t KEY_CHUNK = 1 << 14;
+
+// spread the low 21 bits out to every third bit
+static inline uint64_t spreadBits(uint32_t v)
+{
+	uint64_t x = v & 0x1FFFFF;
+	x = (x | x << 32) & 0x1F00000000FFFFull;
+	x = (x | x << 16) & 0x1F0000FF0000FFull;
+	x = (x | x << 8) & 0x100F00F00F00F00Full;
+	x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+	x = (x | x << 2) & 0x1249249249249249ull;
+	return x;
+}
+
+// gather every third bit back into the low 21
+static inline uint32_t compactBits(uint64_t x)
+{
+	x &= 0x1249249249249249ull;
+	x = (x | x >> 2) & 0x10C30C30C30C30C3ull;
+	x = (x | x >> 4) & 0x100F00F00F00F00Full;
+	x = (x | x >> 8) & 0x1F0000FF0000FFull;
+	x = (x | x >> 16) & 0x1F00000000FFFFull;
+	x = (x | x >> 32) & 0x1FFFFF;
+	return static_cast<uint32_t>(x);
+}
+
+void mortonDecode(uint64_t key, uint32_t& x, uint32_t& y, uint32_t& z)
+{
+	x = compactBits(key);
+	y = compactBits(key >> 1);
+	z = compactBits(key >> 2);
+}
+
+uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z)
+{
+	return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+void mortonBounds(const float* x, const float* y, const float* z, size_t count, glm::vec3& lo, float& size)
+{
+	auto pool = ThreadPool::get();
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(pool->size(), (count + KEY_CHUNK - 1) / KEY_CHUNK));
+	std::vector<glm::vec3> chunkLo(chunks, glm::vec3(count ? x[0] : 0.0f, count ? y[0] : 0.0f, count ? z[0] : 0.0f));
+	std::vector<glm::vec3> chunkHi(chunkLo);
+
+	pool->parallelFor(0, chunks, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t c = begin; c < end; c++)
+		{
+			for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; i++)
+			{
+				glm::vec3 p(x[i], y[i], z[i]);
+				chunkLo[c] = glm::min(chunkLo[c], p);
+				chunkHi[c] = glm::max(chunkHi[c], p);
+			}
+		}
+	});
+
+	lo = chunkLo[0];
+	glm::vec3 hi = chunkHi[0];
+	for (size_t c = 1; c < chunks; c++)
+	{
+		lo = glm::min(lo, chunkLo[c]);
+		hi = glm::max(hi, chunkHi[c]);
+	}
+
+	// a little slack so the far faces still quantise inside the cube
+	glm::vec3 extent = hi - lo;
+	size = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) * 1.0001f;
+}
+
+void mortonKeys(const float* x, const float* y, const float* z, size_t count, glm::vec3 lo, float size, uint64_t* keys)
+{
+	const float scale = static_cast<float>(1u << MORTON_BITS) / size;
+	const float top = static_cast<float>((1u << MORTON_BITS) - 1);
+
+	ThreadPool::get()->parallelFor(0, count, KEY_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t qx = static_cast<uint32_t>(std::min(top, std::max(0.0f, (x[i] - lo.x) * scale)));
+			uint32_t qy = static_cast<uint32_t>(std::min(top, std::max(0.0f, (y[i] - lo.y) * scale)));
+			uint32_t qz = static_cast<uint32_t>(std::min(top, std::max(0.0f, (z[i] - lo.z) * scale)));
+			keys[i] = mortonEncode(qx, qy, qz);
+		}
+	});
+}
+
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values)
+{
+	const size_t count = keys.size();
+	const int RADIX = 256;
+
+	auto pool = ThreadPool::get();
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(4 * pool->size(), (count + SORT_CHUNK - 1) / SORT_CHUNK));
+
+	std::vector<uint64_t> keysOut(count);
+	std::vector<uint32_t> valuesOut(count);
+	std::vector<uint32_t> histogram(chunks * RADIX);
+
+	for (int shift = 0; shift < 3 * MORTON_BITS; shift += 8)
+	{
+		// count digits per chunk
+		std::fill(histogram.begin(), histogram.end(), 0u);
+
+		pool->parallelFor(0, chunks, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				uint32_t* h = &histogram[c * RADIX];
+				for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; i++)
+				{
+					h[(keys[i] >> shift) & 0xFF]++;
+				}
+			}
+		});
+
+		// every key has the same digit - nothing would move
+		bool skip = false;
+		for (int d = 0; d < RADIX && !skip; d++)
+		{
+			size_t total = 0;
+			for (size_t c = 0; c < chunks; c++)
+			{
+				total += histogram[c * RADIX + d];
+			}
+			skip = total == count;
+		}
+
+		if (skip)
+			continue;
+
+		// turn the counts into where each chunk writes each digit - digit major so the sort stays stable
+		uint32_t offset = 0;
+		for (int d = 0; d < RADIX; d++)
+		{
+			for (size_t c = 0; c < chunks; c++)
+			{
+				uint32_t n = histogram[c * RADIX + d];
+				histogram[c * RADIX + d] = offset;
+				offset += n;
+			}
+		}
+
+		pool->parallelFor(0, chunks, 1, [&](size_t begin, size_t end)
+		{
+			for (size_t c = begin; c < end; c++)
+			{
+				uint32_t* h = &histogram[c * RADIX];
+				for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; i++)
+				{
+					uint32_t dest = h[(keys[i] >> shift) & 0xFF]++;
+					keysOut[dest] = keys[i];
+					valuesOut[dest] = values[i];
+				}
+			}
+		});
+
+		keys.swap(keysOut);
+		values.swap(valuesOut);
+	}
+}
+
+void mortonOrder(const float* x, const float* y, const float* z, size_t count, std::vector<uint32_t>& order)
+{
+	glm::vec3 lo;
+	float size;
+	mortonBounds(x, y, z, count, lo, size);
+
+	std::vector<uint64_t> keys(count);
+	mortonKeys(x, y, z, count, lo, size, keys.data());
+
+	order.resize(count);
+	std::iota(order.begin(), order.end(), 0u);
+	radixSort(keys, order);
+}
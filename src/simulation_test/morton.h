@@ -0,0 +1,43 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "threadpool.h"
+
+// 63 bit morton keys - 21 bits per axis interleaved, x in the lowest bit of each triple.
+// sorting by key puts particles that are close in space close in memory and makes every
+// octree cell a contiguous run
+const uint32_t MORTON_BITS = 21;
+
+uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z);
+void mortonDecode(uint64_t key, uint32_t& x, uint32_t& y, uint32_t& z);
+
+// bounding cube of the positions - lo corner and edge length
+void mortonBounds(const float* x, const float* y, const float* z, size_t count, glm::vec3& lo, float& size);
+
+// key of every position, quantised to 2^21 steps across the cube at lo
+void mortonKeys(const float* x, const float* y, const float* z, size_t count, glm::vec3 lo, float size, uint64_t* keys);
+
+// multithreaded LSD radix sort on 8 bit digits, ascending and stable. values are carried along
+// with their keys. digits that are the same for every key are skipped
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values);
+
+// permutation that puts the positions in morton order, order[k] is the particle that goes k-th
+void mortonOrder(const float* x, const float* y, const float* z, size_t count, std::vector<uint32_t>& order);
+
+// gather items into the order from mortonOrder - items[k] becomes the old items[order[k]]
+template<typename T>
+void applyOrder(std::vector<T>& items, const std::vector<uint32_t>& order)
+{
+	std::vector<T> sorted(items.size());
+
+	ThreadPool::get()->parallelFor(0, items.size(), 1 << 14, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; k++)
+		{
+			sorted[k] = items[order[k]];
+		}
+	});
+
+	items.swap(sorted);
+}
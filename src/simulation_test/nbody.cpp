@@ -1,51 +1,115 @@
 #include "nbody.h"
+#include "simulation.h"
+#include "threadpool.h"
+#include "snapshot.h"
 
 using namespace glm;
 
-nbody::nbody(const unsigned int num, const bool AMD, const MODE chosenMode)
+nbody::nbody(const unsigned int num, const bool AMD, const MODE chosenMode, const bool headless)
 {
 	// initialise the Renderer
 	num_particles = num; 
+	mode = chosenMode;
+
+	// CPU runs don't need a window or a device
+	if (isHostMode(mode))
+		return;
 
 	// initialise vulkan
 	auto &app = Renderer::get();
-	app->init(chosenMode, AMD);
+	app->init(chosenMode, AMD, headless);
 }
 
-void nbody::prepareParticles()
+void nbody::prepareParticles(DISTRIBUTION distribution, uint32_t seed)
 {
 	particleBuffer.resize(num_particles);
 
-	// create positions for particles 
-	for (auto &p : particleBuffer)
-	{
-		//set rnd position
-		float v1 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 20));
-		v1 -= 10;
+	// without a seed each run still gets one from rand(), as the old serial generator did
+	if (seed == 0)
+		seed = static_cast<uint32_t>(rand());
 
-		auto v2 = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 20));
-		v2 -= 10;
+	generateParticles(particleBuffer, distribution, seed);
+}
 
-		auto massRNG = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 200));
+void nbody::loadSnapshot(const std::string& path)
+{
+	Snapshot snapshot(path);
 
-		auto mass = 1.0;
+	snapshot.read(particleBuffer, idBuffer);
+	startStep = snapshot.header().step;
+	startTime = snapshot.header().time;
+	num_particles = static_cast<unsigned int>(snapshot.count());
 
-		if (massRNG < 150)
-			mass = 1.0;
+	std::cout << "Restarting " << num_particles << " particles from " << path << " at step " << startStep
+		<< " (" << startTime << "s simulated)" << std::endl;
+}
 
-		p.pos = vec4(v1, v2, 0.0f, 100);
-		p.vel = vec4(0.0);
+std::unique_ptr<TrajectoryReader> nbody::loadTrajectory(const std::string& path)
+{
+	std::unique_ptr<TrajectoryReader> reader(new TrajectoryReader(path));
 
-		auto rndM = static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 200));
-	}
+	num_particles = static_cast<unsigned int>(reader->count());
+	particleBuffer.resize(num_particles);
+	replay_simulation::expand(reader->read(0), num_particles, particleBuffer.data());
+
+	std::cout << "Replaying " << reader->frameCount() << " frames of " << num_particles << " particles from " << path
+		<< (reader->header().errorBound > 0.0f ? " (quantised)" : "") << std::endl;
+
+	return reader;
 }
 
-void nbody::run(const parameters simParam)
+void nbody::run(parameters simParam)
 {
+	std::unique_ptr<TrajectoryReader> replay;
+
 	// loop here  
-	prepareParticles();     
+	if (mode == REPLAY)
+	{
+		replay = loadTrajectory(simParam.replayPath);
+		simParam.pCount = num_particles;
+
+		// every frame is uploaded in id order, a re-sort would mix up the ids
+		simParam.resortInterval = 0;
+	}
+	else if (simParam.restartPath.empty())
+	{
+		prepareParticles(simParam.distribution, simParam.seed);
+	}
+	else
+	{
+		loadSnapshot(simParam.restartPath);
+		simParam.pCount = num_particles;
+	}
+
+	if (isHostMode(mode))
+	{
+		std::unique_ptr<cpu_simulation> hostSim;
+
+		if (mode == CPU)
+			hostSim.reset(new cpu_simulation(simParam, particleBuffer));
+		else if (mode == BARNES_HUT)
+			hostSim.reset(new bh_simulation(simParam, particleBuffer));
+		else if (mode == FMM)
+			hostSim.reset(new fmm_simulation(simParam, particleBuffer));
+		else
+			hostSim.reset(new pm_simulation(simParam, particleBuffer));
+
+		if (!idBuffer.empty())
+			hostSim->resume(idBuffer, startStep, startTime);
+
+		hostSim->run();
+		return;
+	}
+
 	createSphereGeom(simParam.stacks, simParam.slices, simParam.dims);
 	Renderer::get()->setVertexData(vertexBuffer, indexBuffer, particleBuffer);
+
+	if (!idBuffer.empty())
+		Renderer::get()->resume(idBuffer, startStep, startTime);
+
+	if (replay)
+		dynamic_cast<replay_simulation*>(Renderer::get()->sim)->setTrajectory(std::move(replay));
+
 	// create config sets up the storage buffers for the data and uniforms. 
 	// creates the descriptions and command buffers.
 
@@ -63,75 +127,90 @@ void nbody::createSphereGeom(const unsigned int stacks, const unsigned int slice
 	float delta_theta = 2.0f * glm::pi<float>() / static_cast<float>(slices);
 	float delta_T = dims.y / static_cast<float>(stacks);
 	float delta_S = dims.x / static_cast<float>(slices);
+
+	// t steps down once per stack - accumulate it up front so stacks can be built in any order
+	std::vector<float> stackT(stacks);
 	float t = dims.y;
-	float s = 0.0f;
+	for (unsigned int i = 0; i < stacks; ++i)
+	{
+		stackT[i] = t;
+		t -= delta_T;
+	}
 
-	int ind = 0;
+	// every slice is 4 vertices and 6 indices, so each stack knows where its data goes
+	vertexBuffer.resize(size_t(stacks) * slices * 4, Vertex(glm::vec3(0.0f), glm::vec3(0.0f), glm::vec2(0.0f)));
+	indexBuffer.resize(size_t(stacks) * slices * 6);
 
 	// Iterate through each stack
-	for (unsigned int i = 0; i < stacks; ++i)
+	ThreadPool::get()->parallelFor(0, stacks, 1, [&](size_t stackBegin, size_t stackEnd)
 	{
-		// Set starting values for stack
-		float rho = i * delta_rho;
-		s = 0.0f;
-		// Vertex data generated
-		std::array<glm::vec3, 4> verts;
-		std::array<glm::vec2, 4> coords;
-		// Iterate through each slice
-		for (unsigned int j = 0; j < slices; ++j)
+		for (size_t i = stackBegin; i < stackEnd; ++i)
 		{
-			// Vertex 0
-			float theta = j * delta_theta;
-			s += delta_S;
-			verts[0] = glm::vec3(dims.x * -sin(theta) * sin(rho),
-				dims.y * cos(theta) * sin(rho),
-				dims.z * cos(rho));
-			coords[0] = glm::vec2(s, t);
-			// Vertex 1
-			verts[1] = glm::vec3(dims.x * -sin(theta) * sin(rho + delta_rho),
-				dims.y * cos(theta) * sin(rho + delta_rho),
-				dims.z * cos(rho + delta_rho));
-			coords[1] = glm::vec2(s, t - delta_T);
-			// Vertex 2
-			theta = ((j + 1) == slices) ? 0.0f : (j + 1) * delta_theta;
-			s = 0;
-			verts[2] = glm::vec3(dims.x * -sin(theta) * sin(rho),
-				dims.y * cos(theta) * sin(rho),
-				dims.z * cos(rho));
-			coords[2] = glm::vec2(s, t);
-			// Vertex 3
-			verts[3] = glm::vec3(dims.x * -sin(theta) * sin(rho + delta_rho),
-				dims.y * cos(theta) * sin(rho + delta_rho),
-				dims.z * cos(rho + delta_rho));
-			coords[3] = glm::vec2(s, t - delta_T);
-
-			for (auto &uv : coords)
+			// Set starting values for stack
+			float rho = i * delta_rho;
+			float t = stackT[i];
+			float s = 0.0f;
+			size_t ind = i * slices * 4;
+			size_t indexOffset = i * slices * 6;
+			// Vertex data generated
+			std::array<glm::vec3, 4> verts;
+			std::array<glm::vec2, 4> coords;
+			// Iterate through each slice
+			for (unsigned int j = 0; j < slices; ++j)
 			{
-				uv = vec2(uv.x * 0.2, uv.y * 0.2);
+				// Vertex 0
+				float theta = j * delta_theta;
+				s += delta_S;
+				verts[0] = glm::vec3(dims.x * -sin(theta) * sin(rho),
+					dims.y * cos(theta) * sin(rho),
+					dims.z * cos(rho));
+				coords[0] = glm::vec2(s, t);
+				// Vertex 1
+				verts[1] = glm::vec3(dims.x * -sin(theta) * sin(rho + delta_rho),
+					dims.y * cos(theta) * sin(rho + delta_rho),
+					dims.z * cos(rho + delta_rho));
+				coords[1] = glm::vec2(s, t - delta_T);
+				// Vertex 2
+				theta = ((j + 1) == slices) ? 0.0f : (j + 1) * delta_theta;
+				s = 0;
+				verts[2] = glm::vec3(dims.x * -sin(theta) * sin(rho),
+					dims.y * cos(theta) * sin(rho),
+					dims.z * cos(rho));
+				coords[2] = glm::vec2(s, t);
+				// Vertex 3
+				verts[3] = glm::vec3(dims.x * -sin(theta) * sin(rho + delta_rho),
+					dims.y * cos(theta) * sin(rho + delta_rho),
+					dims.z * cos(rho + delta_rho));
+				coords[3] = glm::vec2(s, t - delta_T);
+
+				for (auto &uv : coords)
+				{
+					uv = vec2(uv.x * 0.2, uv.y * 0.2);
+				}
+
+				for (int k = 0; k < 4; k++)
+				{
+					vertexBuffer[ind + k] = Vertex(verts[k], glm::normalize(verts[k]), coords[k]);
+				}
+
+				indexBuffer[indexOffset + 0] = static_cast<uint16_t>(ind + 0);
+				indexBuffer[indexOffset + 1] = static_cast<uint16_t>(ind + 1);
+				indexBuffer[indexOffset + 2] = static_cast<uint16_t>(ind + 2);
+				indexBuffer[indexOffset + 3] = static_cast<uint16_t>(ind + 1);
+				indexBuffer[indexOffset + 4] = static_cast<uint16_t>(ind + 3);
+				indexBuffer[indexOffset + 5] = static_cast<uint16_t>(ind + 2);
+
+				ind += 4;
+				indexOffset += 6;
 			}
-
-			//TODO: clean this up
-			vertexBuffer.push_back(Vertex(verts[0], glm::normalize(verts[0]), coords[0]));
-			vertexBuffer.push_back(Vertex(verts[1], glm::normalize(verts[1]), coords[1]));
-			vertexBuffer.push_back(Vertex(verts[2], glm::normalize(verts[2]), coords[2]));
-			vertexBuffer.push_back(Vertex(verts[3], glm::normalize(verts[3]), coords[3]));
-
-			indexBuffer.push_back(ind + 0);
-			indexBuffer.push_back(ind + 1);
-			indexBuffer.push_back(ind + 2);
-			indexBuffer.push_back(ind + 1);
-			indexBuffer.push_back(ind + 3);
-			indexBuffer.push_back(ind + 2);
-
-			ind += 4;
 		}
-		t -= delta_T;
-	}
+	});
 
 }
 
 nbody::~nbody()
 {
 	// clean up app
-	Renderer::get()->clean();
+	if (!isHostMode(mode))
+		Renderer::get()->clean();
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <memory>
 #include "Renderer.h"
 #include "particle.h"
+#include "initial-conditions.h"
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
@@ -12,9 +13,26 @@ enum MODE
 {
 	COMPUTE,
 	TRANSFER,
-	DOUBLE
+	DOUBLE,
+	CPU,
+	BARNES_HUT,
+	FMM,
+	PM,
+	REPLAY			// play a recorded trajectory back, no simulation
 };
 
+enum INTEGRATOR
+{
+	EULER,			// one pass, velocity then position
+	LEAPFROG		// kick-drift-kick, symplectic and second order
+};
+
+// modes that run entirely on the host - no window or vulkan device
+inline bool isHostMode(MODE mode)
+{
+	return mode == CPU || mode == BARNES_HUT || mode == FMM || mode == PM;
+}
+
 extern struct parameters
 {
 	// default values for simulation
@@ -24,13 +42,42 @@ extern struct parameters
 	uint32_t slices = 20;
 	glm::vec3 dims = glm::vec3(0.02f);
 	bool lighting = false;
+	uint32_t workGroupSize = 256;
+	bool autotune = false;
+	uint32_t threads = 0;		// host worker threads, 0 = one per hardware thread
+	bool pinThreads = false;
+	bool symmetric = false;		// CPU engine evaluates each pair once
+	float theta = 0.5f;			// barnes-hut opening angle
+	uint32_t fmmOrder = 4;		// chebyshev nodes per axis in each FMM cell
+	uint32_t gridSize = 64;		// particle mesh cells per axis, rounded up to a power of two
+	INTEGRATOR integrator = EULER;
+	uint32_t substeps = 1;		// steps per frame, each a fraction of the frame time
+	float fixedDeltaT = 0.0f;	// seconds per frame, 0 = the measured frame time
+	uint32_t seed = 0;			// initial conditions seed, 0 = from rand()
+	DISTRIBUTION distribution = PLANE;
+	uint32_t steps = 0;			// frames to run before stopping, 0 = run for totalTime
+	std::string snapshotPath;	// written on exit and every snapshotInterval frames, empty = never
+	uint32_t snapshotInterval = 0;
+	std::string restartPath;	// snapshot to start from instead of generating particles
+	std::string trajectoryPath;	// positions streamed here every trajectoryInterval frames, empty = never (GPU modes)
+	uint32_t trajectoryInterval = 1;
+	float compressionError = 0.0f;	// quantise trajectories and snapshots to this fraction of the bounding box, 0 = raw
+	uint32_t resortInterval = 0;	// steps between morton re-sorts of the particles, 0 = never
+	std::string replayPath;		// trajectory played back by REPLAY
+	bool headless = false;		// render offscreen with no window or swapchain (GPU modes)
+	uint32_t framesInFlight = 2;	// frames the cpu may record ahead of the gpu, 1 to MAX_FRAMES_IN_FLIGHT (GPU modes)
 	MODE chosenMode;
 
-	char *modeTypes[3] =
+	char *modeTypes[8] =
 	{
 		"NORMAL COMPUTE",
 		"TRANSFER BUFFERS _ ASYNC",
-		"DOUBLE BUFFERING _ ASYNC"
+		"DOUBLE BUFFERING _ ASYNC",
+		"CPU REFERENCE",
+		"BARNES-HUT _ CPU",
+		"FAST MULTIPOLE _ CPU",
+		"PARTICLE MESH _ CPU",
+		"TRAJECTORY REPLAY"
 	};
 
 	void print()
@@ -41,6 +88,25 @@ extern struct parameters
 		std::cout << "Stacks: " << stacks << std::endl;
 		std::cout << "Slices: " << slices << std::endl;
 		std::cout << "Lighting: " << (lighting ? "On" : "Off") << std::endl;
+		std::cout << "Workgroup size: " << workGroupSize << (autotune ? " (autotuned)" : "") << std::endl;
+		if (chosenMode == BARNES_HUT) std::cout << "Opening angle: " << theta << std::endl;
+		if (chosenMode == FMM) std::cout << "Expansion order: " << fmmOrder << std::endl;
+		if (chosenMode == PM) std::cout << "Mesh size: " << gridSize << std::endl;
+		if (chosenMode == CPU) std::cout << "Pair evaluation: " << (symmetric ? "symmetric" : "full") << std::endl;
+		std::cout << "Integrator: " << (integrator == LEAPFROG ? "leapfrog" : "euler") << ", " << substeps << " substep" << (substeps == 1 ? "" : "s") << " per frame" << std::endl;
+		if (fixedDeltaT > 0.0f) std::cout << "Fixed time step: " << fixedDeltaT << "s" << std::endl;
+		std::cout << "Initial conditions: " << distributionName(distribution) << std::endl;
+		if (seed) std::cout << "Seed: " << seed << std::endl;
+		if (steps) std::cout << "Steps: " << steps << std::endl;
+		if (headless && !isHostMode(chosenMode)) std::cout << "Headless: offscreen rendering, no window" << std::endl;
+		if (!isHostMode(chosenMode) && chosenMode != REPLAY) std::cout << "Frames in flight: " << framesInFlight << std::endl;
+		if (chosenMode == REPLAY) std::cout << "Replaying: " << replayPath << std::endl;
+		if (!restartPath.empty()) std::cout << "Restart from: " << restartPath << std::endl;
+		if (!snapshotPath.empty()) std::cout << "Snapshots: " << snapshotPath << (snapshotInterval ? " every " + std::to_string(snapshotInterval) + " frames and" : "") << " on exit" << std::endl;
+		if (!trajectoryPath.empty()) std::cout << "Trajectory: " << trajectoryPath << " every " << trajectoryInterval << " frame" << (trajectoryInterval == 1 ? "" : "s") << std::endl;
+		if (compressionError > 0.0f) std::cout << "Output quantised to " << compressionError << " of the bounding box" << std::endl;
+		if (resortInterval) std::cout << "Morton re-sort every " << resortInterval << " steps" << std::endl;
+		std::cout << "Host threads: " << (threads ? std::to_string(threads) : "all") << (pinThreads ? " (pinned)" : "") << std::endl;
 	}
 };
 
@@ -58,16 +124,29 @@ class nbody
 
 	void createSphereGeom(const unsigned int stacks, const unsigned int slices, const glm::vec3 dims);
 
+	MODE mode;
+
+	// restart state - empty ids for a fresh run
+	std::vector<uint32_t> idBuffer;
+	uint64_t startStep = 0;
+	double startTime = 0.0;
+
 
 public:
 
-	nbody(const unsigned int num, const bool AMD, const MODE chosenMode);
+	nbody(const unsigned int num, const bool AMD, const MODE chosenMode, const bool headless = false);
 
 	~nbody();
 	
-	void prepareParticles();
+	void prepareParticles(DISTRIBUTION distribution, uint32_t seed);
+
+	// take the particles, their ids and the run's progress from a snapshot
+	void loadSnapshot(const std::string& path);
+
+	// open a trajectory to replay, the particles start at its first frame
+	std::unique_ptr<TrajectoryReader> loadTrajectory(const std::string& path);
 
-	void run(const parameters simParam); // default 2 mins
+	void run(parameters simParam); // default 2 mins
 
 
 	unsigned int num_particles = 0;
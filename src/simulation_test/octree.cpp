@@ -0,0 +1,323 @@
+#include "octree.h"
+#include "morton.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <numeric>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const size_t TREE_CHUNK = 1 << 14;
+
+static inline uint32_t leadingZeros(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse64(&index, v) ? 63 - index : 64;
+#else
+	return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+// exclusive prefix sum in place, returns the total
+template<typename T>
+static T scan(std::vector<T>& values)
+{
+	auto pool = ThreadPool::get();
+	size_t count = values.size();
+	size_t chunks = std::max<size_t>(1, std::min<size_t>(pool->size(), (count + TREE_CHUNK - 1) / TREE_CHUNK));
+	std::vector<T> chunkSum(chunks + 1, T(0));
+
+	pool->parallelFor(0, chunks, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t c = begin; c < end; c++)
+		{
+			T sum = T(0);
+			for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; i++)
+			{
+				T v = values[i];
+				values[i] = sum;
+				sum += v;
+			}
+			chunkSum[c + 1] = sum;
+		}
+	});
+
+	for (size_t c = 0; c < chunks; c++)
+	{
+		chunkSum[c + 1] += chunkSum[c];
+	}
+
+	pool->parallelFor(0, chunks, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t c = begin; c < end; c++)
+		{
+			for (size_t i = c * count / chunks; i < (c + 1) * count / chunks; i++)
+			{
+				values[i] += chunkSum[c];
+			}
+		}
+	});
+
+	return chunkSum[chunks];
+}
+
+void Octree::build(const float* posX, const float* posY, const float* posZ, size_t count)
+{
+	auto pool = ThreadPool::get();
+
+	// sort particles along the morton curve
+	mortonBounds(posX, posY, posZ, count, lo, rootSize);
+
+	keys.resize(count);
+	mortonKeys(posX, posY, posZ, count, lo, rootSize, keys.data());
+
+	order.resize(count);
+	std::iota(order.begin(), order.end(), 0u);
+	radixSort(keys, order);
+
+	// sorted copies of the positions and their running sums, relative to the cube corner to keep the sums small
+	x.resize(count); y.resize(count); z.resize(count);
+	sumX.resize(count + 1); sumY.resize(count + 1); sumZ.resize(count + 1);
+
+	pool->parallelFor(0, count, TREE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; k++)
+		{
+			x[k] = posX[order[k]];
+			y[k] = posY[order[k]];
+			z[k] = posZ[order[k]];
+			sumX[k] = x[k] - lo.x;
+			sumY[k] = y[k] - lo.y;
+			sumZ[k] = z[k] - lo.z;
+		}
+	});
+
+	sumX[count] = sumY[count] = sumZ[count] = 0.0;
+	scan(sumX); scan(sumY); scan(sumZ);
+
+	nodes.clear();
+
+	// too few to split - one leaf
+	if (count <= LEAF_SIZE)
+	{
+		OctreeNode root = {};
+		root.count = static_cast<uint32_t>(count);
+		root.size = rootSize;
+		if (count > 0)
+			root.centre = lo + glm::vec3(sumX[count], sumY[count], sumZ[count]) / static_cast<float>(count);
+
+		nodes.push_back(root);
+		return;
+	}
+
+	buildRadixTree();
+	markOctreeNodes();
+	linkOctreeNodes();
+}
+
+void Octree::buildRadixTree()
+{
+	const int64_t count = static_cast<int64_t>(keys.size());
+
+	rangeFirst.resize(count - 1);
+	rangeLast.resize(count - 1);
+	prefixLength.resize(count - 1);
+	children.resize(2 * (count - 1));
+
+	// length of the common prefix of keys i and j, -1 off the ends. equal keys are
+	// told apart by their index so every node still splits somewhere
+	auto delta = [&](int64_t i, int64_t j) -> int
+	{
+		if (j < 0 || j >= count)
+			return -1;
+
+		uint64_t a = keys[i], b = keys[j];
+		if (a == b)
+			return 64 + static_cast<int>(leadingZeros(static_cast<uint64_t>(i ^ j) << 32));
+
+		return static_cast<int>(leadingZeros(a ^ b));
+	};
+
+	ThreadPool::get()->parallelFor(0, count - 1, TREE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (int64_t i = begin; i < static_cast<int64_t>(end); i++)
+		{
+			// which way the node's range goes from i
+			int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+
+			// upper bound on the range length, then binary search the other end
+			int deltaMin = delta(i, i - d);
+			int64_t lengthMax = 2;
+			while (delta(i, i + lengthMax * d) > deltaMin)
+			{
+				lengthMax *= 2;
+			}
+
+			int64_t length = 0;
+			for (int64_t t = lengthMax / 2; t >= 1; t /= 2)
+			{
+				if (delta(i, i + (length + t) * d) > deltaMin)
+					length += t;
+			}
+
+			int64_t j = i + length * d;
+			int deltaNode = delta(i, j);
+
+			// binary search where the common prefix ends
+			int64_t split = 0;
+			for (int64_t div = 2; ; div *= 2)
+			{
+				int64_t t = (length + div - 1) / div;
+				if (delta(i, i + (split + t) * d) > deltaNode)
+					split += t;
+				if (t <= 1)
+					break;
+			}
+
+			int64_t gamma = i + split * d + std::min(d, 0);
+			int64_t first = std::min(i, j), last = std::max(i, j);
+
+			rangeFirst[i] = static_cast<uint32_t>(first);
+			rangeLast[i] = static_cast<uint32_t>(last);
+			prefixLength[i] = static_cast<uint32_t>(deltaNode);
+			children[2 * i] = static_cast<uint32_t>(first == gamma ? count - 1 + gamma : gamma);
+			children[2 * i + 1] = static_cast<uint32_t>(last == gamma + 1 ? count - 1 + gamma + 1 : gamma + 1);
+		}
+	});
+}
+
+void Octree::markOctreeNodes()
+{
+	const uint32_t count = static_cast<uint32_t>(keys.size());
+	const uint32_t internalCount = count - 1;
+
+	// keys are 63 bits, so the first shared bit doesn't count towards a level
+	auto level = [&](uint32_t node) -> uint32_t
+	{
+		return node < internalCount ? std::min(MAX_DEPTH, (prefixLength[node] - 1) / 3) : MAX_DEPTH;
+	};
+
+	auto size = [&](uint32_t node) -> uint32_t
+	{
+		return node < internalCount ? rangeLast[node] - rangeFirst[node] + 1 : 1;
+	};
+
+	// a node is kept when its parent gets split and it either starts a deeper octree level or is
+	// small enough to be a leaf. everything under a leaf is dropped. piles of identical keys
+	// never start a new level, so past the last level every node is kept as a binary split
+	kept.assign(2 * count - 1, 0);
+	kept[0] = 1;
+
+	ThreadPool::get()->parallelFor(0, internalCount, TREE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (uint32_t i = static_cast<uint32_t>(begin); i < end; i++)
+		{
+			if (size(i) <= LEAF_SIZE)
+				continue;
+
+			for (int side = 0; side < 2; side++)
+			{
+				uint32_t child = children[2 * i + side];
+				kept[child] = size(child) <= LEAF_SIZE || level(child) > level(i) || level(child) == MAX_DEPTH;
+			}
+		}
+	});
+}
+
+// call visit on the kept nodes directly under node, in order - skipping the binary nodes
+// that only split a cell without starting a new level
+template<typename Visit>
+void Octree::visitChildren(uint32_t node, Visit visit) const
+{
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = children[2 * node + 1];
+	stack[top++] = children[2 * node];
+
+	while (top > 0)
+	{
+		uint32_t n = stack[--top];
+		if (kept[n])
+		{
+			visit(n);
+			continue;
+		}
+
+		stack[top++] = children[2 * n + 1];
+		stack[top++] = children[2 * n];
+	}
+}
+
+void Octree::linkOctreeNodes()
+{
+	const uint32_t count = static_cast<uint32_t>(keys.size());
+	const uint32_t internalCount = count - 1;
+	auto pool = ThreadPool::get();
+
+	auto isSplit = [&](uint32_t i)
+	{
+		return kept[i] && rangeLast[i] - rangeFirst[i] + 1 > LEAF_SIZE;
+	};
+
+	// octree children per kept node, then where they start
+	childCount.assign(internalCount, 0);
+
+	pool->parallelFor(0, internalCount, TREE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (uint32_t i = static_cast<uint32_t>(begin); i < end; i++)
+		{
+			if (isSplit(i))
+				visitChildren(i, [&](uint32_t) { childCount[i]++; });
+		}
+	});
+
+	childBase = childCount;
+	uint32_t total = 1 + scan(childBase);
+
+	// hand every kept node its slot next to its siblings
+	octreeIndex.assign(2 * count - 1, 0);
+
+	pool->parallelFor(0, internalCount, TREE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (uint32_t i = static_cast<uint32_t>(begin); i < end; i++)
+		{
+			if (!isSplit(i))
+				continue;
+
+			uint32_t slot = 1 + childBase[i];
+			visitChildren(i, [&](uint32_t child) { octreeIndex[child] = slot++; });
+		}
+	});
+
+	// fill in the octree nodes, the centre of each is its slice of the running sums
+	nodes.resize(total);
+
+	pool->parallelFor(0, 2 * count - 1, TREE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (uint32_t b = static_cast<uint32_t>(begin); b < end; b++)
+		{
+			if (!kept[b])
+				continue;
+
+			bool internal = b < internalCount;
+			uint32_t first = internal ? rangeFirst[b] : b - internalCount;
+			uint32_t last = internal ? rangeLast[b] : first;
+			uint32_t level = internal ? std::min(MAX_DEPTH, (prefixLength[b] - 1) / 3) : MAX_DEPTH;
+
+			// a leaf that didn't start a new level still fills its parent's cell
+			OctreeNode& node = nodes[octreeIndex[b]];
+			node.count = last - first + 1;
+			node.first = first;
+			node.size = rootSize / static_cast<float>(1u << level);
+			node.centre = lo + glm::vec3(
+				static_cast<float>((sumX[last + 1] - sumX[first]) / node.count),
+				static_cast<float>((sumY[last + 1] - sumY[first]) / node.count),
+				static_cast<float>((sumZ[last + 1] - sumZ[first]) / node.count));
+
+			node.childCount = internal && isSplit(b) ? childCount[b] : 0;
+			node.firstChild = node.childCount ? 1 + childBase[b] : 0;
+		}
+	});
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+// a cell of the tree. the force law ignores mass, so from far enough away a cell
+// pulls like `count` particles sitting at their mean position
+struct OctreeNode
+{
+	glm::vec3 centre;		// mean position of the particles inside
+	float size;				// edge length of the cell
+	uint32_t count;			// particles inside
+	uint32_t first;			// first of them in Octree::order
+	uint32_t firstChild;	// children are stored next to each other
+	uint32_t childCount;	// 0 for a leaf
+};
+
+// linear octree built from morton sorted keys (Karras 2012). a binary radix tree over the
+// sorted keys is built in parallel, then only the binary nodes that start a new octree level
+// (or are small enough to be leaves) are kept. every step is a parallel pass over flat arrays
+class Octree
+{
+	// binary radix tree - internal node i covers sorted particles [first, last]. nodes are
+	// numbered internal first, leaf j is node (count - 1 + j)
+	std::vector<uint64_t> keys;
+	std::vector<uint32_t> rangeFirst, rangeLast;
+	std::vector<uint32_t> prefixLength;		// leading bits shared by the node's keys
+	std::vector<uint32_t> children;			// left, right per internal node
+
+	std::vector<uint8_t> kept;				// binary node is also an octree node
+	std::vector<uint32_t> childCount, childBase, octreeIndex;
+
+	// running sums of the sorted positions, so any cell's centre is one subtraction
+	std::vector<double> sumX, sumY, sumZ;
+
+	glm::vec3 lo;
+	float rootSize;
+
+	void buildRadixTree();
+	void markOctreeNodes();
+	void linkOctreeNodes();
+
+	template<typename Visit>
+	void visitChildren(uint32_t node, Visit visit) const;
+
+public:
+	// particles per leaf before it gets split
+	static const uint32_t LEAF_SIZE = 16;
+	static const uint32_t MAX_DEPTH = 21;
+
+	std::vector<OctreeNode> nodes;		// root is nodes[0]
+	std::vector<uint32_t> order;		// particle indices in morton order, every cell covers a contiguous run
+
+	// positions copied into tree order so leaves read them contiguously
+	std::vector<float> x, y, z;
+
+	// build over structure of arrays positions, centres and counts included
+	void build(const float* posX, const float* posY, const float* posZ, size_t count);
+};
@@ -42,4 +42,25 @@ std::array<VkVertexInputAttributeDescription, 3> Vertex::getAttributeDescription
 	attributeDesc[2].offset = offsetof(Vertex, texCoord);
 
 	return attributeDesc;
-}
\ No newline at end of file
+}
+uint64_t stateHash(const std::vector<particle>& particles, const std::vector<uint32_t>& ids)
+{
+	std::vector<uint32_t> slots(particles.size());
+	for (size_t slot = 0; slot < ids.size(); slot++)
+	{
+		slots[ids[slot]] = static_cast<uint32_t>(slot);
+	}
+
+	uint64_t hash = 14695981039346656037ull;
+	for (uint32_t slot : slots)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&particles[slot]);
+		for (size_t b = 0; b < sizeof(particle); b++)
+		{
+			hash ^= bytes[b];
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return hash;
+}
@@ -5,6 +5,8 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <array>
+#include <vector>
+#include <cstdint>
 
 // structs to store vertex attributes
 struct Vertex
@@ -28,4 +30,8 @@ struct particle
 	glm::vec4 vel;								// Particle velocity
 };
 
+// FNV-1a over the bits of every particle, taken in id order so morton re-sorts don't change it.
+// ids[slot] is the original index of the particle in that slot
+uint64_t stateHash(const std::vector<particle>& particles, const std::vector<uint32_t>& ids);
+
  
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+
+// philox 4x32-10 (salmon et al., "parallel random numbers: as easy as 1, 2, 3"). counter based - a block
+// of output is a pure function of (counter, key), so any particle's numbers can be made on any thread in any order
+struct Philox
+{
+	static void block(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+	{
+		const uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+		const uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+
+		uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		uint32_t k0 = key[0], k1 = key[1];
+
+		for (int round = 0; round < 10; round++)
+		{
+			uint64_t p0 = static_cast<uint64_t>(M0) * c0;
+			uint64_t p1 = static_cast<uint64_t>(M1) * c2;
+
+			uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+			uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+			c1 = static_cast<uint32_t>(p1);
+			c3 = static_cast<uint32_t>(p0);
+			c0 = n0;
+			c2 = n2;
+
+			k0 += W0;
+			k1 += W1;
+		}
+
+		out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+	}
+};
+
+// numbers for one stream (a particle) under one seed, drawn four at a time from consecutive counters
+class PhiloxStream
+{
+	uint32_t key[2];
+	uint32_t counter[4];
+	uint32_t buffered[4];
+	uint32_t used = 4;
+
+public:
+	PhiloxStream(uint32_t seed, uint64_t stream)
+	{
+		key[0] = seed;
+		key[1] = 0x5DEECE66u;
+		counter[0] = static_cast<uint32_t>(stream);
+		counter[1] = static_cast<uint32_t>(stream >> 32);
+		counter[2] = 0;
+		counter[3] = 0;
+	}
+
+	uint32_t next()
+	{
+		if (used == 4)
+		{
+			Philox::block(counter, key, buffered);
+			counter[2]++;
+			used = 0;
+		}
+
+		return buffered[used++];
+	}
+
+	// [0, 1) from the top 24 bits, exact in a float
+	float uniform()
+	{
+		return static_cast<float>(next() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// (0, 1) - safe to take the log of
+	float uniformOpen()
+	{
+		return (static_cast<float>(next() >> 8) + 0.5f) * (1.0f / 16777216.0f);
+	}
+};
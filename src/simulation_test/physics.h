@@ -0,0 +1,6 @@
+#pragma once
+
+// force law constants - these have to match the specialisation constant defaults in nbody.comp
+const float GRAVITY = 0.02f;
+const float POWER = 0.75f;
+const float SOFTEN = 5.0f;
@@ -0,0 +1,138 @@
+#include "pipeline-cache.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+PipelineCache::PipelineCache(const VkDevice& dev, const VkPhysicalDeviceProperties& properties)
+	: device(dev), fileName(fileFor(properties))
+{
+	std::ifstream in(fileName, std::ios::ate | std::ios::binary);
+
+	// no file yet is fine - nothing has been built
+	if (in.is_open())
+	{
+		loaded.resize(static_cast<size_t>(in.tellg()));
+		in.seekg(0);
+		in.read(reinterpret_cast<char*>(loaded.data()), loaded.size());
+
+		if (!in || !matches(loaded, properties))
+		{
+			std::cout << "Pipeline cache " << fileName << " is from another device or driver - starting empty" << std::endl;
+			loaded.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = loaded.size();
+	createInfo.pInitialData = loaded.empty() ? nullptr : loaded.data();
+
+	// a driver can still refuse data it wrote itself, so try again empty before giving up
+	if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) != VK_SUCCESS)
+	{
+		loaded.clear();
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
+
+		if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) != VK_SUCCESS)
+			throw std::runtime_error("failed to create pipeline cache");
+	}
+
+	if (!loaded.empty())
+		std::cout << "Pipeline cache: " << loaded.size() << " bytes from " << fileName << std::endl;
+}
+
+PipelineCache::~PipelineCache()
+{
+	vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+void PipelineCache::save()
+{
+	size_t size = 0;
+	if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+		return;
+
+	std::vector<uint8_t> data(size);
+	if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+		return;
+	data.resize(size);
+
+	if (data == loaded)
+		return;
+
+	// written beside the file and renamed over it, so a run starting now never reads half a cache
+	std::stringstream temporary;
+#ifdef _WIN32
+	temporary << fileName << "." << GetCurrentProcessId() << ".tmp";
+#else
+	temporary << fileName << "." << getpid() << ".tmp";
+#endif
+
+	{
+		std::ofstream out(temporary.str(), std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+		if (!out)
+		{
+			// the next run just builds its pipelines again
+			std::cerr << "failed to write pipeline cache " << temporary.str() << std::endl;
+			out.close();
+			std::remove(temporary.str().c_str());
+			return;
+		}
+	}
+
+#ifdef _WIN32
+	bool replaced = MoveFileExA(temporary.str().c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool replaced = rename(temporary.str().c_str(), fileName.c_str()) == 0;
+#endif
+
+	if (!replaced)
+	{
+		std::cerr << "failed to replace pipeline cache " << fileName << std::endl;
+		std::remove(temporary.str().c_str());
+		return;
+	}
+
+	loaded.swap(data);
+}
+
+std::string PipelineCache::fileFor(const VkPhysicalDeviceProperties& properties)
+{
+	std::stringstream name;
+	name << "pipeline-" << std::hex << std::setfill('0');
+
+	for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+		name << std::setw(2) << static_cast<uint32_t>(properties.pipelineCacheUUID[i]);
+
+	name << "-" << std::setw(8) << properties.driverVersion << ".cache";
+	return name.str();
+}
+
+bool PipelineCache::matches(const std::vector<uint8_t>& data, const VkPhysicalDeviceProperties& properties)
+{
+	if (data.size() < sizeof(PipelineCacheHeader))
+		return false;
+
+	PipelineCacheHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+
+	return header.headerSize >= sizeof(PipelineCacheHeader) && header.headerSize <= data.size()
+		&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == properties.vendorID
+		&& header.deviceID == properties.deviceID
+		&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
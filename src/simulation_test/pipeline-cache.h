@@ -0,0 +1,45 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// VkPipelineCacheHeaderVersionOne - the start of every pipeline cache blob. older sdk headers don't declare it
+struct PipelineCacheHeader
+{
+	uint32_t headerSize;
+	uint32_t headerVersion;			// VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+// compiled pipelines kept between runs in a file per device and driver, so a run only pays for the
+// pipelines the last one didn't build. a file the driver wouldn't accept is ignored and replaced
+class PipelineCache
+{
+	const VkDevice& device;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string fileName;
+
+	std::vector<uint8_t> loaded;	// what the file held, so an unchanged cache isn't written again
+
+public:
+	PipelineCache(const VkDevice& dev, const VkPhysicalDeviceProperties& properties);
+	~PipelineCache();
+
+	PipelineCache(const PipelineCache&) = delete;
+	PipelineCache& operator=(const PipelineCache&) = delete;
+
+	VkPipelineCache handle() const { return cache; }
+
+	// write the cache back to its file if it has grown. concurrent runs each replace the file whole
+	void save();
+
+	// pipeline-<cache uuid>-<driver version>.cache in the working directory
+	static std::string fileFor(const VkPhysicalDeviceProperties& properties);
+
+	// the blob was written by this device and driver
+	static bool matches(const std::vector<uint8_t>& data, const VkPhysicalDeviceProperties& properties);
+};
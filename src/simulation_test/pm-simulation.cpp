@@ -0,0 +1,15 @@
+#include "simulation.h"
+#include "nbody.h"
+
+pm_simulation::pm_simulation(const parameters& param, const std::vector<particle>& initial)
+	: cpu_simulation(param, initial), mesh(param.gridSize)
+{
+}
+
+void pm_simulation::computeForces()
+{
+	loadPositions();
+
+	mesh.evaluate(posX.data(), posY.data(), posZ.data(), particles.size(),
+		accX.data(), accY.data(), accZ.data());
+}
@@ -0,0 +1,246 @@
+#include "pm.h"
+#include "fft.h"
+#include "morton.h"
+#include "physics.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+
+static const size_t PARTICLE_CHUNK = 1 << 13;
+static const size_t CELL_CHUNK = 1 << 12;
+
+ParticleMesh::ParticleMesh(uint32_t size)
+{
+	// the FFT needs a power of two
+	gridSize = 4;
+	while (gridSize < size)
+		gridSize <<= 1;
+
+	paddedSize = 2 * gridSize;
+
+	size_t cells = static_cast<size_t>(gridSize) * gridSize * gridSize;
+	size_t padded = static_cast<size_t>(paddedSize) * paddedSize * paddedSize;
+
+	workerDensity.assign(ThreadPool::get()->size(), std::vector<float>(cells));
+	potential.resize(cells);
+	fieldX.resize(cells); fieldY.resize(cells); fieldZ.resize(cells);
+	densityHat.resize(padded);
+	greensHat.resize(padded);
+}
+
+void ParticleMesh::evaluate(const float* x, const float* y, const float* z, size_t count, float* ax, float* ay, float* az)
+{
+	if (count == 0)
+		return;
+
+	// the cube over the particles with a cell spare on every face, so the weights stay inside and
+	// the gradient is a central difference wherever a particle can land
+	float size;
+	mortonBounds(x, y, z, count, lo, size);
+	cellSize = size / static_cast<float>(gridSize - 3);
+	lo -= glm::vec3(cellSize);
+
+	tabulateGreens();
+	deposit(x, y, z, count);
+	solve();
+	gradient();
+	interpolate(x, y, z, count, ax, ay, az);
+}
+
+void ParticleMesh::tabulateGreens()
+{
+	// the force law is the gradient of G(r) = integral 0..r of GRAVITY / (s^2 + SOFTEN)^POWER ds.
+	// integrated once per step with simpson's rule between consecutive grid distances
+	auto integrand = [](double s) { return GRAVITY / std::pow(s * s + SOFTEN, static_cast<double>(POWER)); };
+
+	uint32_t maxD2 = 3 * gridSize * gridSize;
+	greens.resize(maxD2 + 1);
+	greens[0] = 0.0f;
+
+	double total = 0.0;
+	double previous = 0.0;
+	for (uint32_t d2 = 1; d2 <= maxD2; d2++)
+	{
+		double r = cellSize * std::sqrt(static_cast<double>(d2));
+		total += (r - previous) / 6.0 * (integrand(previous) + 4.0 * integrand(0.5 * (previous + r)) + integrand(r));
+		greens[d2] = static_cast<float>(total);
+		previous = r;
+	}
+
+	// sampled on the padded grid, negative offsets wrapped to the top half
+	const uint32_t M = paddedSize;
+	ThreadPool::get()->parallelFor(0, static_cast<size_t>(M) * M, CELL_CHUNK / M + 1, [&](size_t begin, size_t end)
+	{
+		for (size_t line = begin; line < end; line++)
+		{
+			uint32_t j = static_cast<uint32_t>(line % M), k = static_cast<uint32_t>(line / M);
+			uint32_t dj = std::min(j, M - j), dk = std::min(k, M - k);
+
+			for (uint32_t i = 0; i < M; i++)
+			{
+				uint32_t di = std::min(i, M - i);
+				uint32_t d2 = di * di + dj * dj + dk * dk;
+
+				// only offsets under gridSize per axis are ever used
+				float g = d2 <= maxD2 ? greens[d2] : 0.0f;
+				greensHat[line * M + i] = std::complex<float>(g, 0.0f);
+			}
+		}
+	});
+
+	fft3d(greensHat, M, false);
+}
+
+void ParticleMesh::deposit(const float* x, const float* y, const float* z, size_t count)
+{
+	auto pool = ThreadPool::get();
+	const float toGrid = 1.0f / cellSize;
+	const float top = static_cast<float>(gridSize - 2);
+
+	for (auto &grid : workerDensity)
+	{
+		std::fill(grid.begin(), grid.end(), 0.0f);
+	}
+
+	// cloud in cell - each particle spreads a weight of one over the 8 cells around it
+	pool->parallelFor(0, count, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		std::vector<float>& density = workerDensity[pool->currentWorker()];
+
+		for (size_t p = begin; p < end; p++)
+		{
+			glm::vec3 u = glm::clamp((glm::vec3(x[p], y[p], z[p]) - lo) * toGrid, 0.0f, top);
+			uint32_t i = std::min(static_cast<uint32_t>(u.x), gridSize - 2);
+			uint32_t j = std::min(static_cast<uint32_t>(u.y), gridSize - 2);
+			uint32_t k = std::min(static_cast<uint32_t>(u.z), gridSize - 2);
+			glm::vec3 f = u - glm::vec3(i, j, k);
+			glm::vec3 g = glm::vec3(1.0f) - f;
+
+			density[cell(i, j, k)] += g.x * g.y * g.z;
+			density[cell(i + 1, j, k)] += f.x * g.y * g.z;
+			density[cell(i, j + 1, k)] += g.x * f.y * g.z;
+			density[cell(i + 1, j + 1, k)] += f.x * f.y * g.z;
+			density[cell(i, j, k + 1)] += g.x * g.y * f.z;
+			density[cell(i + 1, j, k + 1)] += f.x * g.y * f.z;
+			density[cell(i, j + 1, k + 1)] += g.x * f.y * f.z;
+			density[cell(i + 1, j + 1, k + 1)] += f.x * f.y * f.z;
+		}
+	});
+}
+
+void ParticleMesh::solve()
+{
+	auto pool = ThreadPool::get();
+	const uint32_t n = gridSize, M = paddedSize;
+
+	// sum the worker grids into the corner of the zero padded grid
+	pool->parallelFor(0, static_cast<size_t>(M) * M, CELL_CHUNK / M + 1, [&](size_t begin, size_t end)
+	{
+		for (size_t line = begin; line < end; line++)
+		{
+			uint32_t j = static_cast<uint32_t>(line % M), k = static_cast<uint32_t>(line / M);
+
+			for (uint32_t i = 0; i < M; i++)
+			{
+				float rho = 0.0f;
+				if (i < n && j < n && k < n)
+				{
+					for (auto &grid : workerDensity)
+						rho += grid[cell(i, j, k)];
+				}
+
+				densityHat[line * M + i] = std::complex<float>(rho, 0.0f);
+			}
+		}
+	});
+
+	fft3d(densityHat, M, false);
+
+	pool->parallelFor(0, densityHat.size(), CELL_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t c = begin; c < end; c++)
+			densityHat[c] *= greensHat[c];
+	});
+
+	fft3d(densityHat, M, true);
+
+	// potential is the real part over the unpadded corner
+	const float scale = 1.0f / (static_cast<float>(M) * M * M);
+	pool->parallelFor(0, static_cast<size_t>(n) * n, CELL_CHUNK / n + 1, [&](size_t begin, size_t end)
+	{
+		for (size_t line = begin; line < end; line++)
+		{
+			uint32_t j = static_cast<uint32_t>(line % n), k = static_cast<uint32_t>(line / n);
+
+			for (uint32_t i = 0; i < n; i++)
+				potential[cell(i, j, k)] = densityHat[(static_cast<size_t>(k) * M + j) * M + i].real() * scale;
+		}
+	});
+}
+
+void ParticleMesh::gradient()
+{
+	const uint32_t n = gridSize;
+	const float inverse = 1.0f / cellSize;
+
+	// acceleration = -grad(potential), central differences inside and one sided on the faces
+	auto derivative = [&](uint32_t i, uint32_t j, uint32_t k, int axis) -> float
+	{
+		uint32_t c[3] = { i, j, k };
+		uint32_t lower[3] = { i, j, k }, upper[3] = { i, j, k };
+		lower[axis] = c[axis] > 0 ? c[axis] - 1 : 0;
+		upper[axis] = c[axis] < n - 1 ? c[axis] + 1 : n - 1;
+
+		float span = static_cast<float>(upper[axis] - lower[axis]);
+		return (potential[cell(upper[0], upper[1], upper[2])] - potential[cell(lower[0], lower[1], lower[2])]) * inverse / span;
+	};
+
+	ThreadPool::get()->parallelFor(0, static_cast<size_t>(n) * n, CELL_CHUNK / n + 1, [&](size_t begin, size_t end)
+	{
+		for (size_t line = begin; line < end; line++)
+		{
+			uint32_t j = static_cast<uint32_t>(line % n), k = static_cast<uint32_t>(line / n);
+
+			for (uint32_t i = 0; i < n; i++)
+			{
+				fieldX[cell(i, j, k)] = -derivative(i, j, k, 0);
+				fieldY[cell(i, j, k)] = -derivative(i, j, k, 1);
+				fieldZ[cell(i, j, k)] = -derivative(i, j, k, 2);
+			}
+		}
+	});
+}
+
+void ParticleMesh::interpolate(const float* x, const float* y, const float* z, size_t count, float* ax, float* ay, float* az)
+{
+	const float toGrid = 1.0f / cellSize;
+	const float top = static_cast<float>(gridSize - 2);
+
+	// same weights as the deposit so a particle feels no net pull from itself
+	ThreadPool::get()->parallelFor(0, count, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t p = begin; p < end; p++)
+		{
+			glm::vec3 u = glm::clamp((glm::vec3(x[p], y[p], z[p]) - lo) * toGrid, 0.0f, top);
+			uint32_t i = std::min(static_cast<uint32_t>(u.x), gridSize - 2);
+			uint32_t j = std::min(static_cast<uint32_t>(u.y), gridSize - 2);
+			uint32_t k = std::min(static_cast<uint32_t>(u.z), gridSize - 2);
+			glm::vec3 f = u - glm::vec3(i, j, k);
+			glm::vec3 g = glm::vec3(1.0f) - f;
+
+			float weights[8] = { g.x * g.y * g.z, f.x * g.y * g.z, g.x * f.y * g.z, f.x * f.y * g.z,
+				g.x * g.y * f.z, f.x * g.y * f.z, g.x * f.y * f.z, f.x * f.y * f.z };
+
+			glm::vec3 acceleration(0.0f);
+			for (uint32_t corner = 0; corner < 8; corner++)
+			{
+				size_t c = cell(i + (corner & 1), j + ((corner >> 1) & 1), k + ((corner >> 2) & 1));
+				acceleration += weights[corner] * glm::vec3(fieldX[c], fieldY[c], fieldZ[c]);
+			}
+
+			ax[p] += acceleration.x;
+			ay[p] += acceleration.y;
+			az[p] += acceleration.z;
+		}
+	});
+}
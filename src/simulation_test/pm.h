@@ -0,0 +1,43 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <complex>
+#include <vector>
+#include <cstdint>
+
+// particle mesh gravity. particles are spread over a grid with cloud in cell weights, the potential
+// comes from an FFT convolution with the force law's own green's function (zero padded so the box
+// is isolated, not periodic), then its gradient is interpolated back with the same weights.
+// cost is O(N + G^3 log G) whatever the particle count, forces are smoothed below a cell
+class ParticleMesh
+{
+	uint32_t gridSize;					// cells per axis the particles are spread over
+	uint32_t paddedSize;				// twice that so the convolution never wraps around
+
+	glm::vec3 lo;
+	float cellSize;
+
+	// one density grid per pool worker so the deposit needs no atomics
+	std::vector<std::vector<float>> workerDensity;
+	std::vector<float> potential;
+	std::vector<float> fieldX, fieldY, fieldZ;
+	std::vector<std::complex<float>> densityHat, greensHat;
+
+	// green's function by squared distance in cells
+	std::vector<float> greens;
+
+	void tabulateGreens();
+	void deposit(const float* x, const float* y, const float* z, size_t count);
+	void solve();
+	void gradient();
+	void interpolate(const float* x, const float* y, const float* z, size_t count, float* ax, float* ay, float* az);
+
+	size_t cell(uint32_t i, uint32_t j, uint32_t k) const { return (static_cast<size_t>(k) * gridSize + j) * gridSize + i; }
+
+public:
+	explicit ParticleMesh(uint32_t gridSize);
+
+	// add the acceleration on every particle from every other to ax/ay/az
+	void evaluate(const float* x, const float* y, const float* z, size_t count, float* ax, float* ay, float* az);
+
+	uint32_t size() const { return gridSize; }
+};
@@ -1,5 +1,6 @@
 #include "renderer.h"
 #include "nbody.h"
+#include "snapshot.h"
 #include <set>
 #include <chrono>
 #define GLM_FORCE_RADIANS
@@ -15,6 +16,10 @@
 
 void Renderer::initWindow()
 {
+	// no display - nothing from glfw is touched
+	if (headless)
+		return;
+
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -42,6 +47,9 @@ void Renderer::initVulkan(const MODE chosenMode, const bool AMD)
 	case DOUBLE:
 		sim = new double_simulation(&presentQueue, &graphicsQueue, &device);
 		break;
+	case REPLAY:
+		sim = new replay_simulation(&presentQueue, &graphicsQueue, &device);
+		break;
 	}
 
 	// set compute config
@@ -49,10 +57,18 @@ void Renderer::initVulkan(const MODE chosenMode, const bool AMD)
 
 	createInstance();
 	setupDebugCallback();
-	createSurface();
+	if (!headless)
+		createSurface();
 	pickPhysicalDevice(AMD);
 	createLogicalDevice();
-	createSwapChain();
+	allocator.init(physicalDevice, device);
+	uploads.create(device, uploadQueue, queueFamilyIndices.transfer, graphicsQueue, queueFamilyIndices.graphics);
+	createPipelineCache();
+
+	if (headless)
+		createOffscreenTargets();
+	else
+		createSwapChain();
 }
 
 void Renderer::createConfig(const parameters& simParam)
@@ -61,6 +77,10 @@ void Renderer::createConfig(const parameters& simParam)
 	PARTICLE_COUNT = simParam.pCount;
 	lighting = simParam.lighting;
 
+	// a replay waits on the queue every frame, so it never has more than the one
+	framesInFlight = chosenSimMode == REPLAY ? 1 : std::min(std::max(simParam.framesInFlight, 1u), MAX_FRAMES_IN_FLIGHT);
+	frameSlots = (chosenSimMode == DOUBLE && framesInFlight % 2) ? framesInFlight * 2 : framesInFlight;
+
 	createImageViews();
 	createRenderPass();
 	createDescriptorSetLayout();
@@ -74,6 +94,9 @@ void Renderer::createConfig(const parameters& simParam)
 
 	sim->createBufferObjects();
 
+	// the textures and buffer objects copy while the rest is set up - nothing reads them until compute is prepared
+	UploadToken staged = uploads.flush();
+
 	createUniformBuffer();
 	sim->createDescriptorPool();
 	createDescriptorSet();
@@ -83,7 +106,11 @@ void Renderer::createConfig(const parameters& simParam)
 	sim->recordGraphicsCommands();
 	createSemaphores();
 
-	prepareCompute();
+	uploads.wait(staged);
+
+	// a replay copies its positions in instead
+	if (chosenSimMode != REPLAY)
+		prepareCompute();
 }
 
 enum STAGES
@@ -150,30 +177,85 @@ void Renderer::mainLoop()
 		<< "async?" << std::endl;
 
 
-	while (!glfwWindowShouldClose(window))
+	uint32_t steps = simulationParameters->steps;
+	uint32_t firstFrame = frameCounter;
+	bool snapshots = !simulationParameters->snapshotPath.empty();
+
+	createTrajectory();
+
+	while (headless || !glfwWindowShouldClose(window))
 	{
+		// a fixed step count ends the run by frames instead of by time
+		if (steps && frameCounter - firstFrame >= steps)
+			break;
 
-		if (secondsRan > simulationParameters->totalTime)
+		if (!steps && secondsRan > simulationParameters->totalTime)
 		{
+			vkDeviceWaitIdle(device);
+			reportFramesInFlight(file);
+
+			if (snapshots)
+				saveSnapshot();
+
+			finishTrajectory();
+			pipelineCache->save();
+			reportMemory();
 			exit(0);
 		}
 
 		// start timer
 		auto startTime = std::chrono::high_resolution_clock::now();
 
+		// the compute submission in this frame signals the copy when it is done
+		bool capture = trajectory && (frameCounter + 1) % simulationParameters->trajectoryInterval == 0;
+		compute->signalReadback = capture;
+		compute->lastQuery = NO_QUERY;
+		compute->lastDeltaT = 0.0f;
+
 		sim->frame();
 
+		// what the frame submitted, reported once the gpu is done with it
+		FrameSync& submitted = frames[frameNumber % framesInFlight];
+		submitted.computeQuery = compute->lastQuery;
+		frameNumber++;
+
 		frameCounter++;
+		// the step that was dispatched - compute mode has already moved the ubo on to the next frame's
+		simulatedTime += compute->lastDeltaT * compute->substeps;
+
+		// only if the frame did submit compute work - otherwise nothing signals the copy
+		if (capture && !compute->signalReadback)
+		{
+			trajectory->capture(sim->buffers[INSTANCE]->buffer[sim->resultBuffer()], frameCounter, simulatedTime);
+			compute->waitReadback = true;
+		}
+
 		auto endTime = std::chrono::high_resolution_clock::now();
 		auto deltaT = std::chrono::duration<double, std::milli>(endTime - startTime).count();
 		frameTimer = (float)deltaT / 1000.0f;
 
-		// reset comput now to get results back
-		if (chosenSimMode == DOUBLE)
+		submitted.number = frameCounter;
+		submitted.frameTime = deltaT;
+
+		// every K frames put the particles back in morton order so neighbours sit together in memory
+		if (simulationParameters->resortInterval && frameCounter % simulationParameters->resortInterval == 0)
 		{
-			dynamic_cast<double_simulation*>(sim)->waitOnFence(compute->fence);
+			vkDeviceWaitIdle(device);
+
+			// the leapfrog drift reads each slot's acceleration from the last kick, so those move with the particles
+			std::vector<VkBuffer> perParticle;
+			if (compute->leapfrog)
+				perParticle.push_back(compute->accelerationBuffer);
+
+			dynamic_cast<InstanceBO*>(sim->buffers[INSTANCE])->sortByMorton(perParticle);
+
+			if (trajectory)
+				trajectory->setOrder(dynamic_cast<InstanceBO*>(sim->buffers[INSTANCE])->ids);
 		}
 
+		if (snapshots && simulationParameters->snapshotInterval && frameCounter % simulationParameters->snapshotInterval == 0)
+			saveSnapshot();
+
 
 		fpsTimer += (float)deltaT;
 		if (fpsTimer > 1000.0f)  // after 1 second
@@ -186,62 +268,100 @@ void Renderer::mainLoop()
 			secondsRan++;
 		}
 
-		// Fetch results.
-		std::uint64_t results[8] = {};
-		vkGetQueryPoolResults(device, renderQueryPool, 0, 1, sizeof(std::uint64_t) * 2, &results[G_START], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);  // graphics start
-		vkGetQueryPoolResults(device, renderQueryPool, 1, 1, sizeof(std::uint64_t) * 2, &results[G_END], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);	 // graphics end
-		vkGetQueryPoolResults(device, computeQueryPool, 0, 1, sizeof(std::uint64_t) * 2, &results[C_START], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT); // compute start
-		vkGetQueryPoolResults(device, computeQueryPool, 1, 1, sizeof(std::uint64_t) * 2, &results[C_END], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT); // compute end
+		// the oldest frame in flight - its timestamps are only waited on where the next frame's draw would wait anyway
+		if (frameNumber >= framesInFlight)
+			reportFrame(file, frames[frameNumber % framesInFlight]);
+
+		if (!headless)
+			glfwPollEvents();
+	}
+
+	vkDeviceWaitIdle(device);
+	reportFramesInFlight(file);
+
+	// hash of the final state so fixed step runs can be compared
+	if (steps)
+	{
+		auto instances = dynamic_cast<InstanceBO*>(sim->buffers[INSTANCE]);
+		uint64_t hash = stateHash(instances->readBack(sim->resultBuffer()), instances->ids);
+
+		std::cout << "State hash after " << frameCounter << " frames: " << std::hex << hash << std::dec << std::endl;
+		file << "State Hash, " << std::hex << hash << std::dec << std::endl;
+	}
+
+	if (snapshots)
+		saveSnapshot();
+
+	finishTrajectory();
+	pipelineCache->save();
+	reportMemory();
+}
+
+void Renderer::reportFrame(std::ofstream& file, const FrameSync& frame)
+{
+	// Fetch results - a queue the frame didn't submit to is left at zero
+	std::uint64_t results[8] = {};
+	if (frame.graphicsQuery != NO_QUERY)
+	{
+		vkGetQueryPoolResults(device, renderQueryPool, frame.graphicsQuery, 1, sizeof(std::uint64_t) * 2, &results[G_START], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);  // graphics start
+		vkGetQueryPoolResults(device, renderQueryPool, frame.graphicsQuery + 1, 1, sizeof(std::uint64_t) * 2, &results[G_END], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);	 // graphics end
+	}
+
+	if (frame.computeQuery != NO_QUERY)
+	{
+		vkGetQueryPoolResults(device, computeQueryPool, frame.computeQuery, 1, sizeof(std::uint64_t) * 2, &results[C_START], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT); // compute start
+		vkGetQueryPoolResults(device, computeQueryPool, frame.computeQuery + 1, 1, sizeof(std::uint64_t) * 2, &results[C_END], 0, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT); // compute end
+	}
 
-		std::uint64_t initial = 0;
-		bool async = false;
+	bool async = false;
 
-		// graphics starts execution first
-		if (results[G_START] < results[C_START])
+	// graphics starts execution first
+	if (results[G_START] < results[C_START])
+	{
+		//std::cout << "Gfx" << std::endl;
+		// if gfx is first. Async if start of c overlaps g end,
+		if (results[C_START] < results[G_END])
 		{
-			//std::cout << "Gfx" << std::endl;
-			// if gfx is first. Async if start of c overlaps g end,
-			if (results[C_START] < results[G_END])
-			{
-				//std::cout << "ASYNCASYNCASYNC" << std::endl;
-				async = true;
-			}
+			//std::cout << "ASYNCASYNCASYNC" << std::endl;
+			async = true;
 		}
-		else
+	}
+	else
+	{
+		//std::cout << "Compute" << std::endl;
+		// if compute is first. Async if start of g overlaps c end,
+		if (results[G_START] < results[C_END])
 		{
-			//std::cout << "Compute" << std::endl;
-			// if compute is first. Async if start of g overlaps c end,
-			if (results[G_START] < results[C_END])
-			{
-				//std::cout << "ASYNCASYNCASYNC" << std::endl;
-				async = true;
-			}
+			//std::cout << "ASYNCASYNCASYNC" << std::endl;
+			async = true;
 		}
-
-		glfwPollEvents();
-
-		// print results to file
-
-		file << frameCounter << ", " 
-			<< deltaT << ", "
-			<< results[C_START] << ", "
-			<< results[C_END] << ", "
-			<< (results[C_END] - results[C_START]) * timestampPeriod / 1000000.0 << ", "
-			<< results[G_START] << ", "
-			<< results[G_END] << ", "
-			<< (results[G_END] - results[G_START]) * timestampPeriod / 1000000.0 << ", "
-			<< (async ? "YES" : "NO") << std::endl;
 	}
 
-	vkDeviceWaitIdle(device);
+	// print results to file
+
+	file << frame.number << ", " 
+		<< frame.frameTime << ", "
+		<< results[C_START] << ", "
+		<< results[C_END] << ", "
+		<< (results[C_END] - results[C_START]) * timestampPeriod / 1000000.0 << ", "
+		<< results[G_START] << ", "
+		<< results[G_END] << ", "
+		<< (results[G_END] - results[G_START]) * timestampPeriod / 1000000.0 << ", "
+		<< (async ? "YES" : "NO") << std::endl;
+}
 
+void Renderer::reportFramesInFlight(std::ofstream& file)
+{
+	// every frame not yet reported, oldest first
+	uint64_t pending = std::min<uint64_t>(frameNumber, framesInFlight - 1);
+	for (uint64_t frame = frameNumber - pending; frame < frameNumber; frame++)
+		reportFrame(file, frames[frame % framesInFlight]);
 }
- 
+
 void Renderer::cleanupSwapChain()
 {
 	vkDestroyImageView(device, depthImageView, nullptr);
-	vkDestroyImage(device, depthImage, nullptr);
-	vkFreeMemory(device, depthImageMemory, nullptr);
+	destroyImage(depthImage, depthImageMemory);
 
 	for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
 	{
@@ -259,6 +379,16 @@ void Renderer::cleanupSwapChain()
 		vkDestroyImageView(device, swapChainImageViews[i], nullptr); 
 	}
 
+	// offscreen targets are ours to free, swapchain images belong to the swapchain
+	if (headless)
+	{
+		for (size_t i = 0; i < swapChainImages.size(); i++)
+		{
+			destroyImage(swapChainImages[i], offscreenMemory[i]);
+		}
+		return;
+	}
+
 	vkDestroySwapchainKHR(device, swapChain, nullptr);
 }
 
@@ -269,23 +399,27 @@ void Renderer::cleanup()
 	vkDestroySampler(device, textureSampler, nullptr);
 	vkDestroyImageView(device, textureImageView, nullptr);
 
-	vkDestroyImage(device, textureImage, nullptr);
-	vkFreeMemory(device, textureImageMemory, nullptr);
+	destroyImage(textureImage, textureImageMemory);
 
 	if (lighting)
 	{
 		vkDestroySampler(device, textureSampler_Normal, nullptr);
 		vkDestroyImageView(device, textureImageView_Normal, nullptr);
 
-		vkDestroyImage(device, textureImage_Normal, nullptr);
-		vkFreeMemory(device, textureImageMemory_Normal, nullptr);
+		destroyImage(textureImage_Normal, textureImageMemory_Normal);
 	}
 
 	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-	vkDestroyBuffer(device, uniformBuffer, nullptr);
-	vkFreeMemory(device, uniformBufferMemory, nullptr);
+	uniforms.destroy();
+
 
+	// a run that threw out of the main loop still has its stream open
+	if (trajectory)
+	{
+		vkDeviceWaitIdle(device);
+		trajectory.reset();
+	}
 
 	// rememebr to call cleanup on compute
 	sim->cleanup();
@@ -298,16 +432,33 @@ void Renderer::cleanup()
 	
 	vkDestroyQueryPool(device, renderQueryPool, nullptr);
 	vkDestroyQueryPool(device, computeQueryPool, nullptr);
-	vkDestroyFence(device, graphicsFence, nullptr);
 
-	vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-	vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
+	for (auto &frame : frames)
+	{
+		vkDestroyFence(device, frame.fence, nullptr);
+		vkDestroySemaphore(device, frame.drawn, nullptr);
+		vkDestroySemaphore(device, frame.renderFinished, nullptr);
+		vkDestroySemaphore(device, frame.imageAvailable, nullptr);
+	}
 
-	if (chosenSimMode == COMPUTE)
+	if (chosenSimMode == COMPUTE || chosenSimMode == REPLAY)
 		vkDestroyCommandPool(device, gfxCommandPool, nullptr);
 
+	pipelineCache.reset();
+	pipeCache = VK_NULL_HANDLE;
+
+	uploads.destroy();
+	allocator.destroy();
+
 	vkDestroyDevice(device, nullptr);
 	DestroyDebugReportCallbackEXT(instance, callback, nullptr);
+
+	if (headless)
+	{
+		vkDestroyInstance(instance, nullptr);
+		return;
+	}
+
 	vkDestroySurfaceKHR(instance, surface, nullptr);
 	vkDestroyInstance(instance, nullptr);
 
@@ -416,21 +567,40 @@ void Renderer::pickPhysicalDevice(const bool AMD)
 	if (deviceCount == 0)
 		throw std::runtime_error("Failed to find GPU with Vulkan support!");
 
+	// headless runs take an integrated or software device (lavapipe) when there is no discrete one
+	VkPhysicalDevice fallback = VK_NULL_HANDLE;
+
 	for (const auto& dev : devices)
 	{
 		std::cout << "checking device" << std::endl;
 
 		if (isDeviceSuitable(dev, AMD)) 
 		{
-			physicalDevice = dev;
-			break;
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(dev, &properties);
+
+			if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+			{
+				physicalDevice = dev;
+				break;
+			}
+
+			if (fallback == VK_NULL_HANDLE)
+				fallback = dev;
 		}
 	}
 
+	if (physicalDevice == VK_NULL_HANDLE)
+		physicalDevice = fallback;
+
 	if (physicalDevice == VK_NULL_HANDLE)
 		throw std::runtime_error("failed to find a suitable GPU!");
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	timestampPeriod = properties.limits.timestampPeriod;
 	
-	std::cout << "device suitable" << std::endl;
+	std::cout << "device suitable: " << properties.deviceName << std::endl;
 }
 
 // create a logic device + queues
@@ -441,15 +611,23 @@ void Renderer::createLogicalDevice()
 	QueueFamilyIndices indices = findQueuesFamilies(physicalDevice);
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<int> uniqueQFamilies = { indices.graphicsFamily, indices.presentFamily, indices.computeFamily };
+	std::set<int> uniqueQFamilies = { indices.graphicsFamily, indices.presentFamily, indices.computeFamily, indices.transferFamily };
 	
 	queueFamilyIndices.graphics = indices.graphicsFamily;
 	queueFamilyIndices.compute = indices.computeFamily;
 	queueFamilyIndices.present = indices.presentFamily;
+	queueFamilyIndices.transfer = indices.transferFamily;
 
 	// influence sheduling of the command buffer (NEEDED EVEN IF ONLY 1 Q)
 	float queuePriority[2] = { 1.0f, 1.0f };
 
+	// software devices often have one queue in one family, so everything shares it
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t sharedQueues = std::min(2u, queueFamilies[indices.graphicsFamily].queueCount);
+
 	// for each unique queue family, create a new info for them and add to list
 	for (int queueFam : uniqueQFamilies)
 	{
@@ -464,7 +642,7 @@ void Renderer::createLogicalDevice()
 		qCreateInfo.queueFamilyIndex = queueFam;
 
 		qCreateInfo.pQueuePriorities = queuePriority;
-		qCreateInfo.queueCount = (queueFam == indices.graphicsFamily && queueFam == indices.computeFamily) ? 2 : 1;
+		qCreateInfo.queueCount = (queueFam == indices.graphicsFamily && queueFam == indices.computeFamily) ? sharedQueues : 1;
 
 		// add to list
 		queueCreateInfos.push_back(qCreateInfo);
@@ -481,8 +659,8 @@ void Renderer::createLogicalDevice()
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	// swap chain extensions enable!
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	// swap chain extensions enable! (none without a window)
+	createInfo.enabledExtensionCount = headless ? 0 : static_cast<uint32_t>(deviceExtensions.size());
 	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
 	// create validation
@@ -501,13 +679,32 @@ void Renderer::createLogicalDevice()
 		throw std::runtime_error("Failed to create logical device!");
 
 	vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
-	vkGetDeviceQueue(device, indices.presentFamily, (indices.graphicsFamily == indices.computeFamily) ? 1 : 0, &presentQueue);
+	vkGetDeviceQueue(device, indices.presentFamily, (indices.graphicsFamily == indices.computeFamily) ? sharedQueues - 1 : 0, &presentQueue);
 	vkGetDeviceQueue(device, indices.computeFamily, 0, &compute->queue);
+	vkGetDeviceQueue(device, indices.transferFamily, 0, &uploadQueue);
 	std::cout << "Graphics queue: " << graphicsQueue << std::endl;
 	std::cout << "Compute queue: " << compute->queue << std::endl;
 	
 }
 
+void Renderer::createPipelineCache()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	pipelineCache.reset(new PipelineCache(device, properties));
+	pipeCache = pipelineCache->handle();
+}
+
+void Renderer::reportMemory()
+{
+	AllocatorStats stats = allocator.stats();
+
+	std::cout << "Device memory: " << stats.reserved / (1 << 20) << " MiB reserved in " << stats.blocks << " blocks, "
+		<< stats.used / (1 << 20) << " MiB used by " << stats.allocations << " allocations ("
+		<< stats.dedicated << " dedicated), fragmentation " << stats.fragmentation << std::endl;
+}
+
 // create swapchain
 void Renderer::createSwapChain()
 {
@@ -607,6 +804,27 @@ void Renderer::createSwapChain()
 
 }
 
+// headless stand in for the swapchain - an image of the window's size that the render pass draws into and
+// nothing presents
+void Renderer::createOffscreenTargets()
+{
+	// one target is enough - frames in flight draw into it one after another on the graphics queue
+	uint32_t imageCount = 1;
+
+	swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	swapChainExtent = { static_cast<uint32_t>(WIDTH), static_cast<uint32_t>(HEIGHT) };
+
+	swapChainImages.resize(imageCount);
+	offscreenMemory.resize(imageCount);
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			swapChainImages[i], offscreenMemory[i]);
+	}
+}
+
 // create image views for the swapchain images so they can be used in the render pipeline.
 void Renderer::createImageViews()
 {
@@ -650,11 +868,16 @@ void Renderer::createQueryPools()
 	VkQueryPoolCreateInfo queryPoolInfo = {};
 	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
 	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
-	queryPoolInfo.queryCount = 2;
+
+	// the pairs of frames still in flight aren't overwritten before they are read
+	renderQueryPairs = graphicsCommandCount();
+	queryPoolInfo.queryCount = 2 * renderQueryPairs;
 
 	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &renderQueryPool) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create render query pool.");
 
+	queryPoolInfo.queryCount = 2 * frameSlots;
+
 	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &computeQueryPool) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create compute query pool.");
 	
@@ -682,6 +905,10 @@ void Renderer::createRenderPass()
 	colourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	colourAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
+	// headless, ready to be copied out instead
+	if (headless)
+		colourAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
 	// dpeth attachment
 	VkAttachmentDescription depthAttachment = {};
 	depthAttachment.format = findDepthFormat();
@@ -758,7 +985,7 @@ void Renderer::createDescriptorSetLayout()
 	// bind through a layoutstruct  -- set as uniform buffer
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1; // can have an array (different MVP for each animation etc)
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // uniform for vertex
 	uboLayoutBinding.pImmutableSamplers = nullptr; // for image sampling
@@ -1142,30 +1369,6 @@ void Renderer::transitionImageLayout(VkImage image, VkFormat format, VkImageLayo
 }
 
 
-void Renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = {
-		width,
-		height,
-		1
-	};
-
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
 // depth buffering - need image, imageview and layout
 void Renderer::createDepthResources()
 {
@@ -1215,8 +1418,14 @@ bool Renderer::hasStencilComponent(VkFormat format)
 // create uniform Buffer
 void Renderer::createUniformBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-	createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffer, uniformBufferMemory);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// a slot per graphics command buffer - one per frame slot and swapchain image. should a recreated
+	// swapchain have more images, the extra command buffers share slots (offset wraps)
+	uint32_t slots = graphicsCommandCount();
+	uniforms.create(sizeof(UniformBufferObject), slots, properties.limits.minUniformBufferOffsetAlignment);
+	updateUniformBuffer();
 }
 
 // allocate the descriptors. - pool to allocate from, how many to allocate, and the layout to base them on
@@ -1236,9 +1445,9 @@ void Renderer::createDescriptorSet()
 	// auto freed when pool is destroyed.
 	// configure which buffer and region of buffer
 	VkDescriptorBufferInfo bufferInfo = {};
-	bufferInfo.buffer = uniformBuffer;
+	bufferInfo.buffer = uniforms.handle();
 	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(UniformBufferObject);
+	bufferInfo.range = uniforms.range();
 
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -1274,7 +1483,7 @@ void Renderer::createDescriptorSet()
 	descriptorWrites[0].dstSet = gfxDescriptorSet; // which to update
 	descriptorWrites[0].dstBinding = 0;			// binding (in the shader layout)
 	descriptorWrites[0].dstArrayElement = 0;	// can be arrays so specify index
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;   	// specify type.
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;   	// specify type - offset given at bind
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &bufferInfo;
 
@@ -1295,65 +1504,117 @@ void Renderer::createSemaphores()
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	// 2 semaphores for if the image is ready (from the swapchain) and iuf the render is finished from the command buffer
-	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-		vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS)
+	// signalled, so no frame waits on a draw that never went
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	// per frame in flight - if the image is ready (from the swapchain), if the render is finished from the command buffer, and if the draw is done for the compute
+	frames.resize(framesInFlight);
+	for (auto &frame : frames)
 	{
-		throw std::runtime_error("failed to create semaphores!");
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailable) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.renderFinished) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.drawn) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create semaphores!");
+		}
+
+		if (vkCreateFence(device, &fenceInfo, nullptr, &frame.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to create frame fence!");
 	}
 }
 
 // get image from swapchain, execute command buffer with that image in the framebuffer, return the image to the swap chain for presentation
-void Renderer::drawFrame()
+bool Renderer::drawFrame()
 {
 	// asynchronous calls so need to use semaphores/fences
+	FrameSync& frame = frames[frameNumber % framesInFlight];
+	frame.graphicsQuery = NO_QUERY;
+
+	// 0. the draw framesInFlight frames back has to be done with the frame's semaphores, and with every command
+	// buffer and ubo slot this slot uses - a real wait only once the cpu has got that far ahead of the gpu
+	if (vkWaitForFences(device, 1, &frame.fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS)
+		throw std::runtime_error("device crashed");
 
-	// 1.  get image from swapchain
-	uint32_t imageIndex;
+	// 1.  get image from swapchain - headless always draws into the one offscreen image
+	uint32_t imageIndex = 0;
+	VkResult result = VK_SUCCESS;
 	// logical device, swapchain, timeout (max here), signaled when engine is finished using the image, output when it's become available.
-	VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	if (!headless)
+		result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR)
 	{
 		recreateSwapChain();
-		return;
+		passSemaphores(frame);
+		return false;
 	}
 	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 		throw std::runtime_error("failed to acquire swap chain image!");
 
+	// only reset once it is certain to be submitted with
+	vkResetFences(device, 1, &frame.fence);
+
 	// 2. Submitting the command buffer
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	// wait for if the image is avalible from the swapchain and stored in imageIndex
-	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore };
-
 	// Wait at the colour stage of the pipeline - theoretically can implement the vertex shader whilst the image is not ready
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
+	VkSemaphore waitSemaphores[2];
+	VkPipelineStageFlags waitStages[2];
+	uint32_t waitCount = 0;
+
+	if (!headless)
+	{
+		waitSemaphores[waitCount] = frame.imageAvailable;
+		waitStages[waitCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	}
+
+	// and for compute to have finished with the instances, where the mode asked for it
+	if (drawWait != VK_NULL_HANDLE)
+	{
+		waitSemaphores[waitCount] = drawWait;
+		waitStages[waitCount++] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	}
+
+	submitInfo.waitSemaphoreCount = waitCount;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	// which command buffers to submit for exe - the one that binds the swap chain image we aquired as a colour attachment
 	submitInfo.commandBufferCount = 1;
 
-	if (chosenSimMode == DOUBLE)
-	{
-		submitInfo.pCommandBuffers = &graphicsCmdBuffers[dynamic_cast<double_simulation*>(sim)->bufferIndex];
-	}
-	else
-	{
-		submitInfo.pCommandBuffers = &graphicsCmdBuffers[imageIndex];
-	}
+	// the slot's set, with the one for this image - last submitted at least framesInFlight frames back, so the fence
+	// wait above covers it and its ubo slot
+	uint32_t commandIndex = frameSlot() * static_cast<uint32_t>(swapChainImages.size()) + imageIndex;
+	submitInfo.pCommandBuffers = &graphicsCmdBuffers[commandIndex];
+	uniforms.write(commandIndex, &graphicsUBO);
+
+	// which semaphores to signal once the command buffers have finished execution. nothing to present headless
+	VkSemaphore signalSemaphores[2];
+	uint32_t signalCount = 0;
+
+	if (!headless)
+		signalSemaphores[signalCount++] = frame.renderFinished;
 
-	// which semaphores to signal once the command buffers have finished execution.
-	VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
-	submitInfo.signalSemaphoreCount = 1;
+	if (signalDrawn)
+		signalSemaphores[signalCount++] = frame.drawn;
+
+	submitInfo.signalSemaphoreCount = signalCount;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	// submit to queue with signal info. // last param is a fence but we're using semaphores
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, graphicsFence) != VK_SUCCESS)
+	// submit to queue with signal info, the fence lets the frame framesInFlight on reuse all of this
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frame.fence) != VK_SUCCESS)
 		throw std::runtime_error("failed to submit draw command buffer!");
+
+	drawWait = VK_NULL_HANDLE;
+	signalDrawn = false;
+	frame.graphicsQuery = graphicsQuery(commandIndex);
+
+	if (headless)
+		return true;
 	
 
 	// should return true when render is finished
@@ -1364,7 +1625,7 @@ void Renderer::drawFrame()
 
 	// wait for the render to have finished before starting
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
+	presentInfo.pWaitSemaphores = &frame.renderFinished;
 
 	// specify which swapchain to present the image to
 	VkSwapchainKHR swapChains[] = { swapChain };
@@ -1386,10 +1647,42 @@ void Renderer::drawFrame()
 		throw std::runtime_error("failed to present swap chain image!");
 	}
 
+	return true;
 }
 
 
 
+void Renderer::passSemaphores(FrameSync& frame)
+{
+	if (drawWait == VK_NULL_HANDLE && !signalDrawn)
+		return;
+
+	// an empty batch stands in for the draw, so the chain through it carries on - its signal still follows every
+	// draw before it. the frame's fence was never reset, so stays signalled
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+	if (drawWait != VK_NULL_HANDLE)
+	{
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &drawWait;
+		submitInfo.pWaitDstStageMask = &waitStage;
+	}
+
+	if (signalDrawn)
+	{
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &frame.drawn;
+	}
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit skipped draw!");
+
+	drawWait = VK_NULL_HANDLE;
+	signalDrawn = false;
+}
+
 void Renderer::createTextureImage()
 {
 	int texWidth, texHeight, texChannels;
@@ -1398,27 +1691,12 @@ void Renderer::createTextureImage()
 
 	if (!pixels)
 		throw std::runtime_error("failed to load texture image!");
-	
-	// buffer to copy pixels
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(device, stagingBufferMemory);
-	stbi_image_free(pixels);
 
 	createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
 
-	transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-	transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	// staged and copied with the buffer objects, shader read only by the time createConfig waits on them
+	uploads.uploadImage(textureImage, pixels, imageSize, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+	stbi_image_free(pixels);
 
 	// create Normal Map
 	if (lighting)
@@ -1430,26 +1708,10 @@ void Renderer::createTextureImage()
 		if (!pixels)
 			throw std::runtime_error("failed to load texture image!");
 
-		// buffer to copy pixels
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-		void* data;
-		vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, static_cast<size_t>(imageSize));
-		vkUnmapMemory(device, stagingBufferMemory);
-		stbi_image_free(pixels);
-
 		createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage_Normal, textureImageMemory_Normal);
 
-		transitionImageLayout(textureImage_Normal, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		copyBufferToImage(stagingBuffer, textureImage_Normal, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-		transitionImageLayout(textureImage_Normal, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
+		uploads.uploadImage(textureImage_Normal, pixels, imageSize, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+		stbi_image_free(pixels);
 	}
 }
 
@@ -1512,7 +1774,7 @@ VkImageView Renderer::createImageView(VkImage image, VkFormat format, VkImageAsp
 	return imageView;
 }
 
-void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory)
 {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1536,16 +1798,17 @@ void Renderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkI
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+	// optimal tiling keeps to the image blocks, linear images are laid out like buffers
+	imageMemory = allocator.allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL);
 
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
+	vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
+}
 
-	vkBindImageMemory(device, image, imageMemory, 0);
+void Renderer::destroyImage(VkImage& image, Allocation& imageMemory)
+{
+	vkDestroyImage(device, image, nullptr);
+	allocator.free(imageMemory);
+	image = VK_NULL_HANDLE;
 }
 
 void Renderer::updateUniformBuffer()
@@ -1555,15 +1818,10 @@ void Renderer::updateUniformBuffer()
 	auto currentTime = std::chrono::high_resolution_clock::now();
 	float time = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
 
-	UniformBufferObject ubo = {}; 
+	UniformBufferObject& ubo = graphicsUBO;
 	ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	ubo.view = glm::lookAt(glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10000.0f);
-
-	void* data;  
-	vkMapMemory(device, uniformBufferMemory, 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(device, uniformBufferMemory);
 }
 
 // wrapper to pass the shader code to the pipeline
@@ -1623,10 +1881,11 @@ std::vector<const char*> Renderer::getExtensions()
 {
 	std::vector<const char*> extensions;
 
-	// find extensions
+	// find extensions - a headless instance needs no surface ones
 	unsigned int glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	const char** glfwExtensions = nullptr;
+	if (!headless)
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
 	for (unsigned int i = 0; i < glfwExtensionCount; i++)
 	{
@@ -1671,12 +1930,16 @@ bool Renderer::isDeviceSuitable(VkPhysicalDevice device, const bool AMD)
 		}
 	}
 
-	// is this a discrete gpu and does it have geom capabilities 
-	bool physical = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
+	// is this a discrete gpu and does it have geom capabilities. headless takes any type, pickPhysicalDevice prefers discrete
+	bool physical = (headless || deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) &&
 		deviceFeatures.geometryShader;
 
 	QueueFamilyIndices indices = findQueuesFamilies(device);
 
+	// nothing to present to without a window
+	if (headless)
+		return physical && indices.isComplete() && deviceFeatures.samplerAnisotropy;
+
 	bool extensionsSupported = checkDeviceExtensionSupport(device);
 
 	bool swapChainAdequate = false;
@@ -1685,7 +1948,6 @@ bool Renderer::isDeviceSuitable(VkPhysicalDevice device, const bool AMD)
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
 
-	timestampPeriod = deviceProperties.limits.timestampPeriod;
 	return physical && indices.isComplete() && extensionsSupported && swapChainAdequate && deviceFeatures.samplerAnisotropy;
 }
 
@@ -1711,24 +1973,6 @@ bool Renderer::checkDeviceExtensionSupport(VkPhysicalDevice device)
 }  
 
 
-// query info
-uint32_t Renderer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-	// query info about the avaliable types of memory
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-	// check and return index if desired properties are found.
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-	{
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-		{
-			return i;
-		}
-	}
-
-	throw std::runtime_error("Failed to fins suitable memory type!");
-}
 
 VKAPI_ATTR VkBool32 VKAPI_CALL Renderer::debugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t obj, size_t location, int32_t code, const char * layerPrefix, const char * msg, void * userData)
 {
@@ -1794,9 +2038,12 @@ QueueFamilyIndices Renderer::findQueuesFamilies(VkPhysicalDevice device)
 			if (queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)
 				indices.computeFamily = i;
 
-			// check for presentation support to window
+			// check for presentation support to window. headless frames are never presented, the graphics family stands in
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			if (headless)
+				presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			else
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 			if (presentSupport)
 				indices.presentFamily = i;
 
@@ -1809,9 +2056,57 @@ QueueFamilyIndices Renderer::findQueuesFamilies(VkPhysicalDevice device)
 		i++;
 	}
 
+	// a single queue graphics family (software devices) shares that queue with compute
+	if (indices.computeFamily < 0 && indices.graphicsFamily >= 0 && queueFamilies[indices.graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT)
+		indices.computeFamily = indices.graphicsFamily;
+
+	// uploads want the copy engine's own family (transfer only), so they run beside graphics and compute
+	for (i = 0; i < queueFamilyCount; i++)
+	{
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+		if (queueFamilies[i].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.transferFamily = i;
+			break;
+		}
+	}
+
+	if (indices.transferFamily < 0)
+		indices.transferFamily = indices.graphicsFamily;
+
 	return indices;
 }
  
+int Renderer::findTransferQueueFamily(VkPhysicalDevice pd)
+{
+	// find and return the index of transfer queue family for device
+
+	int index = -1;
+
+	// as before, find them, set them
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, queueFamilies.data());
+
+	// find suitable family that supports transfer.
+	unsigned int i = 0;
+	for (const auto& queueFamily : queueFamilies)
+	{
+
+		// check for Transfer support 
+		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT)
+		{
+			index = i;
+			break;
+		}
+		i++;
+	}
+
+	return index;
+}
+
 // check swapchain support for surface format, presentation mode, swap extent.
 SwapChainSupportDetails Renderer::querySwapChainSupport(VkPhysicalDevice device) {
 	SwapChainSupportDetails details;
@@ -1919,6 +2214,56 @@ void Renderer::setVertexData(const std::vector<Vertex> vert, const std::vector<u
 
 }
 
+void Renderer::resume(const std::vector<uint32_t>& ids, uint64_t step, double time)
+{
+	dynamic_cast<InstanceBO*>(sim->buffers[INSTANCE])->ids = ids;
+	frameCounter = static_cast<uint32_t>(step);
+	simulatedTime = time;
+}
+
+void Renderer::saveSnapshot()
+{
+	vkDeviceWaitIdle(device);
+
+	auto instances = dynamic_cast<InstanceBO*>(sim->buffers[INSTANCE]);
+	writeSnapshot(simulationParameters->snapshotPath, instances->readBack(sim->resultBuffer()), instances->ids,
+		frameCounter, simulatedTime, compute->ubo.deltaT * compute->substeps, simulationParameters->compressionError);
+
+	std::cout << "Snapshot at frame " << frameCounter << " written to " << simulationParameters->snapshotPath << std::endl;
+}
+
+void Renderer::createTrajectory()
+{
+	if (simulationParameters->trajectoryPath.empty())
+		return;
+
+	// same family the transfer mode copies on
+	int family = findTransferQueueFamily(physicalDevice);
+	VkQueue transferQueue;
+	vkGetDeviceQueue(device, family, 0, &transferQueue);
+
+	trajectory.reset(new TrajectoryStream(device, transferQueue, family, simulationParameters->trajectoryPath,
+		PARTICLE_COUNT, simulationParameters->trajectoryInterval, simulationParameters->compressionError));
+	trajectory->setOrder(dynamic_cast<InstanceBO*>(sim->buffers[INSTANCE])->ids);
+
+	compute->readbackReady = trajectory->readySemaphore();
+	compute->readbackDone = trajectory->doneSemaphore();
+}
+
+void Renderer::finishTrajectory()
+{
+	if (!trajectory)
+		return;
+
+	vkDeviceWaitIdle(device);
+	trajectory->finish();
+	trajectory.reset();
+
+	compute->readbackReady = VK_NULL_HANDLE;
+	compute->readbackDone = VK_NULL_HANDLE;
+	compute->signalReadback = compute->waitReadback = false;
+}
+
 void Renderer::createComputeUBO()
 {
 	compute->ubo.particleCount = PARTICLE_COUNT;
@@ -1926,15 +2271,38 @@ void Renderer::createComputeUBO()
 	compute->ubo.destX = 0.5f;
 	compute->ubo.destY = 0.0f;
 
-	VkDeviceSize bufferSize = sizeof(ComputeConfig::computeUBO);
-	createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		compute->uniformBuffer, compute->uboMem);  // buffer pointer and memory
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	compute->uniforms.create(sizeof(ComputeConfig::computeUBO), frameSlots, properties.limits.minUniformBufferOffsetAlignment);
+	for (uint32_t slot = 0; slot < compute->uniforms.slots(); slot++)
+		compute->writeUniforms(slot);
 }
 
 void Renderer::prepareCompute()
 {
 	createComputeUBO();
 
+	compute->leapfrog = simulationParameters->integrator == LEAPFROG;
+	compute->substeps = std::max(1u, simulationParameters->substeps);
+
+	// leapfrog reads from set 0 and writes to set 1 in every mode, they're just the same buffer outside double buffering
+	compute->setCount = (chosenSimMode == DOUBLE || compute->leapfrog) ? 2 : 1;
+
+	if (compute->leapfrog)
+	{
+		// transfers both ways for the morton re-sort
+		createBuffer(sizeof(glm::vec4) * PARTICLE_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, compute->accelerationBuffer, compute->accelerationMem);
+	}
+
+	// somewhere for double buffered euler substeps to write that isn't the buffer they read
+	if (chosenSimMode == DOUBLE && !compute->leapfrog && compute->substeps > 1)
+	{
+		createBuffer(sizeof(particle) * PARTICLE_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			compute->scratchBuffer, compute->scratchMem);
+	}
+
 	// create compute pipeline
 	// Compute pipelines are created separate from graphics pipelines even if they use the same queue (family index)
 
@@ -1945,7 +2313,7 @@ void Renderer::prepareCompute()
 	positionBinding.descriptorCount = 1;
 
 	VkDescriptorSetLayoutBinding uniformBinding{};
-	uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uniformBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uniformBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 	uniformBinding.binding = 1;
 	uniformBinding.descriptorCount = 1;
@@ -1957,6 +2325,17 @@ void Renderer::prepareCompute()
 	// Binding 1 : Uniform buffer
 	setLayoutBindings.push_back(uniformBinding);
 
+	// Binding 2 : Leapfrog accelerations
+	if (compute->leapfrog)
+	{
+		VkDescriptorSetLayoutBinding accelerationBinding{};
+		accelerationBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		accelerationBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		accelerationBinding.binding = 2;
+		accelerationBinding.descriptorCount = 1;
+		setLayoutBindings.push_back(accelerationBinding);
+	}
+
 
 	// decsriptor layout create info
 	VkDescriptorSetLayoutCreateInfo descriptorLayout{};
@@ -1972,14 +2351,22 @@ void Renderer::prepareCompute()
 	
 	setlayouts.push_back(compute->descriptorSetLayout); // use same layout for both descriptor sets
 	
-	if (chosenSimMode == DOUBLE)
+	if (compute->setCount == 2)
 		setlayouts.push_back(compute->descriptorSetLayout);
 
+	// leapfrog stage (drift or kick)
+	VkPushConstantRange stageRange{};
+	stageRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	stageRange.offset = 0;
+	stageRange.size = sizeof(uint32_t);
+
 	// create pipeline layout 
 	VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = setlayouts.size();
 	pipelineLayoutCreateInfo.pSetLayouts = setlayouts.data();
+	pipelineLayoutCreateInfo.pushConstantRangeCount = compute->leapfrog ? 1 : 0;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &stageRange;
 
 	if(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &compute->pipelineLayout) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create compute pipeline");
@@ -1991,23 +2378,82 @@ void Renderer::prepareCompute()
 
 	// if double load double 
 
-	std::string fileName = "res/shaders/";
+	std::string shaderName = "comp.spv";
 
-	if (chosenSimMode == DOUBLE)
-		fileName += "d";
+	if (compute->leapfrog)
+		shaderName = "l" + shaderName;
+	else if (chosenSimMode == DOUBLE)
+		shaderName = "d" + shaderName;
 
 	// create shader module
-	auto computeShaderCode = readFile(fileName + "comp.spv");
+	auto computeShaderCode = readFile("res/shaders/" + shaderName);
 
 	// modules only needed in creation of pipeline so can be destroyed locally
 	VkShaderModule computeShaderMod = createShaderModule(computeShaderCode);
 
+	// size the workgroup and shared memory tile, keeping inside what the device supports
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	uint32_t maxGroupSize = std::min(deviceProperties.limits.maxComputeWorkGroupSize[0], deviceProperties.limits.maxComputeWorkGroupInvocations);
+	uint32_t maxTileSize = deviceProperties.limits.maxComputeSharedMemorySize / sizeof(glm::vec4);
+
+	compute->workGroupSize = std::max(1u, std::min(simulationParameters->workGroupSize, maxGroupSize));
+	compute->sharedDataSize = std::min(compute->workGroupSize, maxTileSize);
+
+	// benchmark the candidate sizes (or load the last result for this device)
+	if (simulationParameters->autotune)
+		tuneCompute(computeShaderMod, shaderName);
+
+	compute->pipeline = createComputePipeline(computeShaderMod, compute->workGroupSize, compute->sharedDataSize);
+
+	// Create a command buffer for compute operations
+	sim->allocateComputeCommandBuffers();
+
+	vkDestroyShaderModule(device, computeShaderMod, nullptr);
+
+	if (compute->leapfrog)
+		primeLeapfrog();
+
+	// compute mode dispatches its first frame before updateCompute, and tuning and priming leave a zero step
+	// behind - so start on the step updateCompute gives, a fixed one split over the substeps
+	float firstStep = simulationParameters->fixedDeltaT > 0.0f ? simulationParameters->fixedDeltaT : 0.016f;
+	compute->ubo.deltaT = firstStep / static_cast<float>(compute->substeps);
+
+	// Build a single command buffer containing the compute dispatch commands
+	sim->recordComputeCommands();
+}
+
+VkPipeline Renderer::createComputePipeline(VkShaderModule shader, uint32_t workGroupSize, uint32_t sharedDataSize)
+{
+	// specialisation constants - 0 is the tile size, 4 is local_size_x
+	struct SpecialisationData
+	{
+		int32_t sharedDataSize;
+		uint32_t workGroupSize;
+	} specData = { static_cast<int32_t>(sharedDataSize), workGroupSize };
+
+	std::array<VkSpecializationMapEntry, 2> specEntries = {};
+	specEntries[0].constantID = 0;
+	specEntries[0].offset = offsetof(SpecialisationData, sharedDataSize);
+	specEntries[0].size = sizeof(int32_t);
+	specEntries[1].constantID = 4;
+	specEntries[1].offset = offsetof(SpecialisationData, workGroupSize);
+	specEntries[1].size = sizeof(uint32_t);
+
+	VkSpecializationInfo specInfo = {};
+	specInfo.mapEntryCount = static_cast<uint32_t>(specEntries.size());
+	specInfo.pMapEntries = specEntries.data();
+	specInfo.dataSize = sizeof(specData);
+	specInfo.pData = &specData;
+
 	// assign the shaders
 	VkPipelineShaderStageCreateInfo compShaderStageInfo = {};
 	compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-	compShaderStageInfo.module = computeShaderMod;
+	compShaderStageInfo.module = shader;
 	compShaderStageInfo.pName = "main";		// function to invoke
+	compShaderStageInfo.pSpecializationInfo = &specInfo;
 
 
 	// create info for pipeline setting shader
@@ -2018,16 +2464,214 @@ void Renderer::prepareCompute()
 	computePipelineCreateInfo.stage = compShaderStageInfo;
 	
 	// create it
-	if(vkCreateComputePipelines(device, pipeCache, 1, &computePipelineCreateInfo, nullptr, &compute->pipeline) != VK_SUCCESS)
+	VkPipeline pipeline;
+	if(vkCreateComputePipelines(device, pipeCache, 1, &computePipelineCreateInfo, nullptr, &pipeline) != VK_SUCCESS)
 		throw std::runtime_error("failed creating compute pipeline");
 
-	// Create a command buffer for compute operations
-	sim->allocateComputeCommandBuffers();
+	return pipeline;
+}
 
-	vkDestroyShaderModule(device, computeShaderMod, nullptr);
+void Renderer::tuneCompute(VkShaderModule shader, const std::string& shaderName)
+{
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+	uint32_t maxGroupSize = std::min(deviceProperties.limits.maxComputeWorkGroupSize[0], deviceProperties.limits.maxComputeWorkGroupInvocations);
+	uint32_t maxTileSize = deviceProperties.limits.maxComputeSharedMemorySize / sizeof(glm::vec4);
+
+	TuneKey key = {};
+	key.shader = shaderName;
+	key.vendorID = deviceProperties.vendorID;
+	key.deviceID = deviceProperties.deviceID;
+	key.driverVersion = deviceProperties.driverVersion;
+	key.particleBucket = TuneCache::particleBucket(PARTICLE_COUNT);
+
+	// already tuned this shader, device, driver and particle count. an edited cache file can still hold sizes
+	// the device can't run, so those are tuned again rather than trusted
+	TuneCache cache(TUNE_CACHE_FILE);
+	TuneResult best = {};
+	if (cache.find(key, best))
+	{
+		if (best.workGroupSize != 0 && best.workGroupSize <= maxGroupSize && best.sharedDataSize != 0 && best.sharedDataSize <= maxTileSize)
+		{
+			compute->workGroupSize = best.workGroupSize;
+			compute->sharedDataSize = best.sharedDataSize;
+			std::cout << "Autotune (cached): workgroup " << best.workGroupSize << ", tile " << best.sharedDataSize << std::endl;
+			return;
+		}
 
-	// Build a single command buffer containing the compute dispatch commands
-	sim->recordComputeCommands();
+		std::cout << "Autotune: cached workgroup " << best.workGroupSize << ", tile " << best.sharedDataSize << " is outside the device limits, tuning again" << std::endl;
+		best = {};
+	}
+
+	// a zero time step leaves every particle where it is, so the benchmark doesn't disturb the start state
+	compute->ubo.deltaT = 0.0f;
+	compute->ubo.particleCount = PARTICLE_COUNT;
+	compute->writeUniforms(0);
+
+	// one command buffer and fence reused for every candidate
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocateInfo.commandPool = compute->commandPool;
+	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer cmdBuffer;
+	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmdBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed allocating buffer for autotune commands");
+
+	VkFenceCreateInfo fenceCreateInfo{};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS)
+		throw std::runtime_error("Failed creating autotune fence");
+
+	std::vector<VkDescriptorSet> descSets = standaloneSets();
+	std::vector<uint32_t> offsets(descSets.size(), compute->uniforms.offset(0));
+	uint32_t stage = KICK;
+
+	double bestTime = std::numeric_limits<double>::max();
+
+	for (uint32_t groupSize : TUNE_GROUP_SIZES)
+	{
+		if (groupSize > maxGroupSize)
+			continue;
+
+		for (uint32_t tileScale : TUNE_TILE_SCALES)
+		{
+			uint32_t tileSize = groupSize * tileScale;
+			if (tileSize > maxTileSize)
+				continue;
+
+			VkPipeline pipeline = createComputePipeline(shader, groupSize, tileSize);
+
+			VkCommandBufferBeginInfo cmdBufInfo{};
+			cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+			vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo);
+			vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+			vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipelineLayout, 0, static_cast<uint32_t>(descSets.size()), descSets.data(),
+				static_cast<uint32_t>(offsets.size()), offsets.data());
+
+			// leapfrog times its force pass - the drift is a trivial per particle update
+			if (compute->leapfrog)
+				vkCmdPushConstants(cmdBuffer, compute->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(stage), &stage);
+
+			vkCmdResetQueryPool(cmdBuffer, computeQueryPool, 0, 2);
+			vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, computeQueryPool, 0);
+			vkCmdDispatch(cmdBuffer, (PARTICLE_COUNT + groupSize - 1) / groupSize, 1, 1);
+			vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, computeQueryPool, 1);
+			vkEndCommandBuffer(cmdBuffer);
+
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &cmdBuffer;
+
+			// keep the quickest run - the first one also pays for warming up
+			double candidateTime = std::numeric_limits<double>::max();
+			for (int run = 0; run < TUNE_RUNS; run++)
+			{
+				if (vkQueueSubmit(compute->queue, 1, &submitInfo, fence) != VK_SUCCESS)
+					throw std::runtime_error("failed to submit autotune dispatch");
+
+				vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+				vkResetFences(device, 1, &fence);
+
+				std::uint64_t stamps[2] = {};
+				vkGetQueryPoolResults(device, computeQueryPool, 0, 2, sizeof(stamps), stamps, sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+				candidateTime = std::min(candidateTime, (stamps[1] - stamps[0]) * timestampPeriod / 1000000.0);
+			}
+
+			std::cout << "Autotune: workgroup " << groupSize << ", tile " << tileSize << " - " << candidateTime << "ms" << std::endl;
+
+			if (candidateTime < bestTime)
+			{
+				bestTime = candidateTime;
+				best.workGroupSize = groupSize;
+				best.sharedDataSize = tileSize;
+			}
+
+			vkDestroyPipeline(device, pipeline, nullptr);
+		}
+	}
+
+	vkDestroyFence(device, fence, nullptr);
+	vkFreeCommandBuffers(device, compute->commandPool, 1, &cmdBuffer);
+
+	// nothing fitted the limits so keep the defaults
+	if (best.workGroupSize == 0)
+		return;
+
+	compute->workGroupSize = best.workGroupSize;
+	compute->sharedDataSize = best.sharedDataSize;
+	std::cout << "Autotune: using workgroup " << best.workGroupSize << ", tile " << best.sharedDataSize << std::endl;
+
+	cache.store(key, best);
+}
+
+std::vector<VkDescriptorSet> Renderer::standaloneSets() const
+{
+	// the double buffered shaders read set 0 and write set 1, leapfrog outside double buffering reads and writes the one buffer
+	if (chosenSimMode == DOUBLE)
+	{
+		auto comp = static_cast<Async*>(compute);
+		return { comp->descriptorSet[1], comp->descriptorSet[0] };
+	}
+
+	if (compute->setCount == 2)
+		return { compute->descriptorSet, compute->descriptorSet };
+
+	return { compute->descriptorSet };
+}
+
+void Renderer::primeLeapfrog()
+{
+	// zero length step - the kick writes the accelerations and adds nothing to the velocities
+	compute->ubo.deltaT = 0.0f;
+	compute->ubo.particleCount = PARTICLE_COUNT;
+	compute->writeUniforms(0);
+
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocateInfo.commandPool = compute->commandPool;
+	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer cmdBuffer;
+	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmdBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed allocating buffer for leapfrog start");
+
+	VkCommandBufferBeginInfo cmdBufInfo{};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	// the kick works on set 1, which in double buffering is the buffer the first frame reads
+	std::vector<VkDescriptorSet> descSets = standaloneSets();
+	descSets[1] = descSets[0];
+	std::vector<uint32_t> offsets(descSets.size(), compute->uniforms.offset(0));
+	uint32_t stage = KICK;
+
+	vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo);
+	vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipeline);
+	vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipelineLayout, 0, static_cast<uint32_t>(descSets.size()), descSets.data(),
+		static_cast<uint32_t>(offsets.size()), offsets.data());
+	vkCmdPushConstants(cmdBuffer, compute->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(stage), &stage);
+	vkCmdDispatch(cmdBuffer, compute->groupCount(PARTICLE_COUNT), 1, 1);
+	vkEndCommandBuffer(cmdBuffer);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuffer;
+
+	if (vkQueueSubmit(compute->queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit leapfrog start");
+
+	vkQueueWaitIdle(compute->queue);
+	vkFreeCommandBuffers(device, compute->commandPool, 1, &cmdBuffer);
 }
 
 void Renderer::updateCompute()
@@ -2037,16 +2681,17 @@ void Renderer::updateCompute()
 	float frameTime = std::chrono::duration_cast<std::chrono::milliseconds>(newTime - currentTime).count(); 
 	currentTime = newTime;  
 	 
-	compute->ubo.deltaT = (frameTimer);
+	// the frame's time (fixed, or as long as the last frame took) is split evenly over the substeps recorded in the command buffer
+	float frameStep = simulationParameters->fixedDeltaT > 0.0f ? simulationParameters->fixedDeltaT : frameTimer;
+	compute->ubo.deltaT = frameStep / static_cast<float>(compute->substeps);
 	compute->ubo.destX = 0.75f; 
 	compute->ubo.destY = 0.0f;
-	vkMapMemory(device, compute->uboMem, 0, sizeof(compute->ubo), 0, &compute->mapped);
-	memcpy(compute->mapped, &compute->ubo, sizeof(compute->ubo));
-	vkUnmapMemory(device, compute->uboMem);
- 
+
+	// the simulation copies it into the ubo slot of the command buffer it submits next
 }
 
-void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory,
+	ALLOCATION_STRATEGY strategy)
 {
 	// create struct as usual
 	VkBufferCreateInfo bufferInfo = {};
@@ -2070,18 +2715,18 @@ void Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemor
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-	// determine memory type to allocate 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	// allocate memory
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-		throw std::runtime_error("Failed to allocate buffer memory");
+	// a piece of one of the allocator's blocks, of a memory type with the properties asked for
+	bufferMemory = allocator.allocate(memRequirements, properties, false, strategy);
 
 	// bind memory to the buffer (int is offset)
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);
+	vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
+}
+
+void Renderer::destroyBuffer(VkBuffer& buffer, Allocation& bufferMemory)
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator.free(bufferMemory);
+	buffer = VK_NULL_HANDLE;
 }
 
 VkCommandBuffer Renderer::beginSingleTimeCommands()
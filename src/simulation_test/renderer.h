@@ -18,6 +18,12 @@
 #include <chrono>
 #include "simulation.h"
 #include "compute.h"
+#include "autotune.h"
+#include "trajectory.h"
+#include "pipeline-cache.h"
+#include "allocator.h"
+#include "uniform-ring.h"
+#include "upload-manager.h"
 
 using namespace std::chrono;
 
@@ -35,6 +41,9 @@ const std::vector<const char*> validationLayers = {
 	"VK_LAYER_LUNARG_standard_validation"
 };
 
+// most frames the cpu may record ahead of the gpu
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
 const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
@@ -61,11 +70,15 @@ static std::vector<char> readFile(const std::string& filename)
 	return buffer;
 }
 
+// check before overwriting a results file
+bool does_file_exist(std::string fileName);
+
 // struct for queues
 struct QueueFamilyIndices {
 	int graphicsFamily = -1;
 	int presentFamily = -1;
 	int computeFamily = -1;
+	int transferFamily = -1;		// transfer only if there is one, otherwise the graphics family
 
 	// check if families are complete. gfx compute present
 	bool isComplete() {
@@ -96,37 +109,64 @@ private:
 	VkDevice device;
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	VkQueue uploadQueue;		// the upload manager's, on queueFamilyIndices.transfer
 	VkSurfaceKHR surface;
 	VkSwapchainKHR swapChain;
 	VkFormat swapChainImageFormat;
 	VkDescriptorSetLayout descriptorSetLayout;
-	VkSemaphore imageAvailableSemaphore;
-	VkSemaphore renderFinishedSemaphore;
+
+	// sync for one frame in flight - drawFrame waits on its fence before reusing any of it
+	struct FrameSync
+	{
+		VkSemaphore imageAvailable = VK_NULL_HANDLE;
+		VkSemaphore renderFinished = VK_NULL_HANDLE;
+		VkSemaphore drawn = VK_NULL_HANDLE;		// signalled by the draw when signalDrawn is set
+		VkFence fence = VK_NULL_HANDLE;			// the draw's, created signalled
+
+		// what the frame submitted, for its row of the results once the gpu is done with it
+		uint32_t number = 0;
+		double frameTime = 0.0;
+		uint32_t graphicsQuery = NO_QUERY;
+		uint32_t computeQuery = NO_QUERY;
+	};
+	std::vector<FrameSync> frames;
 
 	time_point<system_clock> currentTime;
-	VkPipelineCache pipeCache;
+
+	// every pipeline is built through pipeCache, loaded from and saved to pipelineCache's file
+	VkPipelineCache pipeCache = VK_NULL_HANDLE;
+	std::unique_ptr<PipelineCache> pipelineCache;
+	void createPipelineCache();
+
+	// every buffer and image is placed in memory from here
+	DeviceAllocator allocator;
+	void reportMemory();
 
 	const parameters* simulationParameters;
 
 	void createComputeUBO();
 
-	VkBuffer uniformBuffer;
-	VkDeviceMemory uniformBufferMemory;
+	// updateUniformBuffer fills this in, drawFrame copies it to the slot of the command buffer it submits
+	UniformBufferObject graphicsUBO;
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	Allocation textureImageMemory;
 	VkImageView textureImageView;
 	VkSampler textureSampler;
 	VkImage textureImage_Normal;
-	VkDeviceMemory textureImageMemory_Normal;
+	Allocation textureImageMemory_Normal;
 	VkImageView textureImageView_Normal;
 	VkSampler textureSampler_Normal;
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	Allocation depthImageMemory;
 	VkImageView depthImageView;
 
 	std::vector<VkImage> swapChainImages;
 	std::vector<VkImageView> swapChainImageViews;
 
+	// no window, surface or swapchain - swapChainImages are offscreen images backed by offscreenMemory
+	bool headless = false;
+	std::vector<Allocation> offscreenMemory;
+
 	void initWindow();
 	void initVulkan(const MODE chosenMode, const bool AMD);
 
@@ -152,6 +192,7 @@ private:
 	void pickPhysicalDevice(const bool AMD);
 	void createLogicalDevice();
 	void createSwapChain();
+	void createOffscreenTargets();
 	void createImageViews();
 	void createRenderPass();
 	void createDescriptorSetLayout();
@@ -162,9 +203,9 @@ private:
 
 	// texture stuff
 	void createTextureImage();
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory);
+	void destroyImage(VkImage& image, Allocation& imageMemory);
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 	void createTextureImageView();
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
 	void createTextureSampler();
@@ -180,9 +221,10 @@ private:
 	void createDescriptorSet();
 	void createSemaphores();
 
-	// for timestamps
+	// for timestamps - a pair per graphics command buffer and per compute slot
 	void createQueryPools();
 	double timestampPeriod;
+	uint32_t renderQueryPairs = 1;
 
 	// checks
 	bool checkValidationLayerSupport();
@@ -192,8 +234,6 @@ private:
 	bool isDeviceSuitable(VkPhysicalDevice device, const bool AMD);
 	bool hasStencilComponent(VkFormat format);
 
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
 	// find queues
 	QueueFamilyIndices findQueuesFamilies(VkPhysicalDevice device);
 
@@ -230,13 +270,43 @@ private:
 	const int HEIGHT = 600;
 
 	void prepareCompute();
+	VkPipeline createComputePipeline(VkShaderModule shader, uint32_t workGroupSize, uint32_t sharedDataSize);
+
+	// benchmark workgroup/tile sizes and keep the fastest, cached per shader
+	void tuneCompute(VkShaderModule shader, const std::string& shaderName);
+
+	// one zero length force pass so the first leapfrog drift has the starting accelerations
+	void primeLeapfrog();
+
+	// descriptor sets for a one-off dispatch outside the recorded command buffers
+	std::vector<VkDescriptorSet> standaloneSets() const;
 
 	// timer vars
-	uint32_t frameCounter, lastFPS;
+	uint32_t frameCounter = 0, lastFPS = 0;
 	float frameTimer = 0;
 	float fpsTimer = 0;
 
 	int secondsRan = 0;
+	double simulatedTime = 0.0;
+
+	// a results row for a frame the gpu has finished - waits on its timestamps if it hasn't quite
+	void reportFrame(std::ofstream& file, const FrameSync& frame);
+
+	// rows for the frames still in flight, once the device is idle
+	void reportFramesInFlight(std::ofstream& file);
+
+	// for a draw that didn't go - waits on drawWait and signals the frame's drawn semaphore if asked to
+	void passSemaphores(FrameSync& frame);
+
+	// read the newest results back and write them to the snapshot path. waits for the device
+	void saveSnapshot();
+
+	// positions streamed out every trajectoryInterval frames, null when not asked for
+	std::unique_ptr<TrajectoryStream> trajectory;
+	void createTrajectory();
+
+	// write out the frames still in flight and drop the stream. waits for the device
+	void finishTrajectory();
 
 	bool amdGPU = false;
 
@@ -256,7 +326,8 @@ public:
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
 	VkDescriptorSet gfxDescriptorSet;
-	VkFence graphicsFence;
+	UniformRing uniforms;		// graphics ubo slots - graphics command buffer i binds slot i
+	UploadManager uploads;		// staged copies of startup data, batched on the transfer queue
 	VkDescriptorPool descriptorPool;
 	VkQueryPool renderQueryPool, computeQueryPool;
 
@@ -269,8 +340,9 @@ public:
 		return instance;
 	}
 
-	void init(const MODE chosenMode, const bool AMD)
+	void init(const MODE chosenMode, const bool AMD, const bool offscreen = false)
 	{
+		headless = offscreen;
 		initWindow();
 		initVulkan(chosenMode, AMD);
 	}
@@ -283,21 +355,52 @@ public:
 		uint32_t graphics;
 		uint32_t compute;
 		uint32_t present;
+		uint32_t transfer;
 	} queueFamilyIndices;
 
+	// first queue family that supports transfers
+	int findTransferQueueFamily(VkPhysicalDevice pd);
+
 	void setVertexData(const std::vector<Vertex> vert, const std::vector<uint16_t> ind, const std::vector<particle> part);
+
+	// carry on from a snapshot - after setVertexData, before createConfig
+	void resume(const std::vector<uint32_t>& ids, uint64_t step, double time);
 	void createConfig(const parameters& simParam);
 	int PARTICLE_COUNT = 0;
 
 	// buffer creation & copy functions
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	// short lived buffers (staging) should ask for ALLOCATE_LINEAR. host visible memory comes back mapped
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory,
+		ALLOCATION_STRATEGY strategy = ALLOCATE_BUDDY);
+	void destroyBuffer(VkBuffer& buffer, Allocation& bufferMemory);
 	void copyBuffer(VkBuffer srcBuff, VkBuffer targetBuff, VkDeviceSize size);
 
 	// command queue for recording & submitting copies
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
-	void drawFrame();
+	// frames the cpu may get ahead of the gpu, and the command buffer sets cycled through for them - a multiple
+	// of framesInFlight (double for double buffering with an odd count, so each slot writes the same buffer)
+	uint32_t framesInFlight = 1;
+	uint32_t frameSlots = 1;
+	uint64_t frameNumber = 0;		// frames started, mainLoop moves it on after each
+
+	// compute command buffer and ubo slot of this frame, graphics ones are per slot and image
+	uint32_t frameSlot() const { return static_cast<uint32_t>(frameNumber % frameSlots); }
+	uint32_t graphicsCommandCount() const { return frameSlots * static_cast<uint32_t>(swapChainImages.size()); }
+
+	// first of the timestamp pair graphics command buffer command writes. shared should a recreated swapchain have more images
+	uint32_t graphicsQuery(uint32_t command) const { return 2 * (command % renderQueryPairs); }
+
+	// gpu ordering for modes whose compute works on the buffer the draw reads. drawWait is waited on by the next
+	// draw before it reads the instances, signalDrawn has it signal drawnSemaphore() - each used once, even by a
+	// draw that doesn't go
+	VkSemaphore drawWait = VK_NULL_HANDLE;
+	bool signalDrawn = false;
+	VkSemaphore drawnSemaphore() const { return frames[frameNumber % framesInFlight].drawn; }
+
+	// false if nothing was drawn - the swapchain was out of date and has been recreated
+	bool drawFrame();
 	void updateCompute();
 	void updateUniformBuffer();
 
@@ -0,0 +1,206 @@
+#include "simulation.h"
+#include "renderer.h"
+#include "compute.h"
+#include "threadpool.h"
+#include "initial-conditions.h"
+
+// frames after the one being read that the os is asked to page in
+static const size_t PREFETCH_FRAMES = 8;
+
+// particles per expand task
+static const size_t EXPAND_CHUNK = 1 << 16;
+
+replay_simulation::replay_simulation(const VkQueue* pQ,
+	const VkQueue* gQ,
+	const VkDevice* dev) : simulation(pQ, gQ, dev)
+{
+	// never set up - only the frame time and substeps are read, by the frame loop and the snapshots
+	compute = new ComputeConfig();
+	compute->ubo.deltaT = 0.0f;
+	renderer = Renderer::get();
+}
+
+void replay_simulation::setTrajectory(std::unique_ptr<TrajectoryReader> reader)
+{
+	trajectory = std::move(reader);
+
+	// frame 0 is already in the instance buffer
+	nextFrame = 1 % trajectory->frameCount();
+	shownTime = trajectory->frame(0).time;
+}
+
+void replay_simulation::expand(const float* xyz, size_t count, particle* out)
+{
+	ThreadPool::get()->parallelFor(0, count, EXPAND_CHUNK, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			out[i].pos = glm::vec4(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], PARTICLE_MASS);
+			out[i].vel = glm::vec4(0.0f);
+		}
+	});
+}
+
+void replay_simulation::createCommandPools(QueueFamilyIndices& queueFamilyIndices, VkPhysicalDevice& phys)
+{
+	// draws and uploads both go on the graphics queue
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &renderer->gfxCommandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create gfx command pool!");
+}
+
+void replay_simulation::createBufferObjects()
+{
+	if (!trajectory)
+		throw std::runtime_error("replay has no trajectory");
+
+	for (auto &b : buffers)
+	{
+		b->createSpecificBuffer();
+	}
+
+	VkDeviceSize bufferSize = sizeof(particle) * buffers[INSTANCE]->size;
+
+	for (auto &upload : uploads)
+	{
+		Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			upload.buffer, upload.memory);
+		upload.mapped = static_cast<particle*>(upload.memory.mapped);
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = renderer->gfxCommandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &upload.commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate replay command buffer");
+
+		// free to fill straight away
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		if (vkCreateFence(device, &fenceInfo, nullptr, &upload.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to create replay fence");
+	}
+
+	prepareUpload(uploads[current]);
+}
+
+// nothing to compute - the positions come from the trajectory
+void replay_simulation::allocateComputeCommandBuffers()
+{
+}
+
+void replay_simulation::recordComputeCommands()
+{
+}
+
+void replay_simulation::dispatchCompute()
+{
+}
+
+void replay_simulation::frame()
+{
+	// wait until presentation is finished before drawing the next frame
+	vkQueueWaitIdle(presentQueue);
+
+	submitUpload(uploads[current]);
+	renderer->drawFrame();
+	renderer->updateUniformBuffer();
+
+	// decode the frame after into the other staging buffer while this one is copied and drawn
+	current = 1 - current;
+	prepareUpload(uploads[current]);
+}
+
+void replay_simulation::prepareUpload(Upload& upload)
+{
+	// the copy out of it was submitted the frame before last
+	auto fenceResult = vkWaitForFences(device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+	while (fenceResult != VK_SUCCESS)
+	{
+		if (fenceResult == VK_ERROR_DEVICE_LOST)
+			throw std::runtime_error("device crashed");
+
+		fenceResult = vkWaitForFences(device, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+	}
+
+	const float* positions = trajectory->read(nextFrame);
+	trajectory->prefetch(nextFrame, PREFETCH_FRAMES);
+
+	expand(positions, trajectory->count(), upload.mapped);
+	upload.time = trajectory->frame(nextFrame).time;
+
+	// loop back to the start once the last frame has been shown
+	nextFrame = (nextFrame + 1) % trajectory->frameCount();
+}
+
+void replay_simulation::submitUpload(Upload& upload)
+{
+	vkResetFences(device, 1, &upload.fence);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(upload.commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("replay command buffer failed to start");
+
+	// the upload is timed in place of the compute
+	vkCmdResetQueryPool(upload.commandBuffer, renderer->computeQueryPool, 0, 2);
+	vkCmdWriteTimestamp(upload.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 0);
+
+	// the last frame's draw has to have fetched the instances before they are overwritten
+	vkCmdPipelineBarrier(upload.commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = sizeof(particle) * buffers[INSTANCE]->size;
+	vkCmdCopyBuffer(upload.commandBuffer, upload.buffer, buffers[INSTANCE]->buffer[0], 1, &copyRegion);
+
+	// and this frame's draw has to see the new ones
+	VkBufferMemoryBarrier bufferBarrier = {};
+	bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.buffer = buffers[INSTANCE]->buffer[0];
+	bufferBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(upload.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+		0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+	vkCmdWriteTimestamp(upload.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 1);
+
+	vkEndCommandBuffer(upload.commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &upload.commandBuffer;
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, upload.fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit replay upload");
+	compute->lastQuery = 0;
+
+	// the frame loop adds this to the simulated time, so it follows the recording (and jumps back when it loops)
+	compute->ubo.deltaT = static_cast<float>(upload.time - shownTime);
+	compute->lastDeltaT = compute->ubo.deltaT;
+	shownTime = upload.time;
+}
+
+void replay_simulation::cleanup()
+{
+	for (auto &upload : uploads)
+	{
+		vkDestroyFence(device, upload.fence, nullptr);
+		vkFreeCommandBuffers(device, renderer->gfxCommandPool, 1, &upload.commandBuffer);
+		renderer->destroyBuffer(upload.buffer, upload.memory);
+	}
+
+	trajectory.reset();
+}
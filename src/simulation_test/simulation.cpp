@@ -34,8 +34,8 @@ void simulation::createCommandPools(QueueFamilyIndices& queueFamilyIndices, VkPh
 void simulation::recordGraphicsCommands()
 {
 
-	// resize allocation for frame buffers
-	renderer->graphicsCmdBuffers.resize(renderer->swapChainFramebuffers.size());
+	// one per frame slot and frame buffer - a slot's set isn't touched again until that frame is done
+	renderer->graphicsCmdBuffers.resize(renderer->graphicsCommandCount());
 
 	// allocate the buffers
 	VkCommandBufferAllocateInfo allocInfo = {};
@@ -67,7 +67,8 @@ void simulation::recordGraphicsCommands()
 		vkBeginCommandBuffer(renderer->graphicsCmdBuffers[i], &beginInfo);
 
 		// reset timer
-		vkCmdResetQueryPool(renderer->graphicsCmdBuffers[i], renderer->renderQueryPool, 0, 2);
+		uint32_t query = renderer->graphicsQuery(static_cast<uint32_t>(i));
+		vkCmdResetQueryPool(renderer->graphicsCmdBuffers[i], renderer->renderQueryPool, query, 2);
 
 
 		// Start the render pass
@@ -75,7 +76,7 @@ void simulation::recordGraphicsCommands()
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		// render pass and it's attachments to bind (in this case a colour attachment from the frambuffer)
 		renderPassInfo.renderPass = renderer->renderPass;
-		renderPassInfo.framebuffer = renderer->swapChainFramebuffers[i];
+		renderPassInfo.framebuffer = renderer->swapChainFramebuffers[i % renderer->swapChainFramebuffers.size()];
 
 		// size of render area
 		renderPassInfo.renderArea.offset = { 0, 0 };
@@ -100,21 +101,22 @@ void simulation::recordGraphicsCommands()
 		VkDeviceSize offsets[] = { 0 };
 		vkCmdBindVertexBuffers(renderer->graphicsCmdBuffers[i], 0, 1, vertexBuffers, offsets); // vbo
 
-		VkBuffer instanceBuffers[] = { buffers[INSTANCE]->buffer[buffIndex] };
+		VkBuffer instanceBuffers[] = { buffers[INSTANCE]->buffer[drawBuffer()] };
 
 		vkCmdBindVertexBuffers(renderer->graphicsCmdBuffers[i], 1, 1, instanceBuffers, offsets); // instance
 																								 // bind index & uniforms
 		vkCmdBindIndexBuffer(renderer->graphicsCmdBuffers[i], buffers[INDEX]->buffer[buffIndex], 0, VK_INDEX_TYPE_UINT16);
-		vkCmdBindDescriptorSets(renderer->graphicsCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipelineLayout, 0, 1, &renderer->gfxDescriptorSet, 0, nullptr);
+		uint32_t uniformOffset = renderer->uniforms.offset(static_cast<uint32_t>(i));
+		vkCmdBindDescriptorSets(renderer->graphicsCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->pipelineLayout, 0, 1, &renderer->gfxDescriptorSet, 1, &uniformOffset);
 
-		vkCmdWriteTimestamp(renderer->graphicsCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, 0);
+		vkCmdWriteTimestamp(renderer->graphicsCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, query);
 
 		// DRAW A TRIANGLEEEEE!!!?"!?!!?!?!?!?!?!
 		// vertex count, instance count, first vertex/ first instance. - used for offsets
 		vkCmdDrawIndexed(renderer->graphicsCmdBuffers[i], static_cast<uint32_t>(buffers[INDEX]->size), static_cast<uint32_t>(buffers[INSTANCE]->size), 0, 0, 0);
 		//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
 
-		vkCmdWriteTimestamp(renderer->graphicsCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, 1);
+		vkCmdWriteTimestamp(renderer->graphicsCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->renderQueryPool, query + 1);
 
 		// end the pass
 		vkCmdEndRenderPass(renderer->graphicsCmdBuffers[i]);
@@ -133,10 +135,10 @@ void simulation::createDescriptorPool()
 {
 	// how many and what type
 	std::vector<VkDescriptorPoolSize> poolSize = { VkDescriptorPoolSize(), VkDescriptorPoolSize(), VkDescriptorPoolSize() };
-	poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	poolSize[0].descriptorCount = 2;
 	poolSize[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSize[1].descriptorCount = 1;
+	poolSize[1].descriptorCount = 2;		// particles and leapfrog accelerations
 	poolSize[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	
 	// if lighting then 2 textures are used
@@ -181,9 +183,9 @@ void simulation::createDescriptorSets()
 
 
 	VkDescriptorBufferInfo UBI = {};
-	UBI.buffer = compute->uniformBuffer;
+	UBI.buffer = compute->uniforms.handle();
 	UBI.offset = 0;
-	UBI.range = sizeof(ComputeConfig::computeUBO);
+	UBI.range = compute->uniforms.range();
 
 	// Binding 0 : Particle position storage buffer
 	VkWriteDescriptorSet storageDesc{};
@@ -198,13 +200,30 @@ void simulation::createDescriptorSets()
 	VkWriteDescriptorSet uniformDesc{};
 	uniformDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	uniformDesc.dstSet = compute->descriptorSet;
-	uniformDesc.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uniformDesc.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uniformDesc.dstBinding = 1;
 	uniformDesc.pBufferInfo = &UBI;
 	uniformDesc.descriptorCount = 1;
 
 	std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = { storageDesc, uniformDesc };
 
+	// Binding 2 : Leapfrog accelerations
+	VkDescriptorBufferInfo accelerationInfo = {};
+	accelerationInfo.buffer = compute->accelerationBuffer;
+	accelerationInfo.offset = 0;
+	accelerationInfo.range = VK_WHOLE_SIZE;
+
+	VkWriteDescriptorSet accelerationDesc{};
+	accelerationDesc.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	accelerationDesc.dstSet = compute->descriptorSet;
+	accelerationDesc.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	accelerationDesc.dstBinding = 2;
+	accelerationDesc.pBufferInfo = &accelerationInfo;
+	accelerationDesc.descriptorCount = 1;
+
+	if (compute->leapfrog)
+		computeWriteDescriptorSets.push_back(accelerationDesc);
+
 	// create sets
 	vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
 
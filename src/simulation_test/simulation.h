@@ -3,10 +3,18 @@
 #include <GLFW/glfw3.h>
 #include "buffer.h"
 #include "compute.h"
+#include "cpu-forces.h"
+#include "octree.h"
+#include "fmm.h"
+#include "pm.h"
+#include "trajectory.h"
 #include <memory>
+#include <vector>
+#include <string>
 
 class Renderer;
 struct QueueFamilyIndices;
+struct parameters;
 
 class simulation
 {
@@ -50,6 +58,12 @@ public:
 	virtual void dispatchCompute() = 0;
 	virtual void cleanup() = 0;
 
+	// instance buffer holding the newest compute results
+	virtual size_t resultBuffer() const { return buffIndex; }
+
+	// instance buffer the draw reads
+	virtual size_t drawBuffer() const { return buffIndex; }
+
 	ComputeConfig* compute;
 };
 
@@ -64,6 +78,7 @@ private:
 	void dispatchCompute() override;
 	void cleanup() override;
 
+	void recordComputeCommand(uint32_t slot);
 
 	int findComputeQueueFamily(VkPhysicalDevice device);
 public:
@@ -82,16 +97,25 @@ private:
 	void dispatchCompute() override;
 	void cleanup() override;
 
+	void recordComputeCommand(uint32_t slot);
 	void copyComputeResults();
-	void computeTransfer();
 	void recordTransferCommands();
 
 	VkCommandBuffer transferCmdBuffer;
 	VkQueue transferQueue;
 	VkCommandPool transferPool;
-	int findTransferQueueFamily(VkPhysicalDevice pd);
+
+	// each copy waits on its frame's compute and the last draw, and signals its copied semaphore, which the next
+	// compute waits on, and copiedForDraw for the frame's draw
+	std::vector<VkSemaphore> copied;
+	std::vector<VkSemaphore> copiedForDraw;
+	VkSemaphore lastCopy = VK_NULL_HANDLE;
+	VkSemaphore lastDrawn = VK_NULL_HANDLE;
 public:
 	trans_simulation(const VkQueue* pQ, const VkQueue* gQ, const VkDevice* dev);
+
+	// draws from the storage the copy fills, the compute's buffer is rewritten meanwhile
+	size_t drawBuffer() const override { return buffIndex + 1; }
 };
 
 class double_simulation : public simulation
@@ -104,13 +128,180 @@ class double_simulation : public simulation
 	void dispatchCompute() override;
 	void cleanup() override;
 
-	void recordRenderCommand(int frame);
-	void recordComputeCommand(int frame);
+	void recordRenderCommand(uint32_t command);
+	void recordComputeCommand(uint32_t slot);
 	void allocateGraphicsCommandBuffers();
 	void createDescriptorPool();
 	void createDescriptorSets();
+
+	// signalled by the last draw, which read the buffer the next compute writes
+	VkSemaphore lastDrawn = VK_NULL_HANDLE;
 public:
 	double_simulation(const VkQueue* pQ, const VkQueue* gQ, const VkDevice* dev);
 	int bufferIndex = 0;
-	void waitOnFence(VkFence& fence);
-};
\ No newline at end of file
+
+	// frame() flips bufferIndex after the compute for it has been submitted
+	size_t resultBuffer() const override { return 1 - bufferIndex; }
+};
+
+// plays a recorded trajectory back instead of simulating - no compute at all. each frame is decoded from the
+// mapped file into one of two staging buffers while the copy out of the other is still in flight, then copied
+// into the instance buffer ahead of the draw on the graphics queue
+class replay_simulation : public simulation
+{
+	struct Upload
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory;
+		particle* mapped = nullptr;				// persistently mapped, host coherent
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		double time = 0.0;						// recorded time of the frame it holds
+	};
+
+	void frame() override;
+	void createCommandPools(QueueFamilyIndices& queueFamilyIndices, VkPhysicalDevice& phys) override;
+	void allocateComputeCommandBuffers() override;
+	void recordComputeCommands() override;
+	void createBufferObjects() override;
+	void dispatchCompute() override;
+	void cleanup() override;
+
+	// wait for the upload's last copy, then fill it with the next trajectory frame
+	void prepareUpload(Upload& upload);
+
+	// copy the upload into the instance buffer, ordered against the draws either side of it
+	void submitUpload(Upload& upload);
+
+	std::unique_ptr<TrajectoryReader> trajectory;
+	Upload uploads[2];
+	int current = 0;					// upload the next frame submits
+	size_t nextFrame = 0;				// trajectory frame the next prepareUpload reads
+	double shownTime = 0.0;				// recorded time of the frame in the instance buffer
+
+public:
+	replay_simulation(const VkQueue* pQ, const VkQueue* gQ, const VkDevice* dev);
+
+	// the frames to play - before createConfig, with the instance buffer's particles made from frame 0
+	void setTrajectory(std::unique_ptr<TrajectoryReader> reader);
+
+	// instance records for count positions. velocities aren't recorded, so they are left at zero
+	static void expand(const float* xyz, size_t count, particle* out);
+};
+
+// runs the nbody.comp physics on host threads - never touches a Vulkan device
+class cpu_simulation : public simulation
+{
+protected:
+	void frame() override;
+	void createCommandPools(QueueFamilyIndices& queueFamilyIndices, VkPhysicalDevice& phys) override;
+	void allocateComputeCommandBuffers() override;
+	void recordComputeCommands() override;
+	void recordGraphicsCommands() override;
+	void createDescriptorPool() override;
+	void createDescriptorSets() override;
+	void createBufferObjects() override;
+	void dispatchCompute() override;
+	void cleanup() override;
+
+	// copy positions into the structure of arrays and zero the accelerations
+	void loadPositions();
+
+	// acceleration on every particle from every other (the O(N^2) pass)
+	virtual void computeForces();
+	void computeForceRange(size_t begin, size_t end);
+	void computeForcesSymmetric(size_t chunk);
+	void integrate(float deltaT);
+
+	// leapfrog halves - velocity from the current accelerations, position from the velocity
+	void kick(float deltaT);
+	void drift(float deltaT);
+
+	// put the particles in morton order, carrying their ids along
+	void sortParticles();
+
+	std::string createFileString(int testNum);
+
+	const parameters& simParam;
+	std::vector<particle> particles;
+	std::vector<uint32_t> ids;			// original index of the particle in each slot
+	uint64_t stepCount = 0;
+	double simTime = 0.0;				// simulated seconds
+	float lastDeltaT = 0.0f;
+	bool accelerationCurrent = false;	// accX/Y/Z are for the current positions (leapfrog)
+	unsigned int threadCount;
+
+	// structure of arrays copies of the positions and the accelerations for the force kernels
+	std::vector<float> posX, posY, posZ;
+	std::vector<float> accX, accY, accZ;
+	ForceKernelInfo forceKernel;
+	ForceTiling tiling;
+
+	// symmetric mode - one x/y/z acceleration set per pool worker, summed after the pass
+	std::vector<std::vector<float>> workerAcc;
+
+	float frameTimer = 0;
+	double computeTime = 0;   // ms spent in the last step
+
+public:
+	cpu_simulation(const parameters& param, const std::vector<particle>& initial);
+	~cpu_simulation();
+
+	// advance every particle by one step of deltaT
+	void step(float deltaT);
+
+	// run for simParam.totalTime, writing the same CSV layout as the GPU modes
+	void run();
+
+	// carry on from a snapshot - the particles were already passed to the constructor
+	void resume(const std::vector<uint32_t>& restoredIds, uint64_t step, double time);
+
+	// write the state to simParam.snapshotPath
+	void saveSnapshot();
+
+	const std::vector<particle>& getParticles() const { return particles; }
+	const std::vector<uint32_t>& getIds() const { return ids; }
+};
+
+// barnes-hut - the O(N^2) pass replaced by an octree walk where distant cells act as one particle
+class bh_simulation : public cpu_simulation
+{
+protected:
+	void computeForces() override;
+	void walkTree();
+
+	Octree tree;
+	float theta;		// opening angle, a cell is opened when size / distance >= theta
+
+public:
+	bh_simulation(const parameters& param, const std::vector<particle>& initial);
+};
+
+// fast multipole - far field through chebyshev interpolation for O(N) steps,
+// checked against the direct sum every so often
+class fmm_simulation : public cpu_simulation
+{
+protected:
+	void computeForces() override;
+	void measureError();
+
+	Fmm fmm;
+
+	// direct sum accelerations for the sampled particles
+	std::vector<float> directX, directY, directZ;
+
+public:
+	fmm_simulation(const parameters& param, const std::vector<particle>& initial);
+};
+
+// particle mesh - forces from a grid potential, cheap for huge counts but smoothed below a cell
+class pm_simulation : public cpu_simulation
+{
+protected:
+	void computeForces() override;
+
+	ParticleMesh mesh;
+
+public:
+	pm_simulation(const parameters& param, const std::vector<particle>& initial);
+};
@@ -0,0 +1,237 @@
+#include "snapshot.h"
+#include "physics.h"
+#include "compression.h"
+#include <numeric>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char SNAPSHOT_MAGIC[8] = { 'N', 'B', 'O', 'D', 'Y', 'S', 'N', 'P' };
+
+static uint64_t alignUp(uint64_t value)
+{
+	return (value + SNAPSHOT_ALIGNMENT - 1) & ~(SNAPSHOT_ALIGNMENT - 1);
+}
+
+void writeSnapshot(const std::string& path, const std::vector<particle>& particles, const std::vector<uint32_t>& ids,
+	uint64_t step, double time, float deltaT, float errorBound)
+{
+	SnapshotHeader header = {};
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.recordSize = sizeof(particle);
+	header.recordOffset = alignUp(sizeof(SnapshotHeader));
+	header.idOffset = header.recordOffset + sizeof(particle) * particles.size();
+	header.count = particles.size();
+	header.encoding = errorBound > 0.0f ? SNAPSHOT_QUANTISED : SNAPSHOT_RAW;
+	header.errorBound = errorBound;
+	header.step = step;
+	header.time = time;
+	header.deltaT = deltaT;
+	header.gravity = GRAVITY;
+	header.power = POWER;
+	header.soften = SOFTEN;
+
+	std::vector<uint8_t> payload;
+	if (header.encoding == SNAPSHOT_QUANTISED)
+	{
+		// back in id order, the ids aren't stored
+		size_t count = particles.size();
+		std::vector<float> positions(3 * count), velocities(3 * count), w(2 * count);
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t id = ids[i];
+			for (int a = 0; a < 3; a++)
+			{
+				positions[3 * id + a] = particles[i].pos[a];
+				velocities[3 * id + a] = particles[i].vel[a];
+			}
+			w[2 * id + 0] = particles[i].pos.w;
+			w[2 * id + 1] = particles[i].vel.w;
+		}
+
+		PositionEncoder(errorBound).encode(positions.data(), count, payload);
+		PositionEncoder(errorBound).encode(velocities.data(), count, payload);
+		encodeBytes(reinterpret_cast<const uint8_t*>(w.data()), sizeof(float) * w.size(), payload);
+
+		header.idOffset = 0;
+		header.payloadSize = payload.size();
+	}
+
+	std::string temporary = path + ".tmp";
+	FILE* out = fopen(temporary.c_str(), "wb");
+	if (!out)
+		throw std::runtime_error("failed to open snapshot " + temporary);
+
+	std::vector<uint8_t> padding(static_cast<size_t>(header.recordOffset - sizeof(header)), 0);
+
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(padding.data(), 1, padding.size(), out) == padding.size();
+
+	if (header.encoding == SNAPSHOT_QUANTISED)
+	{
+		written = written && fwrite(payload.data(), 1, payload.size(), out) == payload.size();
+	}
+	else
+	{
+		written = written
+			&& fwrite(particles.data(), sizeof(particle), particles.size(), out) == particles.size()
+			&& fwrite(ids.data(), sizeof(uint32_t), ids.size(), out) == ids.size();
+	}
+
+	if (fclose(out) != 0 || !written)
+		throw std::runtime_error("failed to write snapshot " + temporary);
+
+#ifdef _WIN32
+	if (!MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		throw std::runtime_error("failed to replace snapshot " + path);
+#else
+	if (rename(temporary.c_str(), path.c_str()) != 0)
+		throw std::runtime_error("failed to replace snapshot " + path);
+#endif
+}
+
+Snapshot::Snapshot(const std::string& path)
+{
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		file = nullptr;
+		throw std::runtime_error("failed to open snapshot " + path);
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	length = static_cast<uint64_t>(size.QuadPart);
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	base = mapping ? static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		throw std::runtime_error("failed to open snapshot " + path);
+
+	struct stat info;
+	fstat(file, &info);
+	length = static_cast<uint64_t>(info.st_size);
+
+	void* view = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	base = view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+
+	// read front to back by the upload
+	if (base)
+		madvise(const_cast<uint8_t*>(base), length, MADV_SEQUENTIAL);
+#endif
+
+	// the destructor doesn't run for a throwing constructor
+	auto fail = [&](const std::string& reason)
+	{
+		release();
+		throw std::runtime_error("snapshot " + path + ": " + reason);
+	};
+
+	if (!base || length < sizeof(SnapshotHeader))
+		fail("too small to map");
+
+	const SnapshotHeader& h = header();
+	if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0)
+		fail("not a snapshot");
+
+	if (h.version < 1 || h.version > SNAPSHOT_VERSION || h.recordSize != sizeof(particle))
+		fail("written by an incompatible version");
+
+	if (encoding() == SNAPSHOT_RAW)
+	{
+		if (h.recordOffset % SNAPSHOT_ALIGNMENT != 0 || h.idOffset != h.recordOffset + h.count * sizeof(particle)
+			|| h.idOffset + h.count * sizeof(uint32_t) > length)
+			fail("truncated");
+	}
+	else if (encoding() == SNAPSHOT_QUANTISED)
+	{
+		if (h.recordOffset % SNAPSHOT_ALIGNMENT != 0 || h.recordOffset + h.payloadSize > length)
+			fail("truncated");
+	}
+	else
+	{
+		fail("unknown encoding");
+	}
+
+	if (h.gravity != GRAVITY || h.power != POWER || h.soften != SOFTEN)
+	{
+		std::cout << "Warning: snapshot was written with different force constants (G " << h.gravity
+			<< ", power " << h.power << ", soften " << h.soften << ")" << std::endl;
+	}
+}
+
+void Snapshot::read(std::vector<particle>& particles, std::vector<uint32_t>& ids) const
+{
+	size_t n = count();
+
+	if (encoding() == SNAPSHOT_RAW)
+	{
+		particles.assign(this->particles(), this->particles() + n);
+		ids.assign(this->ids(), this->ids() + n);
+		return;
+	}
+
+	const uint8_t* payload = base + header().recordOffset;
+	size_t remaining = static_cast<size_t>(header().payloadSize);
+
+	std::vector<float> positions(3 * n), velocities(3 * n);
+	std::vector<uint8_t> w;
+
+	size_t used = PositionDecoder().decode(payload, remaining, true, n, positions.data());
+	used += PositionDecoder().decode(payload + used, remaining - used, true, n, velocities.data());
+	decodeBytes(payload + used, remaining - used, w);
+
+	if (w.size() != 2 * sizeof(float) * n)
+		throw std::runtime_error("snapshot has the wrong number of particles");
+
+	const float* weights = reinterpret_cast<const float*>(w.data());
+	particles.resize(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		particles[i].pos = glm::vec4(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2], weights[2 * i]);
+		particles[i].vel = glm::vec4(velocities[3 * i], velocities[3 * i + 1], velocities[3 * i + 2], weights[2 * i + 1]);
+	}
+
+	ids.resize(n);
+	std::iota(ids.begin(), ids.end(), 0u);
+}
+
+Snapshot::~Snapshot()
+{
+	release();
+}
+
+void Snapshot::release()
+{
+#ifdef _WIN32
+	if (base)
+		UnmapViewOfFile(base);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	mapping = file = nullptr;
+#else
+	if (base)
+		munmap(const_cast<uint8_t*>(base), length);
+	if (file >= 0)
+		close(file);
+	file = -1;
+#endif
+	base = nullptr;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "particle.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// a SnapshotHeader padded out to SNAPSHOT_ALIGNMENT, count particle records, then count uint32 ids.
+// the records start on a page boundary so a mapped file can be handed straight to the uploads.
+// version 2 adds quantised snapshots - version 1 files are always raw
+const uint32_t SNAPSHOT_VERSION = 2;
+const uint64_t SNAPSHOT_ALIGNMENT = 4096;
+
+enum SNAPSHOT_ENCODING : uint32_t
+{
+	SNAPSHOT_RAW = 0,			// particle records and ids as they are in memory
+	SNAPSHOT_QUANTISED = 1		// compression.h keyframes of the positions and the velocities, then the w components
+								// through encodeBytes, all in id order - payloadSize bytes from recordOffset, no ids
+};
+
+struct SnapshotHeader
+{
+	char magic[8];				// "NBODYSNP"
+	uint32_t version;
+	uint32_t recordSize;		// sizeof(particle) when written
+	uint64_t recordOffset;		// bytes from the start of the file to the first particle
+	uint64_t idOffset;			// bytes from the start of the file to the first id
+	uint64_t count;
+
+	uint64_t step;				// frames run so far
+	double time;				// simulated seconds so far
+	float deltaT;				// last step's time step
+
+	// physics.h when written, a restart with different constants won't continue the same run
+	float gravity;
+	float power;
+	float soften;
+
+	// version 2
+	uint32_t encoding;
+	float errorBound;			// quantised only, relative to the bounding box
+	uint64_t payloadSize;		// quantised only
+};
+
+// write the state to path. goes through a temporary file and a rename, so a crash mid-write leaves the last
+// snapshot intact. ids[slot] is the original index of the particle in that slot.
+// a non zero errorBound quantises it - much smaller, but a restart from it no longer continues the run exactly
+void writeSnapshot(const std::string& path, const std::vector<particle>& particles, const std::vector<uint32_t>& ids,
+	uint64_t step, double time, float deltaT, float errorBound = 0.0f);
+
+// a snapshot file mapped read only. the header is checked on open, the records are used in place
+class Snapshot
+{
+	const uint8_t* base = nullptr;
+	uint64_t length = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+	void release();
+
+public:
+	explicit Snapshot(const std::string& path);
+	~Snapshot();
+
+	Snapshot(const Snapshot&) = delete;
+	Snapshot& operator=(const Snapshot&) = delete;
+
+	const SnapshotHeader& header() const { return *reinterpret_cast<const SnapshotHeader*>(base); }
+	SNAPSHOT_ENCODING encoding() const { return header().version < 2 ? SNAPSHOT_RAW : static_cast<SNAPSHOT_ENCODING>(header().encoding); }
+	size_t count() const { return static_cast<size_t>(header().count); }
+
+	// the records in place - raw snapshots only
+	const particle* particles() const { return reinterpret_cast<const particle*>(base + header().recordOffset); }
+	const uint32_t* ids() const { return reinterpret_cast<const uint32_t*>(base + header().idOffset); }
+
+	// copy the particles and their ids out, decoding a quantised snapshot
+	void read(std::vector<particle>& particles, std::vector<uint32_t>& ids) const;
+};
@@ -0,0 +1,206 @@
+#include "threadpool.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// which queue belongs to the current thread, -1 outside the pool
+static thread_local int workerIndex = -1;
+
+ThreadPool::ThreadPool() : pending(0) {}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> l(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (auto &w : workers)
+	{
+		w.join();
+	}
+}
+
+void ThreadPool::init(unsigned int workerCount, bool pin)
+{
+	// already running
+	if (!queues.empty())
+		return;
+
+	if (workerCount == 0)
+		workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+	pinned = pin;
+
+	// the thread calling parallelFor does work too, so it counts as one of the workers
+	unsigned int threads = workerCount - 1;
+
+	for (unsigned int i = 0; i < threads + 1; i++)
+	{
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+
+	// the main thread takes the core after the workers
+	if (pinned)
+		pinThread(threads);
+}
+
+void ThreadPool::pinThread(unsigned int core)
+{
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	core %= cores;
+
+#ifdef _WIN32
+	SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+unsigned int ThreadPool::queueIndex() const
+{
+	// anything outside the pool shares the last queue
+	return workerIndex >= 0 ? static_cast<unsigned int>(workerIndex) : static_cast<unsigned int>(queues.size() - 1);
+}
+
+bool ThreadPool::popOrSteal(unsigned int index, Task& task)
+{
+	// newest task from our own deque - most likely to still be in cache
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> l(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			pending--;
+			return true;
+		}
+	}
+
+	// oldest task from someone else's
+	for (size_t k = 1; k < queues.size(); k++)
+	{
+		Queue& victim = *queues[(index + k) % queues.size()];
+		std::lock_guard<std::mutex> l(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			pending--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::runTask(const Task& task)
+{
+	(*task.job->fn)(task.begin, task.end);
+
+	// last chunk wakes whoever is waiting on the job
+	if (--task.job->remaining == 0)
+	{
+		std::lock_guard<std::mutex> l(sleepLock);
+		done.notify_all();
+	}
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+	workerIndex = static_cast<int>(index);
+
+	if (pinned)
+		pinThread(index);
+
+	while (true)
+	{
+		Task task;
+		if (popOrSteal(index, task))
+		{
+			runTask(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> l(sleepLock);
+		wake.wait(l, [this] { return stopping || pending > 0; });
+
+		if (stopping && pending == 0)
+			return;
+	}
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn)
+{
+	if (end <= begin)
+		return;
+
+	// never started - run with the defaults
+	if (queues.empty())
+		init(0, false);
+
+	// the last queue and worker index are this thread's until the job is done
+	std::unique_lock<std::recursive_mutex> caller(callerLock, std::defer_lock);
+	if (workerIndex < 0)
+		caller.lock();
+
+	grain = std::max<size_t>(1, grain);
+	size_t chunks = (end - begin + grain - 1) / grain;
+
+	// not worth handing out
+	if (chunks == 1 || workers.empty())
+	{
+		fn(begin, end);
+		return;
+	}
+
+	Job job;
+	job.fn = &fn;
+	job.remaining = chunks;
+
+	// each queue gets a contiguous run of chunks, stealing only kicks in when they finish unevenly.
+	// counted in the same critical section, so no worker takes one before it's counted, or sees the count
+	// before they're all queued
+	{
+		std::lock_guard<std::mutex> l(sleepLock);
+		pending += chunks;
+
+		for (size_t c = 0; c < chunks; c++)
+		{
+			Queue& q = *queues[c * queues.size() / chunks];
+			std::lock_guard<std::mutex> ql(q.lock);
+			q.tasks.push_back({ &job, begin + c * grain, std::min(end, begin + (c + 1) * grain) });
+		}
+	}
+	wake.notify_all();
+
+	// help out until every chunk of this job has finished
+	unsigned int index = queueIndex();
+	while (job.remaining > 0)
+	{
+		Task task;
+		if (popOrSteal(index, task))
+		{
+			runTask(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> l(sleepLock);
+		done.wait(l, [&] { return job.remaining == 0 || pending > 0; });
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// persistent pool of host threads, each with its own deque of tasks.
+// workers take from the back of their own deque and steal from the front of everyone else's,
+// so uneven chunks and slow (hyperthreaded) cores even themselves out
+class ThreadPool
+{
+	struct Job
+	{
+		const std::function<void(size_t, size_t)>* fn;
+		std::atomic<size_t> remaining;
+	};
+
+	struct Task
+	{
+		Job* job;
+		size_t begin, end;
+	};
+
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	// one queue per worker plus one shared by threads outside the pool
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex sleepLock;
+	std::condition_variable wake;		// new tasks or shutting down
+	std::condition_variable done;		// a job finished
+	std::atomic<size_t> pending;		// tasks queued but not started
+	std::recursive_mutex callerLock;	// threads outside the pool take turns, they share a queue and worker index
+	bool stopping = false;
+	bool pinned = false;
+
+	void workerLoop(unsigned int index);
+	bool popOrSteal(unsigned int index, Task& task);
+	void runTask(const Task& task);
+	unsigned int queueIndex() const;
+
+	static void pinThread(unsigned int core);
+
+public:
+	ThreadPool();
+	~ThreadPool();
+
+	inline static std::shared_ptr<ThreadPool> get()
+	{
+		static std::shared_ptr<ThreadPool> instance(new ThreadPool());
+		return instance;
+	}
+
+	// start the workers - 0 uses every hardware thread. pin locks worker n to core n
+	void init(unsigned int workerCount, bool pin);
+
+	// call fn(chunkBegin, chunkEnd) over [begin, end) split into chunks of grain.
+	// blocks until all chunks are done, the calling thread works on chunks while it waits.
+	// calls from threads outside the pool run one at a time
+	void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+	unsigned int size() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+	// index of the calling thread in [0, size()) - for per worker scratch inside parallelFor.
+	// threads outside the pool all share the last index, only one of them is ever inside parallelFor
+	unsigned int currentWorker() const { return queueIndex(); }
+};
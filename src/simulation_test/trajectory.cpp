@@ -0,0 +1,493 @@
+#include "trajectory.h"
+#include "renderer.h"
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char TRAJECTORY_MAGIC[8] = { 'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J' };
+
+TrajectoryStream::TrajectoryStream(const VkDevice& dev, VkQueue transferQueue, uint32_t queueFamily, const std::string& path,
+	uint64_t particleCount, uint32_t interval, float errorBound, uint32_t slots)
+	: device(dev), queue(transferQueue), count(particleCount)
+{
+	file = fopen(path.c_str(), "wb");
+	if (!file)
+		throw std::runtime_error("failed to open trajectory " + path);
+
+	TrajectoryHeader header = {};
+	memcpy(header.magic, TRAJECTORY_MAGIC, sizeof(header.magic));
+	header.version = TRAJECTORY_VERSION;
+	header.interval = interval;
+	header.count = count;
+	header.errorBound = errorBound;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		throw std::runtime_error("failed to write trajectory " + path);
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create trajectory command pool");
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &computeDone) != VK_SUCCESS ||
+		vkCreateSemaphore(device, &semaphoreInfo, nullptr, &copyDone) != VK_SUCCESS)
+		throw std::runtime_error("failed to create trajectory semaphores");
+
+	ring.resize(std::max(1u, slots));
+	VkDeviceSize bufferSize = sizeof(particle) * count;
+
+	for (auto &slot : ring)
+	{
+		// cached memory reads much faster on the writer thread, but not every device has it host coherent
+		try
+		{
+			Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+				slot.buffer, slot.memory);
+		}
+		catch (const std::runtime_error&)
+		{
+			vkDestroyBuffer(device, slot.buffer, nullptr);
+			slot.buffer = VK_NULL_HANDLE;
+
+			Renderer::get()->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				slot.buffer, slot.memory);
+		}
+
+		slot.mapped = static_cast<const particle*>(slot.memory.mapped);
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &slot.commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate trajectory command buffer");
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkCreateFence(device, &fenceInfo, nullptr, &slot.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to create trajectory fence");
+	}
+
+	scratch.resize(3 * count);
+	if (errorBound > 0.0f)
+		encoder.reset(new PositionEncoder(errorBound));
+
+	writer = std::thread(&TrajectoryStream::writerLoop, this);
+}
+
+TrajectoryStream::~TrajectoryStream()
+{
+	try
+	{
+		finish();
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	for (auto &slot : ring)
+	{
+		vkDestroyFence(device, slot.fence, nullptr);
+		vkFreeCommandBuffers(device, commandPool, 1, &slot.commandBuffer);
+		Renderer::get()->destroyBuffer(slot.buffer, slot.memory);
+	}
+
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	vkDestroySemaphore(device, computeDone, nullptr);
+	vkDestroySemaphore(device, copyDone, nullptr);
+}
+
+void TrajectoryStream::setOrder(const std::vector<uint32_t>& ids)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	order = std::make_shared<const std::vector<uint32_t>>(ids);
+}
+
+void TrajectoryStream::capture(VkBuffer source, uint64_t frame, double time)
+{
+	Slot& slot = ring[head];
+
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		if (!error.empty())
+			throw std::runtime_error(error);
+
+		// the writer is behind - the only place the frame loop waits on it
+		if (slot.pending)
+		{
+			stalls++;
+			written.wait(guard, [&] { return !slot.pending || !error.empty(); });
+
+			if (!error.empty())
+				throw std::runtime_error(error);
+		}
+	}
+
+	vkResetFences(device, 1, &slot.fence);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(slot.commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("trajectory command buffer failed to start");
+
+	// the semaphore wait already orders the copy after the compute writes
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = sizeof(particle) * count;
+	vkCmdCopyBuffer(slot.commandBuffer, source, slot.buffer, 1, &copyRegion);
+
+	// make the copy visible to the writer thread once the fence signals
+	VkBufferMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.buffer = slot.buffer;
+	hostBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+		0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+	vkEndCommandBuffer(slot.commandBuffer);
+
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &computeDone;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &slot.commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &copyDone;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, slot.fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit trajectory copy");
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		slot.pending = true;
+		slot.frame = frame;
+		slot.time = time;
+		slot.ids = order;
+	}
+	submitted.notify_one();
+
+	head = (head + 1) % ring.size();
+}
+
+void TrajectoryStream::writerLoop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	// slots are submitted and written in ring order
+	while (true)
+	{
+		submitted.wait(guard, [&] { return stopping || ring[tail].pending; });
+		if (!ring[tail].pending)
+			break;
+
+		Slot& slot = ring[tail];
+		guard.unlock();
+
+		std::string failure;
+		try
+		{
+			VkResult result;
+			do
+			{
+				result = vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+				if (result == VK_ERROR_DEVICE_LOST)
+					throw std::runtime_error("device crashed");
+			} while (result != VK_SUCCESS);
+
+			writeFrame(slot);
+		}
+		catch (const std::runtime_error& e)
+		{
+			failure = e.what();
+		}
+
+		guard.lock();
+		slot.pending = false;
+		slot.ids.reset();
+		tail = (tail + 1) % ring.size();
+		written.notify_all();
+
+		if (!failure.empty())
+		{
+			error = "trajectory: " + failure;
+			break;
+		}
+	}
+}
+
+void TrajectoryStream::writeFrame(const Slot& slot)
+{
+	// back to id order, so frames line up across morton re-sorts
+	const std::vector<uint32_t>& ids = *slot.ids;
+	for (size_t i = 0; i < count; i++)
+	{
+		const glm::vec4& pos = slot.mapped[i].pos;
+		float* out = &scratch[3 * size_t(ids[i])];
+		out[0] = pos.x;
+		out[1] = pos.y;
+		out[2] = pos.z;
+	}
+
+	TrajectoryFrameHeader header = {};
+	header.frame = slot.frame;
+	header.time = slot.time;
+
+	const void* payload = scratch.data();
+	header.size = sizeof(float) * scratch.size();
+	header.encoding = RAW_POSITIONS;
+
+	// encoded here rather than on the frame loop, spread over the pool
+	if (encoder)
+	{
+		encoded.clear();
+		header.encoding = encoder->encode(scratch.data(), count, encoded) ? QUANTISED_KEY : QUANTISED_DELTA;
+		payload = encoded.data();
+		header.size = encoded.size();
+	}
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		fwrite(payload, 1, static_cast<size_t>(header.size), file) != header.size)
+		throw std::runtime_error("failed to write frame " + std::to_string(slot.frame));
+
+	framesWritten++;
+}
+
+void TrajectoryStream::finish()
+{
+	if (!file)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	submitted.notify_one();
+
+	if (writer.joinable())
+		writer.join();
+
+	bool closed = fclose(file) == 0;
+	file = nullptr;
+
+	std::cout << "Trajectory: " << framesWritten << " frames written, " << stalls << " waits for a free slot" << std::endl;
+
+	if (!error.empty())
+		throw std::runtime_error(error);
+	if (!closed)
+		throw std::runtime_error("failed to close trajectory");
+}
+
+TrajectoryReader::TrajectoryReader(const std::string& path)
+{
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		file = nullptr;
+		throw std::runtime_error("failed to open trajectory " + path);
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	length = static_cast<uint64_t>(size.QuadPart);
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	base = mapping ? static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		throw std::runtime_error("failed to open trajectory " + path);
+
+	struct stat info;
+	fstat(file, &info);
+	length = static_cast<uint64_t>(info.st_size);
+
+	void* view = length ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	base = view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+
+	// read front to back, and pages behind the replay can go
+	if (base)
+		madvise(const_cast<uint8_t*>(base), length, MADV_SEQUENTIAL);
+#endif
+
+	// the destructor doesn't run for a throwing constructor
+	auto fail = [&](const std::string& reason)
+	{
+		release();
+		throw std::runtime_error("trajectory " + path + ": " + reason);
+	};
+
+	if (!base || length < sizeof(TrajectoryHeader))
+		fail("too small to map");
+
+	memcpy(&fileHeader, base, sizeof(fileHeader));
+	if (memcmp(fileHeader.magic, TRAJECTORY_MAGIC, sizeof(fileHeader.magic)) != 0)
+		fail("not a trajectory");
+	if (fileHeader.version != TRAJECTORY_VERSION)
+		fail("written by an incompatible version");
+	if (fileHeader.count == 0)
+		fail("has no particles");
+
+	// walk the headers. a run that died mid write leaves a partial frame at the end, which is dropped
+	uint64_t offset = sizeof(TrajectoryHeader);
+	size_t keyframe = SIZE_MAX;
+	while (length - offset >= sizeof(TrajectoryFrameHeader))
+	{
+		Frame f;
+		memcpy(&f.header, base + offset, sizeof(f.header));
+		f.offset = offset + sizeof(TrajectoryFrameHeader);
+
+		if (f.header.size > length - f.offset)
+		{
+			std::cout << "Warning: trajectory " << path << " ends part way through frame " << f.header.frame << std::endl;
+			break;
+		}
+
+		if (f.header.encoding == RAW_POSITIONS)
+		{
+			if (f.header.size != sizeof(float) * 3 * fileHeader.count)
+				fail("frame " + std::to_string(f.header.frame) + " has the wrong size");
+			keyframe = frames.size();
+		}
+		else if (f.header.encoding == QUANTISED_KEY)
+		{
+			keyframe = frames.size();
+		}
+		else if (f.header.encoding != QUANTISED_DELTA || keyframe == SIZE_MAX)
+		{
+			fail("frame " + std::to_string(f.header.frame) + " can't be decoded");
+		}
+
+		f.keyframe = keyframe;
+		frames.push_back(f);
+		offset = f.offset + f.header.size;
+	}
+
+	if (frames.empty())
+		fail("has no frames");
+
+	positions.resize(3 * count());
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+	release();
+}
+
+void TrajectoryReader::release()
+{
+#ifdef _WIN32
+	if (base)
+		UnmapViewOfFile(base);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	mapping = file = nullptr;
+#else
+	if (base)
+		munmap(const_cast<uint8_t*>(base), length);
+	if (file >= 0)
+		close(file);
+	file = -1;
+#endif
+	base = nullptr;
+}
+
+void TrajectoryReader::decode(size_t index)
+{
+	const Frame& f = frames[index];
+	size_t used = decoder.decode(base + f.offset, static_cast<size_t>(f.header.size), f.header.encoding == QUANTISED_KEY,
+		count(), positions.data());
+
+	if (used != f.header.size)
+		throw std::runtime_error("trajectory frame " + std::to_string(f.header.frame) + " is corrupt");
+
+	decoded = index;
+}
+
+const float* TrajectoryReader::read(size_t index)
+{
+	const Frame& f = frames[index];
+
+	if (f.header.encoding == RAW_POSITIONS)
+	{
+		const uint8_t* payload = base + f.offset;
+		if (reinterpret_cast<uintptr_t>(payload) % alignof(float) == 0)
+			return reinterpret_cast<const float*>(payload);
+
+		memcpy(positions.data(), payload, static_cast<size_t>(f.header.size));
+		decoded = SIZE_MAX;
+		return positions.data();
+	}
+
+	if (index == decoded)
+		return positions.data();
+
+	// carry on from the decoded frame when it's part of the same chain, otherwise start at the keyframe
+	size_t from = f.keyframe;
+	if (decoded != SIZE_MAX && decoded >= f.keyframe && decoded < index && decoder.primed())
+		from = decoded + 1;
+
+	for (size_t i = from; i <= index; i++)
+		decode(i);
+
+	return positions.data();
+}
+
+void TrajectoryReader::prefetch(size_t index, size_t ahead)
+{
+	if (index + 1 >= frames.size() || ahead == 0)
+		return;
+
+	size_t last = std::min(frames.size() - 1, index + ahead);
+	uint64_t begin = frames[index + 1].offset - sizeof(TrajectoryFrameHeader);
+	uint64_t end = frames[last].offset + frames[last].header.size;
+
+	// only ask for what wasn't asked for last time, unless the replay looped back to the start
+	if (prefetchedTo > end)
+		prefetchedTo = 0;
+	begin = std::max(begin, prefetchedTo);
+	if (begin >= end)
+		return;
+
+	// the range has to start on a page
+	const uint64_t page = 4096;
+	uint64_t aligned = begin & ~(page - 1);
+
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<uint8_t*>(base + aligned);
+	range.NumberOfBytes = static_cast<SIZE_T>(end - aligned);
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	madvise(const_cast<uint8_t*>(base + aligned), static_cast<size_t>(end - aligned), MADV_WILLNEED);
+#endif
+
+	prefetchedTo = end;
+}
@@ -0,0 +1,177 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include "particle.h"
+#include "compression.h"
+#include "allocator.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+// version 1 layout - a TrajectoryHeader, then for every written frame a TrajectoryFrameHeader and size bytes of payload
+const uint32_t TRAJECTORY_VERSION = 1;
+
+// how a frame's payload is stored
+enum TRAJECTORY_ENCODING : uint32_t
+{
+	RAW_POSITIONS = 0,			// count x/y/z floats in id order
+	QUANTISED_KEY = 1,			// PositionEncoder keyframe, decodes on its own
+	QUANTISED_DELTA = 2			// PositionEncoder delta frame, needs every frame back to the last keyframe
+};
+
+struct TrajectoryHeader
+{
+	char magic[8];				// "NBODYTRJ"
+	uint32_t version;
+	uint32_t interval;			// frames between written frames
+	uint64_t count;				// particles in every frame
+	float errorBound;			// quantised frames, relative to the bounding box. 0 = raw
+	uint32_t reserved;
+};
+
+struct TrajectoryFrameHeader
+{
+	uint64_t frame;				// frames run when it was taken
+	double time;				// simulated seconds when it was taken
+	uint64_t size;				// payload bytes after this header
+	uint32_t encoding;
+	uint32_t reserved;
+};
+
+// streams particle positions to a file without stalling the frame loop. each capture copies the instance
+// buffer into the next slot of a ring of host visible buffers on the transfer queue, and a writer thread
+// waits on the slot's fence and writes it out. the frame loop only waits when every slot is still pending
+class TrajectoryStream
+{
+	struct Slot
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory;
+		const particle* mapped = nullptr;		// persistently mapped, host coherent
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+
+		bool pending = false;					// copy submitted, not yet written
+		uint64_t frame = 0;
+		double time = 0.0;
+		std::shared_ptr<const std::vector<uint32_t>> ids;	// particle order when the copy was taken
+	};
+
+	const VkDevice& device;
+	VkQueue queue;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+
+	// the compute submission signals computeDone for the copy to wait on, the copy signals copyDone
+	// for the next compute submission so it can't overwrite the particles mid copy
+	VkSemaphore computeDone = VK_NULL_HANDLE;
+	VkSemaphore copyDone = VK_NULL_HANDLE;
+
+	std::vector<Slot> ring;
+	size_t head = 0;				// next slot to capture into
+	size_t tail = 0;				// next slot to write out
+	uint64_t count;
+	std::shared_ptr<const std::vector<uint32_t>> order;
+
+	FILE* file = nullptr;
+	std::vector<float> scratch;		// one frame of positions in id order
+
+	// quantises the frames on the writer thread, null for raw frames
+	std::unique_ptr<PositionEncoder> encoder;
+	std::vector<uint8_t> encoded;
+
+	std::thread writer;
+	std::mutex lock;
+	std::condition_variable submitted;	// a slot went pending, or stopping
+	std::condition_variable written;	// a slot was freed
+	bool stopping = false;
+	std::string error;					// from the writer, rethrown on the frame loop's thread
+
+	uint64_t framesWritten = 0;
+	uint64_t stalls = 0;				// captures that had to wait for a free slot
+
+	void writerLoop();
+	void writeFrame(const Slot& slot);
+
+public:
+	// queue must belong to queueFamily. interval is only recorded in the header, the caller picks the frames.
+	// a non zero errorBound writes quantised frames
+	TrajectoryStream(const VkDevice& dev, VkQueue transferQueue, uint32_t queueFamily, const std::string& path,
+		uint64_t particleCount, uint32_t interval, float errorBound = 0.0f, uint32_t slots = 3);
+	~TrajectoryStream();
+
+	TrajectoryStream(const TrajectoryStream&) = delete;
+	TrajectoryStream& operator=(const TrajectoryStream&) = delete;
+
+	// semaphores for the compute submissions either side of a capture
+	VkSemaphore readySemaphore() const { return computeDone; }
+	VkSemaphore doneSemaphore() const { return copyDone; }
+
+	// particle order in the device buffers, ids[slot] is the original index. call again after a re-sort
+	void setOrder(const std::vector<uint32_t>& ids);
+
+	// copy source once the compute submission that signalled readySemaphore has finished
+	void capture(VkBuffer source, uint64_t frame, double time);
+
+	// write out every pending slot and close the file. the destructor calls it too
+	void finish();
+};
+
+// plays a trajectory back through a read only mapping. the frame headers are indexed when it opens, the
+// payloads are only touched as frames are read, and the frames after the current one are prefetched so a
+// sequential replay doesn't stall on page faults
+class TrajectoryReader
+{
+	struct Frame
+	{
+		TrajectoryFrameHeader header;
+		uint64_t offset;			// payload, from the start of the file
+		size_t keyframe;			// index of the frame a delta chain starts from
+	};
+
+	const uint8_t* base = nullptr;
+	uint64_t length = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+	TrajectoryHeader fileHeader = {};
+	std::vector<Frame> frames;
+
+	// quantised frames decode into positions, delta frames against the one before
+	PositionDecoder decoder;
+	std::vector<float> positions;
+	size_t decoded = SIZE_MAX;		// frame in positions and the decoder
+
+	uint64_t prefetchedTo = 0;		// end of the byte range already asked for
+
+	void release();
+	void decode(size_t index);
+
+public:
+	explicit TrajectoryReader(const std::string& path);
+	~TrajectoryReader();
+
+	TrajectoryReader(const TrajectoryReader&) = delete;
+	TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+	const TrajectoryHeader& header() const { return fileHeader; }
+	size_t count() const { return static_cast<size_t>(fileHeader.count); }
+	size_t frameCount() const { return frames.size(); }
+	const TrajectoryFrameHeader& frame(size_t index) const { return frames[index].header; }
+
+	// count x/y/z positions in id order, valid until the next read. raw frames point straight into the
+	// mapping. reading in order is cheapest - a delta frame out of order decodes forward from its keyframe
+	const float* read(size_t index);
+
+	// have the os start paging in the frames after index, up to ahead of them
+	void prefetch(size_t index, size_t ahead);
+};
@@ -27,47 +27,21 @@ void trans_simulation::frame()
 	renderer->updateCompute();		   // update 
 
 
+	// compute, copy into the draw storage, then draw from it - the copy waits on the compute and the last draw,
+	// the draw on the copy, and the next compute on the copy too
 	dispatchCompute();
+	copyComputeResults();
+	renderer->signalDrawn = true;
 	renderer->drawFrame();			   // render
-	computeTransfer();
+	lastDrawn = renderer->drawnSemaphore();
 
 }
 
-int trans_simulation::findTransferQueueFamily(VkPhysicalDevice pd)
-{
-	// find and return the index of compute queue family for device
-
-	int index = -1;
-
-	// as before, find them, set them
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, nullptr);
-
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(pd, &queueFamilyCount, queueFamilies.data());
-
-	// find suitable family that supports transfer.
-	unsigned int i = 0;
-	for (const auto& queueFamily : queueFamilies)
-	{
-
-		// check for Transfer support 
-		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT)
-		{
-			index = i;
-			break;
-		}
-		i++;
-	}
-
-	return index;
-}
-
 void trans_simulation::createCommandPools(QueueFamilyIndices& queueFamilyIndices, VkPhysicalDevice& phys)
 {
 	simulation::createCommandPools(queueFamilyIndices, phys); // call base class
 
-	int queueIndex = findTransferQueueFamily(phys);
+	int queueIndex = renderer->findTransferQueueFamily(phys);
 	// store value
 	vkGetDeviceQueue(device, queueIndex, 0, &transferQueue);
 
@@ -82,30 +56,46 @@ void trans_simulation::createCommandPools(QueueFamilyIndices& queueFamilyIndices
 // compute & transfer command buffers
 void trans_simulation::allocateComputeCommandBuffers()
 {
-	// Create a command buffer for compute operations
+	compute->createFrameResources(device, renderer->frameSlots, renderer->framesInFlight);
+
+	// allocate transfer command buffer
 	VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
 	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cmdBufAllocateInfo.commandPool = compute->commandPool;
+	cmdBufAllocateInfo.commandPool = transferPool;
 	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 	cmdBufAllocateInfo.commandBufferCount = 1;
-	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &compute->commandBuffer) != VK_SUCCESS)
-		throw std::runtime_error("Failed allocating buffer for compute commands");
-	// allocate transfer command buffer
-
-	cmdBufAllocateInfo.commandPool = transferPool;
 	if (vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &transferCmdBuffer) != VK_SUCCESS)
 		throw std::runtime_error("Failed allocating buffer for transfer commands");
 
-	// Fence for compute CB sync
-	VkFenceCreateInfo fenceCreateInfo{};
-	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-	if (vkCreateFence(device, &fenceCreateInfo, nullptr, &compute->fence) != VK_SUCCESS)
-		throw std::runtime_error("Failed creating compute fence");
+	// copy done, for the next compute and for this frame's draw - one per frame in flight
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	copied.resize(renderer->framesInFlight);
+	copiedForDraw.resize(renderer->framesInFlight);
+	for (uint32_t i = 0; i < renderer->framesInFlight; i++)
+	{
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &copied[i]) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &copiedForDraw[i]) != VK_SUCCESS)
+			throw std::runtime_error("Failed creating transfer semaphore");
+	}
 }
 
 void trans_simulation::recordComputeCommands()
 {
+	for (uint32_t slot = 0; slot < compute->commandBuffers.size(); slot++)
+		recordComputeCommand(slot);
+
+	// Set up memory barriers
+	// need for compute and draw
+
+	recordTransferCommands();
+}
+
+void trans_simulation::recordComputeCommand(uint32_t slot)
+{
+	VkCommandBuffer commandBuffer = compute->commandBuffers[slot];
+
 	// create command buffer
 	// Compute: Begin, bind pipeline, bind desc sets, dispatch calls, end.
 
@@ -113,29 +103,23 @@ void trans_simulation::recordComputeCommands()
 	VkCommandBufferBeginInfo cmdBufInfo{};
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-	if (vkBeginCommandBuffer(compute->commandBuffer, &cmdBufInfo) != VK_SUCCESS)
+	if (vkBeginCommandBuffer(commandBuffer, &cmdBufInfo) != VK_SUCCESS)
 		throw std::runtime_error("Compute command buffer failed to start");
 
-	// bind pipeline & desc sets
-	vkCmdBindPipeline(compute->commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipeline);
-	vkCmdBindDescriptorSets(compute->commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipelineLayout, 0, 1, &compute->descriptorSet, 0, 0);
+	// bind pipeline - recordSteps binds the descriptor sets for each substep
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute->pipeline);
 
-	vkCmdResetQueryPool(compute->commandBuffer, renderer->computeQueryPool, 0, 2);
-	vkCmdWriteTimestamp(compute->commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 0);
+	vkCmdResetQueryPool(commandBuffer, renderer->computeQueryPool, 2 * slot, 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 2 * slot);
 
-	// dispatch shader
-	vkCmdDispatch(compute->commandBuffer, renderer->PARTICLE_COUNT, 1, 1);
+	// dispatch shader, once per substep
+	compute->recordSteps(commandBuffer, compute->descriptorSet, compute->descriptorSet, renderer->PARTICLE_COUNT, slot);
 
-	vkCmdWriteTimestamp(compute->commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 1);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer->computeQueryPool, 2 * slot + 1);
 
 
 	// end cmd writing
-	vkEndCommandBuffer(compute->commandBuffer);
-
-	// Set up memory barriers
-	// need for compute and draw
-
-	recordTransferCommands();
+	vkEndCommandBuffer(commandBuffer);
 }
 
 void trans_simulation::recordTransferCommands()
@@ -143,7 +127,8 @@ void trans_simulation::recordTransferCommands()
 	// create commandBuffer
 	VkCommandBufferBeginInfo cmdBufInfo{};
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	//cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	// submitted every frame, so the last frame's copy can still be pending
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
 
 
 	VkBufferMemoryBarrier computeBarrier, drawBarrier;
@@ -223,52 +208,59 @@ void trans_simulation::recordTransferCommands()
 // copy compute results
 void trans_simulation::copyComputeResults()
 {
+	uint32_t slot = renderer->frameSlot();
+	uint32_t frame = slot % renderer->framesInFlight;
+
+	// straight after this frame's compute on the gpu, with no cpu check on it, and once the last draw has
+	// finished with the draw storage
+	VkSemaphore waits[2] = { compute->finished[slot], lastDrawn };
+	VkPipelineStageFlags waitStages[2] = { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT };
+	VkSemaphore signals[2] = { copied[frame], copiedForDraw[frame] };
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &transferCmdBuffer;
-	// Submit to queue asynchronously
-	vkResetFences(device, 1, &compute->fence);
-	if (vkQueueSubmit(transferQueue, 1, &submitInfo, compute->fence) != VK_SUCCESS)
+	submitInfo.waitSemaphoreCount = lastDrawn != VK_NULL_HANDLE ? 2 : 1;
+	submitInfo.pWaitSemaphores = waits;
+	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.signalSemaphoreCount = 2;
+	submitInfo.pSignalSemaphores = signals;
+
+	// Submit to queue asynchronously - the compute slot's fence covers it, as the next compute waits on the copy
+	if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
 		throw std::runtime_error("failed to submit transfer queue");
 
-}
-
-void trans_simulation::computeTransfer()
-{
-	// Check for compute operation results
-	if (VK_SUCCESS == vkGetFenceStatus(device, compute->fence))
-	{
-		copyComputeResults();
-
-	}
+	lastCopy = copied[frame];
+	lastDrawn = VK_NULL_HANDLE;
+	renderer->drawWait = copiedForDraw[frame];
 }
 
 void trans_simulation::dispatchCompute()
 {
-	auto fenceResult = vkWaitForFences(device, 1, &compute->fence, VK_TRUE, UINT64_MAX);
-	// Submit compute commands
-	while (fenceResult != VK_SUCCESS)
-	{
-		if (fenceResult == VK_ERROR_DEVICE_LOST)
-			throw std::runtime_error("device crashed");
+	uint32_t slot = renderer->frameSlot();
 
-		fenceResult = vkWaitForFences(device, 1, &compute->fence, VK_TRUE, UINT64_MAX);
-	};
+	// the submission framesInFlight frames back is done with the slot's ubo, so this frame's values can go in
+	compute->waitSlot(device, slot);
+	compute->writeUniforms(slot);
 
-	vkResetFences(device, 1, &compute->fence);
-	VkSubmitInfo computeSubmitInfo{};
-	computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	computeSubmitInfo.pCommandBuffers = &compute->commandBuffer;
-	computeSubmitInfo.commandBufferCount = 1;
+	// the last copy has to have read the particles before they change, and this frame's copy follows on
+	compute->waitSemaphore = lastCopy;
+	compute->waitStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	compute->signalSemaphore = compute->finished[slot];
+	lastCopy = VK_NULL_HANDLE;
 
-	if (vkQueueSubmit(compute->queue, 1, &computeSubmitInfo, compute->fence) != VK_SUCCESS)
-		throw std::runtime_error("failed to submit compute queue");
+	compute->submit(slot);
 }
 
 void trans_simulation::cleanup()
 {
+	for (uint32_t i = 0; i < copied.size(); i++)
+	{
+		vkDestroySemaphore(device, copied[i], nullptr);
+		vkDestroySemaphore(device, copiedForDraw[i], nullptr);
+	}
+
 	vkDestroyCommandPool(device, transferPool, nullptr);
 	compute->cleanup(device);
 }
@@ -0,0 +1,32 @@
+#include "uniform-ring.h"
+#include "renderer.h"
+#include <algorithm>
+#include <cstring>
+
+void UniformRing::create(VkDeviceSize size, uint32_t slots, VkDeviceSize minOffsetAlignment)
+{
+	blockSize = size;
+	slotCount = std::max(1u, slots);
+
+	VkDeviceSize alignment = std::max<VkDeviceSize>(minOffsetAlignment, 1);
+	stride = (size + alignment - 1) / alignment * alignment;
+
+	Renderer::get()->createBuffer(stride * slotCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
+}
+
+void UniformRing::destroy()
+{
+	Renderer::get()->destroyBuffer(buffer, memory);
+	slotCount = 0;
+}
+
+uint32_t UniformRing::offset(uint32_t slot) const
+{
+	return static_cast<uint32_t>(stride * (slot % slotCount));
+}
+
+void UniformRing::write(uint32_t slot, const void* data)
+{
+	memcpy(static_cast<uint8_t*>(memory.mapped) + offset(slot), data, static_cast<size_t>(blockSize));
+}
@@ -0,0 +1,31 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include "allocator.h"
+
+// a uniform block the host rewrites every frame, kept as one persistently mapped buffer of slots. each
+// recorded command buffer binds its own slot through a dynamic offset (VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC),
+// so the next frame's values go into a different slot from the one a submission in flight is reading.
+// a slot is only rewritten once the submission that last read it has finished
+class UniformRing
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	Allocation memory;
+	VkDeviceSize blockSize = 0;
+	VkDeviceSize stride = 0;					// blockSize rounded up to minUniformBufferOffsetAlignment
+	uint32_t slotCount = 0;
+
+public:
+	void create(VkDeviceSize size, uint32_t slots, VkDeviceSize minOffsetAlignment);
+	void destroy();
+
+	VkBuffer handle() const { return buffer; }
+	VkDeviceSize range() const { return blockSize; }
+	uint32_t slots() const { return slotCount; }
+
+	// dynamic offset to bind slot with
+	uint32_t offset(uint32_t slot) const;
+
+	// copy a block into slot - no driver calls, the memory is host coherent
+	void write(uint32_t slot, const void* data);
+};
@@ -0,0 +1,358 @@
+#include "upload-manager.h"
+#include "renderer.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// copy offsets into the ring - a multiple of every texel size uploaded
+const VkDeviceSize UPLOAD_ALIGNMENT = 16;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+void UploadManager::create(VkDevice dev, VkQueue transferQueue, uint32_t transferFamily, VkQueue graphicsQueue, uint32_t graphicsFamily,
+	VkDeviceSize size)
+{
+	device = dev;
+	queue = transferQueue;
+	family = transferFamily;
+	ownerQueue = graphicsQueue;
+	ownerFamily = graphicsFamily;
+	capacity = size;
+
+	// command buffers are reset and recorded again once their batch finishes
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = family;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create upload command pool");
+
+	if (transferOwnership())
+	{
+		poolInfo.queueFamilyIndex = ownerFamily;
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &ownerPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create upload acquire command pool");
+	}
+
+	Renderer::get()->createBuffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging, stagingMemory);
+}
+
+void UploadManager::destroy()
+{
+	wait(flush());
+
+	for (auto &b : spare)
+	{
+		vkDestroyFence(device, b.fence, nullptr);
+		if (b.copied != VK_NULL_HANDLE)
+			vkDestroySemaphore(device, b.copied, nullptr);
+	}
+	spare.clear();
+
+	// the command buffers go with their pools
+	vkDestroyCommandPool(device, pool, nullptr);
+	if (ownerPool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(device, ownerPool, nullptr);
+	pool = ownerPool = VK_NULL_HANDLE;
+
+	Renderer::get()->destroyBuffer(staging, stagingMemory);
+	capacity = head = used = 0;
+}
+
+VkDeviceSize UploadManager::reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (size > capacity)
+		throw std::runtime_error("upload larger than the staging ring");
+
+	for (;;)
+	{
+		// the free space runs from head round to the oldest batch's bytes - past the end it carries on at 0
+		VkDeviceSize offset = alignUp(head, alignment);
+		VkDeviceSize cost = offset - head + size;
+		if (offset + size > capacity)
+		{
+			offset = 0;
+			cost = capacity - head + size;
+		}
+
+		if (cost <= capacity - used)
+		{
+			head = offset + size;
+			used += cost;
+			open.bytes += cost;
+			return offset;
+		}
+
+		// hand over what is recorded so far, then wait for the oldest batch to give its space back
+		if (inFlight.empty())
+			flush();
+		retire();
+	}
+}
+
+UploadManager::Batch& UploadManager::current()
+{
+	if (recording)
+		return open;
+
+	VkDeviceSize bytes = open.bytes;
+
+	if (!spare.empty())
+	{
+		open = spare.back();
+		spare.pop_back();
+	}
+	else
+	{
+		open = Batch();
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = pool;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(device, &allocInfo, &open.commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("failed to allocate upload command buffer");
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		if (vkCreateFence(device, &fenceInfo, nullptr, &open.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to create upload fence");
+
+		if (transferOwnership())
+		{
+			allocInfo.commandPool = ownerPool;
+			if (vkAllocateCommandBuffers(device, &allocInfo, &open.acquire) != VK_SUCCESS)
+				throw std::runtime_error("failed to allocate upload acquire command buffer");
+
+			VkSemaphoreCreateInfo semaphoreInfo = {};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &open.copied) != VK_SUCCESS)
+				throw std::runtime_error("failed to create upload semaphore");
+		}
+	}
+
+	// reserve may already have counted ring bytes against it
+	open.bytes = bytes;
+	open.token = ++lastToken;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(open.commandBuffer, &beginInfo);
+
+	recording = true;
+	return open;
+}
+
+void UploadManager::retire()
+{
+	Batch batch = inFlight.front();
+	inFlight.pop_front();
+
+	vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device, 1, &batch.fence);
+
+	used -= batch.bytes;
+	if (used == 0)
+		head = 0;
+
+	batch.bytes = 0;
+	batch.bufferAcquires.clear();
+	batch.imageAcquires.clear();
+	spare.push_back(batch);
+}
+
+UploadToken UploadManager::upload(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+	const uint8_t* src = static_cast<const uint8_t*>(data);
+	VkDeviceSize piece = capacity / 4;
+	UploadToken token = submitted;
+
+	while (size > 0)
+	{
+		VkDeviceSize chunk = std::min(size, piece);
+		VkDeviceSize offset = reserve(chunk, UPLOAD_ALIGNMENT);
+		Batch& batch = current();
+
+		memcpy(static_cast<uint8_t*>(stagingMemory.mapped) + offset, src, static_cast<size_t>(chunk));
+
+		VkBufferCopy region = {};
+		region.srcOffset = offset;
+		region.dstOffset = dstOffset;
+		region.size = chunk;
+		vkCmdCopyBuffer(batch.commandBuffer, staging, dst, 1, &region);
+
+		if (transferOwnership())
+		{
+			// release here, acquired by the graphics queue once the copies are done
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.srcQueueFamilyIndex = family;
+			barrier.dstQueueFamilyIndex = ownerFamily;
+			barrier.buffer = dst;
+			barrier.offset = dstOffset;
+			barrier.size = chunk;
+
+			vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+				0, nullptr, 1, &barrier, 0, nullptr);
+
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+			batch.bufferAcquires.push_back(barrier);
+		}
+
+		token = batch.token;
+		src += chunk;
+		dstOffset += chunk;
+		size -= chunk;
+
+		// send a full batch off so the next one is filled while it copies
+		if (batch.bytes >= piece)
+			flush();
+	}
+
+	return token;
+}
+
+UploadToken UploadManager::uploadImage(VkImage image, const void* pixels, VkDeviceSize size, uint32_t width, uint32_t height)
+{
+	VkDeviceSize offset = reserve(size, UPLOAD_ALIGNMENT);
+	Batch& batch = current();
+
+	memcpy(static_cast<uint8_t*>(stagingMemory.mapped) + offset, pixels, static_cast<size_t>(size));
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+
+	// the whole image, which any transfer granularity allows
+	VkBufferImageCopy region = {};
+	region.bufferOffset = offset;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+
+	vkCmdCopyBufferToImage(batch.commandBuffer, staging, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	if (transferOwnership())
+	{
+		// the layout change happens once, between the release and the acquire
+		barrier.srcQueueFamilyIndex = family;
+		barrier.dstQueueFamilyIndex = ownerFamily;
+		barrier.dstAccessMask = 0;
+
+		vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		batch.imageAcquires.push_back(barrier);
+	}
+	else
+	{
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	UploadToken token = batch.token;
+	if (batch.bytes >= capacity / 4)
+		flush();
+
+	return token;
+}
+
+UploadToken UploadManager::flush()
+{
+	if (!recording)
+		return submitted;
+
+	vkEndCommandBuffer(open.commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &open.commandBuffer;
+
+	if (!transferOwnership())
+	{
+		if (vkQueueSubmit(queue, 1, &submitInfo, open.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit uploads");
+	}
+	else
+	{
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &open.copied;
+		if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit uploads");
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(open.acquire, &beginInfo);
+
+		vkCmdPipelineBarrier(open.acquire, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+			static_cast<uint32_t>(open.bufferAcquires.size()), open.bufferAcquires.data(),
+			static_cast<uint32_t>(open.imageAcquires.size()), open.imageAcquires.data());
+
+		vkEndCommandBuffer(open.acquire);
+
+		// the fence goes on the acquire, which can't start before the copies are done
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo acquireInfo = {};
+		acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireInfo.waitSemaphoreCount = 1;
+		acquireInfo.pWaitSemaphores = &open.copied;
+		acquireInfo.pWaitDstStageMask = &waitStage;
+		acquireInfo.commandBufferCount = 1;
+		acquireInfo.pCommandBuffers = &open.acquire;
+
+		if (vkQueueSubmit(ownerQueue, 1, &acquireInfo, open.fence) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit upload acquires");
+	}
+
+	submitted = open.token;
+	inFlight.push_back(open);
+	open = Batch();
+	recording = false;
+
+	return submitted;
+}
+
+void UploadManager::wait(UploadToken token)
+{
+	if (recording && open.token <= token)
+		flush();
+
+	while (!inFlight.empty() && inFlight.front().token <= token)
+		retire();
+}
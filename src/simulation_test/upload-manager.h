@@ -0,0 +1,85 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "allocator.h"
+
+// staging ring size - big uploads are cut into quarter ring pieces so one batch copies while the next is filled
+const VkDeviceSize UPLOAD_RING_SIZE = VkDeviceSize(32) << 20;
+
+// identifies the batch an upload went into. batches finish in order, so waiting on one waits on all before it
+typedef uint64_t UploadToken;
+
+// host to device uploads, staged through one persistently mapped ring and recorded into a shared command buffer
+// on the transfer queue rather than a submit and queue wait per copy. a batch goes when flushed (or when it
+// holds a quarter of the ring) with a fence, and only a caller that needs the data waits on its token.
+// when the transfer family isn't the graphics one, every upload is released by the copy and acquired on
+// the graphics queue in the same batch, so the buffers and images can stay exclusive
+class UploadManager
+{
+	struct Batch
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;	// copies, on the transfer queue
+		VkCommandBuffer acquire = VK_NULL_HANDLE;		// ownership acquires, on the graphics queue
+		VkSemaphore copied = VK_NULL_HANDLE;			// copies done, the acquires wait on it
+		VkFence fence = VK_NULL_HANDLE;					// signalled once the whole batch has finished
+		VkDeviceSize bytes = 0;							// ring bytes it holds, padding included
+		UploadToken token = 0;
+
+		std::vector<VkBufferMemoryBarrier> bufferAcquires;
+		std::vector<VkImageMemoryBarrier> imageAcquires;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue queue = VK_NULL_HANDLE;
+	VkQueue ownerQueue = VK_NULL_HANDLE;
+	uint32_t family = 0;
+	uint32_t ownerFamily = 0;
+	VkCommandPool pool = VK_NULL_HANDLE;
+	VkCommandPool ownerPool = VK_NULL_HANDLE;
+
+	VkBuffer staging = VK_NULL_HANDLE;
+	Allocation stagingMemory;
+	VkDeviceSize capacity = 0;
+	VkDeviceSize head = 0;			// next free byte
+	VkDeviceSize used = 0;			// bytes from the oldest unfinished batch round to head
+
+	Batch open;						// being recorded
+	bool recording = false;
+	std::deque<Batch> inFlight;		// submitted, oldest first
+	std::vector<Batch> spare;		// finished, to be recorded again
+
+	UploadToken lastToken = 0;
+	UploadToken submitted = 0;
+
+	bool transferOwnership() const { return family != ownerFamily; }
+
+	// space for size bytes in the ring, waiting on the oldest batches until there is
+	VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment);
+
+	// the batch being recorded, started if there isn't one
+	Batch& current();
+
+	// wait on the oldest batch and hand its ring space back
+	void retire();
+
+public:
+	// queue and family do the copies, the uploads are then owned by ownerFamily (graphics)
+	void create(VkDevice dev, VkQueue transferQueue, uint32_t transferFamily, VkQueue graphicsQueue, uint32_t graphicsFamily,
+		VkDeviceSize size = UPLOAD_RING_SIZE);
+	void destroy();
+
+	// copy size bytes of data to dst at dstOffset
+	UploadToken upload(VkBuffer dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+	// fill a whole single mip 2d rgba8 image and leave it shader read only. the pixels have to fit in the ring
+	UploadToken uploadImage(VkImage image, const void* pixels, VkDeviceSize size, uint32_t width, uint32_t height);
+
+	// submit what has been recorded, the token covers every upload so far
+	UploadToken flush();
+
+	// block until the batch with token (and every one before it) has finished - flushed first if need be
+	void wait(UploadToken token);
+};